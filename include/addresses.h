@@ -23,10 +23,18 @@
 #define _ADDRESSES_H_
 
 #include "list.h"
+#include "objindex.h"
 #include "config.h"
 
+struct port_range {
+	int					first;
+	int					last;
+};
+
 struct address {
 	struct list_head	list;
+	struct objindex_node	hnode;
+	struct list_head	dirty;
 	int					action;
 	char				*name;
 	char				*fqdn;
@@ -46,7 +54,8 @@ struct address {
 	int					policies_action;
 	int					used;
 	int					nft_chains;
-	int					port_list[NFTLB_MAX_PORTS];
+	struct port_range	*port_ranges;
+	int					nport_ranges;
 	int					nports;
 };
 
@@ -55,6 +64,8 @@ int address_changed(struct config_pair *c);
 void address_s_print(void);
 void address_s_farm_print(struct farm *f);
 struct address * address_lookup_by_name(const char *name);
+void address_rename(struct address *a, char *name);
+void address_set_dirty(struct address *a);
 int address_pre_actionable(struct config_pair *c);
 int address_pos_actionable(struct config_pair *c);
 int address_set_attribute(struct config_pair *c);
@@ -73,6 +84,8 @@ int address_set_protocol(struct address *a, int new_value);
 int address_not_used(struct address *a);
 int address_delete(struct address *paddress);
 int address_search_array_port(struct address *a, int port);
+int address_next_port_range(struct address *a, int *index, int *first, int *last);
+int address_get_first_port(struct address *a);
 int address_validate_iface(struct address *a);
 int address_validate_iether(struct address *a);
 int address_s_clean_nft_chains(void);
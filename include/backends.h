@@ -23,9 +23,12 @@
 #define _BACKENDS_H_
 
 #include "farms.h"
+#include "objindex.h"
 
 struct backend {
 	struct list_head	list;
+	struct objindex_node	hnode;
+	struct objindex_node	ipnode;
 	struct farm		*parent;
 	int			action;
 	char			*name;
@@ -58,6 +61,7 @@ int backend_s_delete(struct farm *f);
 int backend_set_attribute(struct config_pair *c);
 int backend_set_state(struct backend *b, int new_value);
 int backend_s_set_ether_by_ipaddr(struct farm *f, const char *ip_bck, char *ether_bck);
+struct backend * backend_next_by_ipaddr(const char *ipaddr, struct backend *prev);
 int backend_s_set_netinfo(struct farm *f);
 
 struct backend * backend_get_first(struct farm *f);
@@ -56,6 +56,11 @@
 #define CONFIG_KEY_BCKS			"backends"
 #define CONFIG_KEY_WEIGHT		"weight"
 #define CONFIG_KEY_PRIORITY		"priority"
+#define CONFIG_KEY_FARM			"farm"
+#define CONFIG_KEY_BCK			"backend"
+#define CONFIG_KEY_STATES		"states"
+#define CONFIG_KEY_RESULTS		"results"
+#define CONFIG_KEY_RESPONSE		"response"
 #define CONFIG_KEY_ACTION		"action"
 #define CONFIG_KEY_LIMITSTTL	"limits-ttl"
 #define CONFIG_KEY_NEWRTLIMIT	"new-rtlimit"
@@ -178,9 +183,13 @@ void config_delete_output(void);
 void config_set_output(char *fmt, ...);
 int config_file(const char *file);
 int config_buffer(const char *buf, int apply_action);
-int config_print_farms(char **buf, char *name);
-int config_print_farm_sessions(char **buf, char *name);
-int config_print_policies(char **buf, char *name);
+#define CONFIG_DUMP_COMPACT		(1 << 0)
+
+typedef int (*config_writer)(void *data, const char *buf, size_t len);
+
+int config_dump_farms(config_writer write, void *data, int flags, char *name);
+int config_dump_farm_sessions(config_writer write, void *data, int flags, char *name);
+int config_dump_policies(config_writer write, void *data, int flags, char *name);
 int config_set_farm_action(const char *name, const char *value);
 int config_set_session_backend_action(const char *fname, const char *bname, const char *value);
 int config_set_backend_action(const char *fname, const char *bname, const char *value);
@@ -195,5 +204,10 @@ int config_set_address_action(const char *name, const char *value);
 int config_set_farmaddress_action(const char *fname, const char *faname, const char *value);
 int config_print_addresses(char **buf, char *name);
 int config_check_policy(const char *name);
+int config_set_backends_state(const char *data, char **buf);
+unsigned long config_get_generation(const char *name);
+unsigned long config_get_policy_generation(const char *name);
+const char *config_set_backend_value(const char *fname, const char *bname,
+				     const char *key, const char *value);
 
 #endif /* _CONFIG_H_ */
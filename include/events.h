@@ -36,5 +36,20 @@ struct ev_io *events_get_srv(void);
 struct ev_io *events_create_srv(void);
 void events_delete_srv(void);
 
+struct ev_io *events_get_srv_unix(void);
+struct ev_io *events_create_srv_unix(void);
+void events_delete_srv_unix(void);
+struct ev_io *events_get_srv_line(void);
+struct ev_io *events_create_srv_line(void);
+void events_delete_srv_line(void);
+
+struct ev_timer *events_get_commit(void);
+struct ev_timer *events_create_commit(void);
+void events_delete_commit(void);
+
+struct ev_async *events_get_worker(void);
+struct ev_async *events_create_worker(void);
+void events_delete_worker(void);
+
 
 #endif /* _EVENTS_H_ */
@@ -24,9 +24,11 @@
 
 #include "farms.h"
 #include "addresses.h"
+#include "objindex.h"
 
 struct farmaddress {
 	struct list_head	list;
+	struct objindex_node	hnode;
 	struct farm			*farm;
 	struct address		*address;
 	int					action;
@@ -23,6 +23,7 @@
 #define _FARMS_H_
 
 #include "list.h"
+#include "objindex.h"
 #include "config.h"
 #include "nftst.h"
 
@@ -98,11 +99,15 @@ enum switches {
 #define VALUE_RLD_TCPSTRICT_STOP			(1 << 8)
 #define VALUE_RLD_QUEUE_STOP				(1 << 9)
 
+#define VALUE_RLD_BCKS_STATE				(1 << 10)
+
 #define STATEFUL_RLD_START(x)				(x & VALUE_RLD_NEWRTLIMIT_START) || (x & VALUE_RLD_RSTRTLIMIT_START) || (x & VALUE_RLD_ESTCONNLIMIT_START) || (x & VALUE_RLD_TCPSTRICT_START)
 #define STATEFUL_RLD_STOP(x)				(x & VALUE_RLD_NEWRTLIMIT_STOP) || (x & VALUE_RLD_RSTRTLIMIT_STOP) || (x & VALUE_RLD_ESTCONNLIMIT_STOP) || (x & VALUE_RLD_TCPSTRICT_STOP)
 
 struct farm {
 	struct list_head	list;
+	struct objindex_node	hnode;
+	struct list_head	dirty;
 	int			action;
 	int			reload_action;
 	char			*name;
@@ -152,6 +157,10 @@ struct farm {
 	int			policies_action;
 	int			policies_used;
 	int			nft_chains;
+	int			nft_bck_maps;
+	int			nft_bck_slots;
+	int			nft_bck_shape;
+	unsigned long		generation;
 	struct list_head	backends;
 	struct list_head	policies;
 	int					total_timed_sessions;
@@ -165,6 +174,8 @@ struct farm {
 struct list_head * farm_s_get_head(void);
 int farm_set_priority(struct farm *f, int new_value);
 void farm_s_print(void);
+void farm_set_changed(struct farm *f);
+void farm_set_dirty(struct farm *f);
 int farm_is_ingress_mode(struct farm *f);
 int farm_needs_policies(struct farm *f);
 int farm_has_source_address(struct farm *f);
@@ -183,6 +194,7 @@ int farm_pos_actionable(struct config_pair *c);
 
 int farm_set_attribute(struct config_pair *c);
 int farm_set_action(struct farm *f, int action);
+int farm_set_bcks_action(struct farm *f);
 int farm_s_set_action(int action);
 int farm_get_masquerade(struct farm *f);
 void farm_s_set_backend_ether_by_oifidx(int interface_idx, const char * ip_bck, char * ether_bck);
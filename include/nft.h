@@ -22,16 +22,35 @@
 #ifndef _NFT_H_
 #define _NFT_H_
 
+#include <stdio.h>
+
 #include "farms.h"
+#include "sbuffer.h"
 
 #define NFTLB_MASQUERADE_MARK_DEFAULT		0x80000000
 
+#define NFTLB_BACKEND_TEXT					0
+#define NFTLB_BACKEND_NETLINK				1
+
+typedef void (*nft_commit_fn)(unsigned long seq, int error);
+
 int nft_reset(void);
 int nft_check_tables(void);
+int nft_adopt_begin(void);
+int nft_adopt_commit(void);
 int nft_rulerize_farms(struct farm *f);
 int nft_rulerize_address(struct address *a);
 int nft_rulerize_policies(struct policy *p);
 int nft_get_rules_buffer(const char **buf, int key, struct nftst *n);
 void nft_del_rules_buffer(const char *buf);
+int nft_batch_begin(void);
+int nft_batch_commit(void);
+int nft_async_start(nft_commit_fn cb);
+void nft_async_stop(void);
+unsigned long nft_get_commit_seq(void);
+void nft_compile_start(FILE *out);
+void nft_compile_stop(void);
+void nft_fini(void);
+int nft_dump_metrics(struct sbuffer *buf);
 
 #endif /* _NFT_H_ */
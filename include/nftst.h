@@ -34,6 +34,7 @@ struct nftst {
 	struct backend *backend;
 	struct policy *policy;
 	int action;
+	int bck_maps;
 };
 
 struct nftst *nftst_create_from_farm(struct farm *f);
@@ -56,6 +57,8 @@ int nftst_get_family(struct nftst *n);
 int nftst_get_proto(struct nftst *n);
 int nftst_get_chains(struct nftst *n);
 void nftst_set_chains(struct nftst *n, int chains);
+void nftst_set_bck_maps(struct nftst *n, int maps);
+int nftst_get_bck_maps(struct nftst *n);
 int nftst_actions_done(struct nftst *n);
 int nftst_has_farm(struct nftst *n);
 int nftst_has_address(struct nftst *n);
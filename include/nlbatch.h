@@ -0,0 +1,79 @@
+/*
+ *   This file is part of nftlb, nftables load balancer.
+ *
+ *   Copyright (C) ZEVENET SL.
+ *   Author: Laura Garcia <laura.garcia@zevenet.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Affero General Public License as
+ *   published by the Free Software Foundation, either version 3 of the
+ *   License, or any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Affero General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Affero General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _NLBATCH_H_
+#define _NLBATCH_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define NLBATCH_MAX_NAME		256
+
+struct nlmsghdr;
+struct nlattr;
+
+/*
+ * Intervals of an interval set as the kernel stores them: the end is the
+ * first address out of the range, or none if it reaches the end of the
+ * address space.
+ */
+struct nlbatch_range {
+	unsigned char		start[16];
+	unsigned char		end[16];
+	int					open_end;
+};
+
+struct nlbatch_ranges {
+	struct nlbatch_range	*r;
+	unsigned int		n;
+	unsigned int		size;
+	int					len;
+};
+
+struct nlbatch {
+	char				*data;
+	size_t				size;
+	size_t				len;
+	uint32_t			seq_first;
+	uint32_t			seq;
+	unsigned int		msgs;
+	int					error;
+	struct nlmsghdr		*cur;
+	struct nlattr		*cur_elems;
+	int					cur_family;
+	int					cur_action;
+	char				cur_set[NLBATCH_MAX_NAME];
+};
+
+int nlbatch_begin(struct nlbatch *b);
+int nlbatch_is_empty(struct nlbatch *b);
+int nlbatch_set_elem(struct nlbatch *b, int nfproto, const char *set, const void *key, int keylen, uint32_t flags, int action);
+int nlbatch_map_elem(struct nlbatch *b, int nfproto, const char *set, const void *key, int keylen,
+		     const void *data, int datalen, uint32_t flags);
+int nlbatch_set_flush(struct nlbatch *b, int nfproto, const char *set);
+int nlbatch_ranges_add(struct nlbatch_ranges *rs, int family, const char *data);
+int nlbatch_set_ranges(struct nlbatch *b, int nfproto, const char *set, struct nlbatch_ranges *rs);
+void nlbatch_ranges_free(struct nlbatch_ranges *rs);
+int nlbatch_commit(struct nlbatch *b);
+void nlbatch_end(struct nlbatch *b);
+void nlbatch_fini(void);
+
+#endif /* _NLBATCH_H_ */
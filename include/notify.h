@@ -0,0 +1,35 @@
+/*
+ *   This file is part of nftlb, nftables load balancer.
+ *
+ *   Copyright (C) ZEVENET SL.
+ *   Author: Laura Garcia <laura.garcia@zevenet.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Affero General Public License as
+ *   published by the Free Software Foundation, either version 3 of the
+ *   License, or any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Affero General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Affero General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _NOTIFY_H_
+#define _NOTIFY_H_
+
+#define NOTIFY_EVENT_FARM		"farm"
+#define NOTIFY_EVENT_BACKEND		"backend"
+#define NOTIFY_EVENT_NEIGH		"neighbour"
+#define NOTIFY_EVENT_COMMIT		"commit"
+
+typedef void (*notify_fn)(const char *event, const char *data);
+
+void notify_set_handler(notify_fn handler);
+void notify_event(const char *event, const char *fmt, ...);
+
+#endif /* _NOTIFY_H_ */
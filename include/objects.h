@@ -22,6 +22,9 @@
 #ifndef _OBJECTS_H_
 #define _OBJECTS_H_
 
+#include "sbuffer.h"
+#include "slab.h"
+
 #define NFTLB_MAX_PORTS				65535
 
 #define DEFAULT_NAME		""
@@ -205,6 +208,10 @@ struct obj_config {
 
 void objects_init(void);
 struct list_head * obj_get_farms(void);
+unsigned long obj_get_generation(void);
+unsigned long obj_new_generation(void);
+unsigned long obj_get_shared_generation(void);
+void obj_set_shared_changed(void);
 int obj_get_total_farms(void);
 void obj_set_total_farms(int new_value);
 int obj_get_dsr_counter(void);
@@ -244,6 +251,7 @@ char * obj_print_state(int state);
 char * obj_print_switch(int value);
 int obj_set_attribute(struct config_pair *c, int actionable, int apply_action);
 int obj_set_attribute_string(char *src, char **dst);
+int obj_set_attribute_shared(char *src, char **dst);
 int obj_equ_attribute_string(char *stra, char *strb);
 void obj_set_attribute_int(int *src, int value);
 int obj_equ_attribute_int(int valuea, int valueb);
@@ -261,5 +269,6 @@ int obj_get_total_addresses(void);
 struct list_head * obj_get_addresses(void);
 void obj_set_total_addresses(int new_value);
 int obj_recovery(void);
+int obj_dump_metrics(struct sbuffer *buf);
 
 #endif /* _OBJECTS_H_ */
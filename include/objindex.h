@@ -0,0 +1,51 @@
+/*
+ *   This file is part of nftlb, nftables load balancer.
+ *
+ *   Copyright (C) ZEVENET SL.
+ *   Author: Laura Garcia <laura.garcia@zevenet.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Affero General Public License as
+ *   published by the Free Software Foundation, either version 3 of the
+ *   License, or any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Affero General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Affero General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _OBJINDEX_H_
+#define _OBJINDEX_H_
+
+#include "list.h"
+
+/*
+ * Hash index of objects, kept alongside the intrusive lists so lookups
+ * by key don't walk the whole list. The objects embed a node and every
+ * lookup compares its own key on the entries of the bucket with the same
+ * hash.
+ */
+struct objindex_node {
+	struct hlist_node	node;
+	unsigned int		hash;
+};
+
+struct objindex {
+	struct hlist_head	*buckets;
+	unsigned int		size;
+	unsigned int		count;
+};
+
+unsigned int objindex_hash_str(const char *key, unsigned int seed);
+unsigned int objindex_hash_ptr(const void *ptr, unsigned int seed);
+int objindex_add(struct objindex *idx, struct objindex_node *n, unsigned int hash);
+void objindex_del(struct objindex *idx, struct objindex_node *n);
+struct hlist_head *objindex_bucket(struct objindex *idx, unsigned int hash);
+void objindex_free(struct objindex *idx);
+
+#endif /* _OBJINDEX_H_ */
@@ -23,6 +23,7 @@
 #define _POLICIES_H_
 
 #include "list.h"
+#include "objindex.h"
 #include "config.h"
 
 enum type {
@@ -37,6 +38,8 @@ enum route {
 
 struct policy {
 	struct list_head	list;
+	struct objindex_node	hnode;
+	struct list_head	dirty;
 	char				*name;
 	int					type;
 	int					route;
@@ -46,6 +49,7 @@ struct policy {
 	int					used;
 	char				*logprefix;
 	int					action;
+	unsigned long		generation;
 	struct list_head	elements;
 };
 
@@ -55,6 +59,8 @@ struct policy * policy_lookup_by_name(const char *name);
 int policy_changed(struct config_pair *c);
 int policy_set_attribute(struct config_pair *c);
 int policy_set_action(struct policy *p, int action);
+void policy_set_dirty(struct policy *p);
+void policy_set_changed(struct policy *p);
 int policy_s_set_action(int action);
 int policy_pre_actionable(struct config_pair *c);
 int policy_pos_actionable(struct config_pair *c);
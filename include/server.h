@@ -28,5 +28,9 @@ void server_set_host(const char *host);
 void server_set_port(const char *port);
 void server_set_key(char *key);
 void server_set_ipv6(void);
+void server_set_unix(const char *path);
+void server_set_line_port(const char *port);
+int server_set_commit_window(int msecs);
+void server_set_timing(void);
 
 #endif /* _SERVER_H_ */
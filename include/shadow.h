@@ -0,0 +1,31 @@
+/*
+ *   This file is part of nftlb, nftables load balancer.
+ *
+ *   Copyright (C) ZEVENET SL.
+ *   Author: Laura Garcia <laura.garcia@zevenet.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Affero General Public License as
+ *   published by the Free Software Foundation, either version 3 of the
+ *   License, or any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Affero General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Affero General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _SHADOW_H_
+#define _SHADOW_H_
+
+#include "sbuffer.h"
+
+int shadow_filter(const char *script, struct sbuffer *out);
+void shadow_reset(void);
+void shadow_fini(void);
+
+#endif /* _SHADOW_H_ */
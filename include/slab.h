@@ -0,0 +1,73 @@
+/*
+ *   This file is part of nftlb, nftables load balancer.
+ *
+ *   Copyright (C) ZEVENET SL.
+ *   Author: Laura Garcia <laura.garcia@zevenet.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Affero General Public License as
+ *   published by the Free Software Foundation, either version 3 of the
+ *   License, or any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Affero General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Affero General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _SLAB_H_
+#define _SLAB_H_
+
+#include <stddef.h>
+
+#include "list.h"
+#include "sbuffer.h"
+
+/*
+ * Typed pools of fixed size objects carved out of aligned chunks, so the
+ * owner chunk of an object is found by masking its address. The chunks
+ * with free slots are kept in the pool list and released once they're
+ * empty, but one of them is kept as a reserve for bulk deletes followed
+ * by creates.
+ */
+#define SLAB_CHUNK_SIZE		16384
+#define SLAB_ALIGN		8
+
+struct slab_pool {
+	struct list_head	list;
+	struct list_head	chunks;
+	const char		*name;
+	size_t			size;
+	unsigned int		per_chunk;
+	unsigned int		empty;
+	unsigned long		used;
+	unsigned long		total_chunks;
+	unsigned long		allocs;
+};
+
+#define SLAB_POOL(var, pname, type)						\
+	struct slab_pool var = {						\
+		.list = LIST_HEAD_INIT(var.list),				\
+		.chunks = LIST_HEAD_INIT(var.chunks),				\
+		.name = pname,							\
+		.size = (sizeof(type) + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1),	\
+	}
+
+void *slab_alloc(struct slab_pool *pool);
+void slab_free(struct slab_pool *pool, void *obj);
+
+/*
+ * Interned strings shared by reference for the attributes repeated
+ * across many objects, like counters, timeouts, log prefixes or ether
+ * addresses. They must never be modified in place.
+ */
+char *slab_str_get(const char *str);
+void slab_str_put(char *str);
+
+int slab_dump_metrics(struct sbuffer *buf);
+
+#endif /* _SLAB_H_ */
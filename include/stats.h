@@ -0,0 +1,89 @@
+/*
+ *   This file is part of nftlb, nftables load balancer.
+ *
+ *   Copyright (C) ZEVENET SL.
+ *   Author: Laura Garcia <laura.garcia@zevenet.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Affero General Public License as
+ *   published by the Free Software Foundation, either version 3 of the
+ *   License, or any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Affero General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Affero General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stdint.h>
+
+#include "sbuffer.h"
+
+enum stats_phase {
+	STATS_PHASE_PARSE,	// http request parsing
+	STATS_PHASE_JSON,	// json payload parsing
+	STATS_PHASE_APPLY,	// changes applied to the objects
+	STATS_PHASE_RULES,	// nft scripts generation
+	STATS_PHASE_COMMIT,	// nft scripts committed to the kernel
+	STATS_PHASE_TOTAL,
+	STATS_PHASE_MAX,
+};
+
+/* bucket i counts the samples up to 2^i usecs, the last one the rest */
+#define STATS_HIST_BUCKETS	24
+
+enum stats_counter {
+	STATS_CNT_NFT_CMDS,		// nft scripts and netlink batches committed
+	STATS_CNT_NFT_BYTES,		// bytes of the committed nft scripts and batches
+	STATS_CNT_NFT_ERRORS,		// commits refused by the kernel
+	STATS_CNT_RECOVERY,		// successful recoveries of the ruleset
+	STATS_CNT_RECOVERY_FAILED,
+	STATS_CNT_NETLINK_EVENTS,	// neighbour messages received from the kernel
+	STATS_CNT_MAX,
+};
+
+struct stats_hist {
+	unsigned long		count;
+	uint64_t		sum;
+	unsigned long		bucket[STATS_HIST_BUCKETS];
+};
+
+/*
+ * Phases may be nested, like a commit done while the changes are applied,
+ * so every phase only accounts the time not spent in the nested ones.
+ */
+struct stats_timer {
+	int			phase;
+	uint64_t		start;
+	uint64_t		nested;
+	struct stats_timer	*parent;
+};
+
+struct stats_request {
+	uint64_t		start;
+	uint64_t		phase[STATS_PHASE_MAX];
+};
+
+uint64_t stats_now(void);
+void stats_phase_begin(struct stats_timer *t, int phase);
+void stats_phase_end(struct stats_timer *t);
+void stats_request_init(struct stats_request *r);
+void stats_request_set(struct stats_request *r);
+void stats_request_done(struct stats_request *r, const char *endpoint);
+const char *stats_phase_name(int phase);
+void stats_hist_add(struct stats_hist *h, uint64_t nsecs);
+int stats_dump_latency(struct sbuffer *buf);
+void stats_count(int counter, unsigned long n);
+void stats_rulerize_done(uint64_t nsecs);
+void stats_http_response(int code);
+void stats_metric_header(struct sbuffer *buf, const char *name, const char *type, const char *help);
+int stats_dump_metrics(struct sbuffer *buf);
+
+#endif /* _STATS_H_ */
@@ -0,0 +1,47 @@
+/*
+ *   This file is part of nftlb, nftables load balancer.
+ *
+ *   Copyright (C) ZEVENET SL.
+ *   Author: Laura Garcia <laura.garcia@zevenet.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Affero General Public License as
+ *   published by the Free Software Foundation, either version 3 of the
+ *   License, or any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Affero General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Affero General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#ifndef _WORKER_H_
+#define _WORKER_H_
+
+#include "list.h"
+
+struct worker_job {
+	struct list_head	list;
+	unsigned long		seq;
+	char				*cmd;
+	char				*full;
+	unsigned int		epoch;
+	int					error;
+};
+
+typedef int (*worker_exec_fn)(struct worker_job *job);
+typedef void (*worker_done_fn)(struct worker_job *job);
+
+int worker_start(worker_exec_fn exec, worker_done_fn done);
+void worker_stop(void);
+int worker_is_running(void);
+unsigned long worker_submit(const char *cmd, const char *full, unsigned int epoch);
+unsigned long worker_get_seq(void);
+void worker_lock(void);
+void worker_unlock(void);
+
+#endif /* _WORKER_H_ */
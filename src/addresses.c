@@ -36,11 +36,23 @@
 #include "tools.h"
 
 
+static SLAB_POOL(addresses_pool, "addresses", struct address);
+
+static struct objindex addresses_index;
+
+/* addresses with an action pending, the only ones to be rulerized */
+static LIST_HEAD(addresses_dirty);
+
+static unsigned int address_hash(const char *name)
+{
+	return objindex_hash_str(name, 0);
+}
+
 struct address * address_create(char *name)
 {
 	struct list_head *addresses = obj_get_addresses();
 
-	struct address *paddress = (struct address *)malloc(sizeof(struct address));
+	struct address *paddress = (struct address *)slab_alloc(&addresses_pool);
 	if (!paddress) {
 		tools_printlog(LOG_ERR, "Address memory allocation error");
 		return NULL;
@@ -48,6 +60,12 @@ struct address * address_create(char *name)
 
 	obj_set_attribute_string(name, &paddress->name);
 
+	if (objindex_add(&addresses_index, &paddress->hnode, address_hash(name))) {
+		free(paddress->name);
+		slab_free(&addresses_pool, paddress);
+		return NULL;
+	}
+
 	paddress->fqdn = DEFAULT_FQDN;
 	paddress->iface = DEFAULT_IFNAME;
 	paddress->iethaddr = DEFAULT_ETHADDR;
@@ -58,16 +76,20 @@ struct address * address_create(char *name)
 	paddress->protocol = DEFAULT_PROTO;
 	paddress->action = DEFAULT_ACTION;
 	paddress->verdict = DEFAULT_VERDICT;
-	paddress->logprefix = DEFAULT_LOG_LOGPREFIX_ADDRESS;
+	paddress->logprefix = slab_str_get(DEFAULT_LOG_LOGPREFIX_ADDRESS);
 	paddress->logrtlimit = DEFAULT_LOG_RTLIMIT;
 	paddress->logrtlimit_unit = DEFAULT_RTLIMIT_UNIT;
 	paddress->policies_action = ACTION_NONE;
+	init_list_head(&paddress->dirty);
+	address_set_dirty(paddress);
 
 	init_list_head(&paddress->policies);
 
 	paddress->policies_used = 0;
 	paddress->used = 0;
 	paddress->nft_chains = 0;
+	paddress->port_ranges = NULL;
+	paddress->nport_ranges = 0;
 	paddress->nports = 0;
 
 	list_add_tail(&paddress->list, addresses);
@@ -85,6 +107,8 @@ int address_delete(struct address *paddress)
 				   __FUNCTION__, __LINE__, paddress->name);
 
 	list_del(&paddress->list);
+	list_del(&paddress->dirty);
+	objindex_del(&addresses_index, &paddress->hnode);
 
 	if (paddress->name && strcmp(paddress->name, "") != 0)
 		free(paddress->name);
@@ -98,10 +122,11 @@ int address_delete(struct address *paddress)
 		free(paddress->ipaddr);
 	if (paddress->ports && strcmp(paddress->ports, "") != 0)
 		free(paddress->ports);
-	if (paddress->logprefix && strcmp(paddress->logprefix, DEFAULT_LOG_LOGPREFIX_ADDRESS) != 0)
-		free(paddress->logprefix);
+	slab_str_put(paddress->logprefix);
+	if (paddress->port_ranges)
+		free(paddress->port_ranges);
 
-	free(paddress);
+	slab_free(&addresses_pool, paddress);
 	obj_set_total_addresses(obj_get_total_addresses() - 1);
 
 	return 0;
@@ -114,40 +139,101 @@ static void address_get_range_ports(const char *ptr, int *first, int *last)
 
 int address_search_array_port(struct address *a, int port)
 {
-	if (a->port_list[port-1])
-		return 1;
+	int low = 0;
+	int high = a->nport_ranges - 1;
+	int mid;
+
+	while (low <= high) {
+		mid = (low + high) / 2;
+		if (port < a->port_ranges[mid].first)
+			high = mid - 1;
+		else if (port > a->port_ranges[mid].last)
+			low = mid + 1;
+		else
+			return 1;
+	}
 
 	return 0;
 }
 
-static void address_add_array_port(struct address *a, int port)
+/*
+ * Iterate over the virtual port ranges of the address in ascending
+ * order, *index has to be 0 for the first call. Returns 0 once there
+ * are no more ranges.
+ */
+int address_next_port_range(struct address *a, int *index, int *first, int *last)
+{
+	if (*index < 0 || *index >= a->nport_ranges)
+		return 0;
+
+	*first = a->port_ranges[*index].first;
+	*last = a->port_ranges[*index].last;
+	(*index)++;
+
+	return 1;
+}
+
+int address_get_first_port(struct address *a)
+{
+	if (a->nport_ranges == 0)
+		return 0;
+
+	return a->port_ranges[0].first;
+}
+
+static int address_cmp_port_range(const void *r1, const void *r2)
+{
+	return ((const struct port_range *)r1)->first - ((const struct port_range *)r2)->first;
+}
+
+static int address_add_port_range(struct port_range **ranges, int *nranges, int *size, int first, int last)
 {
-	if (!a->port_list[port-1]) {
-		a->nports++;
-		a->port_list[port-1] = 1;
+	struct port_range *new_ranges;
+
+	if (*nranges == *size) {
+		new_ranges = (struct port_range *)realloc(*ranges, sizeof(struct port_range) * (*size ? *size * 2 : 4));
+		if (!new_ranges) {
+			tools_printlog(LOG_ERR, "%s():%d: port ranges memory allocation error", __FUNCTION__, __LINE__);
+			return -1;
+		}
+		*ranges = new_ranges;
+		*size = *size ? *size * 2 : 4;
 	}
+
+	(*ranges)[*nranges].first = first;
+	(*ranges)[*nranges].last = last;
+	(*nranges)++;
+
+	return 0;
 }
 
+/* parse the ports string into a sorted list of disjoint port ranges */
 static int address_get_array_ports(struct address *a)
 {
-	int index = 0;
+	struct port_range *ranges = NULL;
+	int nranges = 0;
+	int size = 0;
 	char *ptr;
-	int iport, new;
-	int last = 0;
+	int i, n;
+	int new, last;
 
-	a->nports = 0;
-	memset(a->port_list, 0, NFTLB_MAX_PORTS * sizeof(int));
 	ptr = a->ports;
 	while (ptr != NULL && *ptr != '\0') {
 		last = new = 0;
 		address_get_range_ports(ptr, &new, &last);
 		if (last == 0)
 			last = new;
+		if (new < 1)
+			new = 1;
+		if (last > NFTLB_MAX_PORTS)
+			last = NFTLB_MAX_PORTS;
 		if (new > last)
 			goto next;
 
-		for (iport = new; iport <= last; iport++)
-			address_add_array_port(a, iport);
+		if (address_add_port_range(&ranges, &nranges, &size, new, last)) {
+			free(ranges);
+			return -1;
+		}
 
 next:
 		ptr = strchr(ptr, ',');
@@ -155,7 +241,29 @@ next:
 			ptr++;
 	}
 
-	return index;
+	if (nranges)
+		qsort(ranges, nranges, sizeof(struct port_range), address_cmp_port_range);
+
+	/* merge the overlapping and adjacent ranges */
+	for (i = 0, n = 0; i < nranges; i++) {
+		if (n && ranges[i].first <= ranges[n - 1].last + 1) {
+			if (ranges[i].last > ranges[n - 1].last)
+				ranges[n - 1].last = ranges[i].last;
+			continue;
+		}
+		ranges[n++] = ranges[i];
+	}
+
+	if (a->port_ranges)
+		free(a->port_ranges);
+
+	a->port_ranges = ranges;
+	a->nport_ranges = n;
+	a->nports = 0;
+	for (i = 0; i < n; i++)
+		a->nports += ranges[i].last - ranges[i].first + 1;
+
+	return 0;
 }
 
 int address_set_ports(struct address *a, char *new_value)
@@ -363,17 +471,26 @@ void address_s_print(void)
 
 struct address * address_lookup_by_name(const char *name)
 {
-	struct list_head *addresses = obj_get_addresses();
+	unsigned int hash = address_hash(name);
+	struct hlist_node *pos;
 	struct address *a;
 
-	list_for_each_entry(a, addresses, list) {
-		if (strcmp(a->name, name) == 0)
+	hlist_for_each_entry(a, pos, objindex_bucket(&addresses_index, hash), hnode.node) {
+		if (a->hnode.hash == hash && strcmp(a->name, name) == 0)
 			return a;
 	}
 
 	return NULL;
 }
 
+void address_rename(struct address *a, char *name)
+{
+	objindex_del(&addresses_index, &a->hnode);
+	free(a->name);
+	obj_set_attribute_string(name, &a->name);
+	objindex_add(&addresses_index, &a->hnode, address_hash(a->name));
+}
+
 int address_pre_actionable(struct config_pair *c)
 {
 	struct address *a = obj_get_current_address();
@@ -458,9 +575,7 @@ int address_set_attribute(struct config_pair *c)
 			return PARSER_OK;
 		break;
 	case KEY_LOGPREFIX:
-		if (strcmp(a->logprefix, DEFAULT_LOG_LOGPREFIX) != 0)
-			free(a->logprefix);
-		ret = obj_set_attribute_string(c->str_value, &a->logprefix);
+		ret = obj_set_attribute_shared(c->str_value, &a->logprefix);
 		break;
 	case KEY_ACTION:
 		ret = address_set_action(a, c->int_value);
@@ -496,8 +611,10 @@ int address_set_action(struct address *a, int action)
 	if (action == ACTION_STOP)
 		farm_s_lookup_address_action(a->name, action);
 
-	if (a->action > action)
+	if (a->action > action) {
 		a->action = action;
+		address_set_dirty(a);
+	}
 	return 1;
 }
 
@@ -532,6 +649,9 @@ int address_rulerize(struct address *a)
 
 	address_print(a);
 
+	if (a->action != ACTION_NONE)
+		obj_set_shared_changed();
+
 	if (a->used) {
 		tools_printlog(LOG_INFO, "%s():%d: address %s won't be rulerized", __FUNCTION__, __LINE__, a->name);
 		return 0;
@@ -540,16 +660,27 @@ int address_rulerize(struct address *a)
 	return nft_rulerize_address(a);
 }
 
+/* marked on changes of the address or of its policies */
+void address_set_dirty(struct address *a)
+{
+	if (list_empty(&a->dirty))
+		list_add_tail(&a->dirty, &addresses_dirty);
+}
+
 int address_s_rulerize(void)
 {
-	struct list_head *addresses = obj_get_addresses();
-	struct address *a, *next;
+	struct address *a;
 	int ret = 0;
 	int output = 0;
+	LIST_HEAD(dirty);
 
 	tools_printlog(LOG_DEBUG, "%s():%d: rulerize addresses", __FUNCTION__, __LINE__);
 
-	list_for_each_entry_safe(a, next, addresses, list) {
+	list_splice_init(&addresses_dirty, &dirty);
+
+	while (!list_empty(&dirty)) {
+		a = list_first_entry(&dirty, struct address, dirty);
+		list_del_init(&a->dirty);
 		ret = address_rulerize(a);
 		output = output || ret;
 	}
@@ -29,9 +29,11 @@
 #include "tools.h"
 
 
+static SLAB_POOL(addresspolicies_pool, "addresspolicies", struct addresspolicy);
+
 static struct addresspolicy * addresspolicy_create(struct address *a, struct policy *p)
 {
-	struct addresspolicy *ap = (struct addresspolicy *)malloc(sizeof(struct addresspolicy));
+	struct addresspolicy *ap = (struct addresspolicy *)slab_alloc(&addresspolicies_pool);
 	if (!ap) {
 		tools_printlog(LOG_ERR, "address policy memory allocation error");
 		return NULL;
@@ -43,12 +45,14 @@ static struct addresspolicy * addresspolicy_create(struct address *a, struct pol
 	ap->policy = p;
 	ap->action = DEFAULT_ACTION;
 	p->used++;
+	policy_set_changed(p);
 
 	a->policies_action = DEFAULT_ACTION;
 
 	if (a->policies_used > 0 && a->action == ACTION_RELOAD)
 		a->policies_action = ACTION_RELOAD;
 	a->policies_used++;
+	address_set_dirty(a);
 
 	list_add_tail(&ap->list, &a->policies);
 
@@ -67,10 +71,12 @@ static int addresspolicy_delete(struct addresspolicy *ap)
 
 	if (ap->policy->used > 0)
 		ap->policy->used--;
+	policy_set_changed(ap->policy);
 
 	ap->address->policies_action = ACTION_STOP;
+	address_set_dirty(ap->address);
 
-	free(ap);
+	slab_free(&addresspolicies_pool, ap);
 
 	return 0;
 }
@@ -108,6 +114,7 @@ int addresspolicy_set_action(struct addresspolicy *ap, int action)
 	if (ap->action > action) {
 		ap->action = action;
 		ap->address->policies_action = ACTION_RELOAD;
+		address_set_dirty(ap->address);
 		return 1;
 	}
 
@@ -19,6 +19,7 @@
  *
  */
 
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -31,41 +32,78 @@
 #include "network.h"
 #include "sessions.h"
 #include "tools.h"
+#include "config.h"
+#include "notify.h"
+
+static SLAB_POOL(backends_pool, "backends", struct backend);
 
 #define BACKEND_MARK_MIN			0x00000001
 #define BACKEND_MARK_MAX			0x00000FFF
 
+#define BACKEND_MARK_WORDS			(BACKEND_MARK_MAX / 64 + 1)
+
+/*
+ * Marks in use by the backends of all the farms. A mark may be shared if
+ * it's given explicitly, so the backends using every mark are counted.
+ */
+static uint64_t backend_marks[BACKEND_MARK_WORDS];
+static unsigned int backend_mark_refs[BACKEND_MARK_MAX + 1];
+
+static void backend_mark_get(int mark)
+{
+	if (mark < BACKEND_MARK_MIN || mark > BACKEND_MARK_MAX)
+		return;
+
+	if (backend_mark_refs[mark]++ == 0)
+		backend_marks[mark / 64] |= 1ULL << (mark % 64);
+}
+
+static void backend_mark_put(int mark)
+{
+	if (mark < BACKEND_MARK_MIN || mark > BACKEND_MARK_MAX || !backend_mark_refs[mark])
+		return;
+
+	if (--backend_mark_refs[mark] == 0)
+		backend_marks[mark / 64] &= ~(1ULL << (mark % 64));
+}
+
+/* the lowest mark not in use */
 static int backend_gen_next_mark(void)
 {
-	struct list_head *farms = obj_get_farms();
-	struct farm *f;
-	struct backend *b;
-	int mark = BACKEND_MARK_MIN;
-	int found = 0;
-
-	for (mark = BACKEND_MARK_MIN; mark <= BACKEND_MARK_MAX; mark++) {
-		found = 0;
-		list_for_each_entry(f, farms, list) {
-			list_for_each_entry(b, &f->backends, list) {
-				if (mark == b->mark) {
-					found = 1;
-					continue;
-				}
-			}
-			if (found)
-				continue;
-		}
+	uint64_t free_marks;
+	int i, mark;
+
+	for (i = BACKEND_MARK_MIN / 64; i < BACKEND_MARK_WORDS; i++) {
+		free_marks = ~backend_marks[i];
+		if (i == BACKEND_MARK_MIN / 64)
+			free_marks &= ~((1ULL << (BACKEND_MARK_MIN % 64)) - 1);
+		if (!free_marks)
+			continue;
+
+		mark = i * 64 + __builtin_ctzll(free_marks);
+		if (mark > BACKEND_MARK_MAX)
+			break;
 
-		if (!found)
-			return mark;
+		return mark;
 	}
 
 	return DEFAULT_MARK;
 }
 
+/* backends are indexed by name within their farm */
+static struct objindex backends_index;
+
+static unsigned int backend_hash(struct farm *f, const char *name)
+{
+	return objindex_hash_str(name, objindex_hash_ptr(f, 0));
+}
+
+/* and by ip address across all the farms, for the neighbour updates */
+static struct objindex backends_ip_index;
+
 static struct backend * backend_create(struct farm *f, char *name)
 {
-	struct backend *b = (struct backend *)malloc(sizeof(struct backend));
+	struct backend *b = (struct backend *)slab_alloc(&backends_pool);
 	if (!b) {
 		tools_printlog(LOG_ERR, "Backend memory allocation error");
 		return NULL;
@@ -74,18 +112,26 @@ static struct backend * backend_create(struct farm *f, char *name)
 	b->parent = f;
 	obj_set_attribute_string(name, &b->name);
 
+	if (objindex_add(&backends_index, &b->hnode, backend_hash(f, name))) {
+		free(b->name);
+		slab_free(&backends_pool, b);
+		return NULL;
+	}
+
 	b->fqdn = DEFAULT_FQDN;
 	b->ethaddr = DEFAULT_ETHADDR;
 	b->oface = DEFAULT_IFNAME;
 	b->ofidx = DEFAULT_IFIDX;
 	b->ipaddr = DEFAULT_IPADDR;
+	init_hlist_node(&b->ipnode.node);
 	b->port = DEFAULT_PORT;
 	b->srcaddr = DEFAULT_SRCADDR;
 	b->weight = DEFAULT_WEIGHT;
 	b->priority = DEFAULT_PRIORITY;
 	b->mark = backend_gen_next_mark();
+	backend_mark_get(b->mark);
 	b->estconnlimit = DEFAULT_ESTCONNLIMIT;
-	b->estconnlimit_logprefix = DEFAULT_B_ESTCONNLIMIT_LOGPREFIX;
+	b->estconnlimit_logprefix = slab_str_get(DEFAULT_B_ESTCONNLIMIT_LOGPREFIX);
 	b->state = DEFAULT_BACKEND_STATE;
 	b->action = DEFAULT_ACTION;
 
@@ -100,6 +146,9 @@ static struct backend * backend_create(struct farm *f, char *name)
 static int backend_delete_node(struct backend *b)
 {
 	list_del(&b->list);
+	objindex_del(&backends_index, &b->hnode);
+	objindex_del(&backends_ip_index, &b->ipnode);
+	backend_mark_put(b->mark);
 	if (b->name)
 		free(b->name);
 	if (b->fqdn && strcmp(b->fqdn, "") != 0)
@@ -108,16 +157,14 @@ static int backend_delete_node(struct backend *b)
 		free(b->oface);
 	if (b->ipaddr && strcmp(b->ipaddr, "") != 0)
 		free(b->ipaddr);
-	if (b->ethaddr && strcmp(b->ethaddr, "") != 0)
-		free(b->ethaddr);
+	slab_str_put(b->ethaddr);
 	if (b->port && strcmp(b->port, "") != 0)
 		free(b->port);
 	if (b->srcaddr && strcmp(b->srcaddr, "") != 0)
 		free(b->srcaddr);
-	if (b->estconnlimit_logprefix && strcmp(b->estconnlimit_logprefix, DEFAULT_B_ESTCONNLIMIT_LOGPREFIX) != 0)
-		free(b->estconnlimit_logprefix);
+	slab_str_put(b->estconnlimit_logprefix);
 
-	free(b);
+	slab_free(&backends_pool, b);
 
 	return 0;
 }
@@ -216,18 +263,32 @@ void backend_s_print(struct farm *f)
 	}
 }
 
+static struct backend * backend_lookup_by_name(struct farm *f, const char *name)
+{
+	unsigned int hash = backend_hash(f, name);
+	struct hlist_node *pos;
+	struct backend *b;
+
+	hlist_for_each_entry(b, pos, objindex_bucket(&backends_index, hash), hnode.node) {
+		if (b->hnode.hash == hash && b->parent == f && strcmp(b->name, name) == 0)
+			return b;
+	}
+
+	return NULL;
+}
+
 struct backend * backend_lookup_by_key(struct farm *f, int key, const char *name, int value)
 {
 	struct backend *b;
 
 	tools_printlog(LOG_DEBUG, "%s():%d: farm %s key %d name %s value %d", __FUNCTION__, __LINE__, f->name, key, name, value);
 
+	if (key == KEY_NAME)
+		return backend_lookup_by_name(f, name);
+
+	/* only used to match the sessions read from the kernel */
 	list_for_each_entry(b, &f->backends, list) {
 		switch (key) {
-		case KEY_NAME:
-			if (strcmp(b->name, name) == 0)
-				return b;
-			break;
 		case KEY_MARK:
 			if (value == backend_get_mark(b))
 				return b;
@@ -307,9 +368,7 @@ static int backend_set_ipaddr_from_ether(struct backend *b)
 
 		tools_printlog(LOG_DEBUG, "%s():%d: discovered ether address for %s is %s", __FUNCTION__, __LINE__, b->name, streth);
 
-		if (b->ethaddr)
-			free(b->ethaddr);
-		obj_set_attribute_string(streth, &b->ethaddr);
+		obj_set_attribute_shared(streth, &b->ethaddr);
 	}
 
 	return ret;
@@ -409,6 +468,8 @@ static int backend_set_mark(struct backend *b, int new_value)
 	tools_printlog(LOG_DEBUG, "%s():%d: current value is %d, but new value will be %d",
 				   __FUNCTION__, __LINE__, old_value, new_value);
 
+	backend_mark_put(old_value);
+	backend_mark_get(new_value);
 	b->mark = new_value;
 
 	return 0;
@@ -520,10 +581,11 @@ static int backend_set_ipaddr(struct backend *b, char *new_value)
 
 	if (b->ipaddr)
 		free(b->ipaddr);
-	if (b->ethaddr)
-		free(b->ethaddr);
 	obj_set_attribute_string(new_value, &b->ipaddr);
-	obj_set_attribute_string("", &b->ethaddr);
+	obj_set_attribute_shared("", &b->ethaddr);
+
+	objindex_del(&backends_ip_index, &b->ipnode);
+	objindex_add(&backends_ip_index, &b->ipnode, objindex_hash_str(b->ipaddr, 0));
 
 	netconfig = (backend_set_ifinfo(b) == 0 && backend_set_ipaddr_from_ether(b) == 0);
 
@@ -737,8 +799,10 @@ int backend_set_attribute(struct config_pair *c)
 		obj_set_current_backend(b);
 		break;
 	case KEY_NEWNAME:
+		objindex_del(&backends_index, &b->hnode);
 		free(b->name);
 		obj_set_attribute_string(c->str_value, &b->name);
+		objindex_add(&backends_index, &b->hnode, backend_hash(b->parent, b->name));
 		break;
 	case KEY_FQDN:
 		if (strcmp(b->fqdn, DEFAULT_FQDN) != 0)
@@ -749,9 +813,7 @@ int backend_set_attribute(struct config_pair *c)
 		backend_set_ipaddr(b, c->str_value);
 		break;
 	case KEY_ETHADDR:
-		if (b->ethaddr)
-			free(b->ethaddr);
-		obj_set_attribute_string(c->str_value, &b->ethaddr);
+		obj_set_attribute_shared(c->str_value, &b->ethaddr);
 		break;
 	case KEY_PORT:
 		backend_set_port(b, c->str_value);
@@ -781,9 +843,7 @@ int backend_set_attribute(struct config_pair *c)
 		backend_set_action(b, c->int_value);
 		break;
 	case KEY_ESTCONNLIMIT_LOGPREFIX:
-		if (strcmp(b->estconnlimit_logprefix, DEFAULT_B_ESTCONNLIMIT_LOGPREFIX) != 0)
-			free(b->estconnlimit_logprefix);
-		obj_set_attribute_string(c->str_value, &b->estconnlimit_logprefix);
+		obj_set_attribute_shared(c->str_value, &b->estconnlimit_logprefix);
 		break;
 	default:
 		return -1;
@@ -813,6 +873,10 @@ int backend_set_state(struct backend *b, int new_value)
 		return 0;
 
 	b->state = new_value;
+	farm_set_changed(f);
+
+	notify_event(NOTIFY_EVENT_BACKEND, "{s:s,s:s,s:s}", CONFIG_KEY_FARM, f->name,
+		     CONFIG_KEY_BCK, b->name, CONFIG_KEY_STATE, obj_print_state(new_value));
 
 	switch (new_value) {
 	case VALUE_STATE_CONFERR:
@@ -841,7 +905,7 @@ int backend_set_state(struct backend *b, int new_value)
 	}
 
 	if (b->action != ACTION_NONE) {
-		farm_set_action(f, ACTION_RELOAD);
+		farm_set_bcks_action(f);
 		backend_s_gen_priority(f, ACTION_NONE);
 	}
 
@@ -855,7 +919,7 @@ int backend_s_set_ether_by_ipaddr(struct farm *f, const char *ip_bck, char *ethe
 
 	list_for_each_entry(b, &f->backends, list) {
 
-		if (strcmp(b->ipaddr, ip_bck) != 0)
+		if (!b->ipaddr || strcmp(b->ipaddr, ip_bck) != 0)
 			continue;
 
 		tools_printlog(LOG_DEBUG, "%s():%d: backend with ip address %s found", __FUNCTION__, __LINE__, ip_bck);
@@ -863,9 +927,8 @@ int backend_s_set_ether_by_ipaddr(struct farm *f, const char *ip_bck, char *ethe
 		if (!b->ethaddr || (b->ethaddr && strcmp(b->ethaddr, ether_bck) != 0)) {
 			if (f->persistence != VALUE_META_NONE)
 				session_get_timed(f);
-			if (b->ethaddr)
-				free(b->ethaddr);
-			obj_set_attribute_string(ether_bck, &b->ethaddr);
+			obj_set_attribute_shared(ether_bck, &b->ethaddr);
+			farm_set_changed(f);
 			changed = 1;
 			if (f->persistence != VALUE_META_NONE) {
 				session_backend_action(f, b, ACTION_RELOAD);
@@ -881,6 +944,27 @@ int backend_s_set_ether_by_ipaddr(struct farm *f, const char *ip_bck, char *ethe
 	return changed;
 }
 
+/* iterate over the backends of all the farms with the given ip address */
+struct backend * backend_next_by_ipaddr(const char *ipaddr, struct backend *prev)
+{
+	unsigned int hash = objindex_hash_str(ipaddr, 0);
+	struct hlist_node *pos;
+	struct backend *b;
+
+	if (prev)
+		pos = prev->ipnode.node.next;
+	else
+		pos = objindex_bucket(&backends_ip_index, hash)->first;
+
+	for (; pos; pos = pos->next) {
+		b = hlist_entry(pos, struct backend, ipnode.node);
+		if (b->ipnode.hash == hash && strcmp(b->ipaddr, ipaddr) == 0)
+			return b;
+	}
+
+	return NULL;
+}
+
 static void backend_set_netinfo(struct backend *b)
 {
 	if (backend_set_ifinfo(b) == 0 && backend_set_ipaddr_from_ether(b) == 0) {
@@ -953,8 +1037,12 @@ int bck_pre_actionable(struct config_pair *c)
 		return ACTION_START;
 		break;
 
-	case KEY_PORT:
 	case KEY_STATE:
+		// the farm action is already set by backend_set_state()
+		return ACTION_NONE;
+		break;
+
+	case KEY_PORT:
 	case KEY_WEIGHT:
 	case KEY_ESTCONNLIMIT_LOGPREFIX:
 		return ACTION_RELOAD;
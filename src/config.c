@@ -24,6 +24,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <limits.h>
 #include <jansson.h>
 
 #include "config.h"
@@ -37,6 +38,7 @@
 #include "farmaddress.h"
 #include "addresspolicy.h"
 #include "tools.h"
+#include "stats.h"
 
 #define CONFIG_MAXBUF			4096
 #define CONFIG_OUTBUF_SIZE		1024
@@ -44,7 +46,6 @@
 static int config_json(json_t *element, int level, int source, int key, int apply_action);
 
 struct config_pair c;
-unsigned int continue_obj = 0;
 char config_outbuf[CONFIG_OUTBUF_SIZE] = { 0 };
 
 static void init_pair(struct config_pair *c)
@@ -787,13 +788,16 @@ void config_set_output(char *fmt, ...)
 
 int config_buffer(const char *buf, int apply_action)
 {
+	struct stats_timer	t;
 	json_error_t	error;
 	json_t		*root;
 	int		ret = PARSER_OK;
 
 	tools_printlog(LOG_NOTICE, "%s():%d: payload %d : %s", __FUNCTION__, __LINE__, (int)strlen(buf), buf);
 
+	stats_phase_begin(&t, STATS_PHASE_JSON);
 	root = json_loadb(buf, strlen(buf), JSON_ALLOW_NUL, &error);
+	stats_phase_end(&t);
 
 	if (root) {
 		ret = config_json(root, LEVEL_INIT, CONFIG_SRC_BUFFER, -1, apply_action);
@@ -814,158 +818,215 @@ static void add_dump_obj(json_t *obj, const char *name, char *value)
 	json_object_set_new(obj, name, json_string(value));
 }
 
-static int add_dump_elements(json_t *obj, struct policy *p);
-
 static struct json_t *add_dump_list(json_t *obj, const char *objname, int object,
-			  struct list_head *head, char *name)
+			  struct list_head *head, char *name);
+
+static json_t *config_dump_farm(struct farm *f)
 {
-	struct farm *f;
-	struct backend *b;
-	struct farmpolicy *fp;
-	struct policy *p;
-	struct element *e;
 	struct farmaddress *fa;
 	struct address *a = NULL;
-	struct addresspolicy *ap;
-	struct session *s;
-	json_t *jarray;
 	json_t *item;
 	char value[10];
 	char buf[100] = {};
 
-	if (continue_obj)
-		jarray = obj;
+	fa = farmaddress_get_first(f);
+	if (fa)
+		a = fa->address;
+
+	item = json_object();
+	add_dump_obj(item, CONFIG_KEY_NAME, f->name);
+
+	if (a) {
+		add_dump_obj(item, CONFIG_KEY_FAMILY, obj_print_family(a->family));
+		add_dump_obj(item, CONFIG_KEY_VIRTADDR, a->ipaddr);
+		add_dump_obj(item, CONFIG_KEY_VIRTPORTS, a->ports);
+	}
+
+	if (f->srcaddr)
+		add_dump_obj(item, CONFIG_KEY_SRCADDR, f->srcaddr);
 	else
-		jarray = json_array();
+		add_dump_obj(item, CONFIG_KEY_SRCADDR, "");
 
-	switch (object) {
-	case LEVEL_FARMS:
-		list_for_each_entry(f, head, list) {
+	add_dump_obj(item, CONFIG_KEY_MODE, obj_print_mode(f->mode));
+	if (f->mode == VALUE_MODE_STLSDNAT) {
+		config_dump_int(value, f->responsettl);
+		add_dump_obj(item, CONFIG_KEY_RESPONSETTL, value);
+	}
 
-			if (name != NULL && (strcmp(name, "") != 0) && (strcmp(f->name, name) != 0))
-				continue;
+	if (a)
+		add_dump_obj(item, CONFIG_KEY_PROTO, obj_print_proto(a->protocol));
+	add_dump_obj(item, CONFIG_KEY_SCHED, obj_print_sched(f->scheduler));
 
-			fa = farmaddress_get_first(f);
-			if (fa)
-				a = fa->address;
+	obj_print_meta(f->schedparam, (char *)buf);
+	add_dump_obj(item, CONFIG_KEY_SCHEDPARAM, buf);
 
-			item = json_object();
-			add_dump_obj(item, CONFIG_KEY_NAME, f->name);
+	obj_print_meta(f->persistence, (char *)buf);
+	add_dump_obj(item, CONFIG_KEY_PERSIST, buf);
 
-			if (a) {
-				add_dump_obj(item, CONFIG_KEY_FAMILY, obj_print_family(a->family));
-				add_dump_obj(item, CONFIG_KEY_VIRTADDR, a->ipaddr);
-				add_dump_obj(item, CONFIG_KEY_VIRTPORTS, a->ports);
-			}
+	config_dump_int(value, f->persistttl);
+	add_dump_obj(item, CONFIG_KEY_PERSISTTM, value);
 
-			if (f->srcaddr)
-				add_dump_obj(item, CONFIG_KEY_SRCADDR, f->srcaddr);
-			else
-				add_dump_obj(item, CONFIG_KEY_SRCADDR, "");
+	add_dump_obj(item, CONFIG_KEY_HELPER, obj_print_helper(f->helper));
 
-			add_dump_obj(item, CONFIG_KEY_MODE, obj_print_mode(f->mode));
-			if (f->mode == VALUE_MODE_STLSDNAT) {
-				config_dump_int(value, f->responsettl);
-				add_dump_obj(item, CONFIG_KEY_RESPONSETTL, value);
-			}
+	obj_print_log(f->log, (char *)buf);
+	add_dump_obj(item, CONFIG_KEY_LOG, buf);
+	if (f->logprefix && strcmp(f->logprefix, DEFAULT_LOG_LOGPREFIX) != 0)
+		add_dump_obj(item, CONFIG_KEY_LOGPREFIX, f->logprefix);
+	obj_print_rtlimit(buf, f->logrtlimit, f->logrtlimit_unit);
+	add_dump_obj(item, CONFIG_KEY_LOG_RTLIMIT, buf);
 
-			if (a)
-				add_dump_obj(item, CONFIG_KEY_PROTO, obj_print_proto(a->protocol));
-			add_dump_obj(item, CONFIG_KEY_SCHED, obj_print_sched(f->scheduler));
+	config_dump_hex(value, f->mark);
+	add_dump_obj(item, CONFIG_KEY_MARK, value);
+	config_dump_int(value, f->priority);
+	add_dump_obj(item, CONFIG_KEY_PRIORITY, value);
+	add_dump_obj(item, CONFIG_KEY_STATE, obj_print_state(f->state));
 
-			obj_print_meta(f->schedparam, (char *)buf);
-			add_dump_obj(item, CONFIG_KEY_SCHEDPARAM, buf);
+	config_dump_int(value, f->limitsttl);
+	add_dump_obj(item, CONFIG_KEY_LIMITSTTL, value);
+	obj_print_rtlimit(buf, f->newrtlimit, f->newrtlimit_unit);
+	add_dump_obj(item, CONFIG_KEY_NEWRTLIMIT, buf);
+	config_dump_int(value, f->newrtlimitbst);
+	add_dump_obj(item, CONFIG_KEY_NEWRTLIMITBURST, value);
+	if (f->newrtlimit_logprefix && strcmp(f->newrtlimit_logprefix, DEFAULT_LOGPREFIX) != 0)
+		add_dump_obj(item, CONFIG_KEY_NEWRTLIMIT_LOGPREFIX, f->newrtlimit_logprefix);
 
-			obj_print_meta(f->persistence, (char *)buf);
-			add_dump_obj(item, CONFIG_KEY_PERSIST, buf);
+	obj_print_rtlimit(buf, f->rstrtlimit, f->newrtlimit_unit);
+	add_dump_obj(item, CONFIG_KEY_RSTRTLIMIT, buf);
+	config_dump_int(value, f->rstrtlimitbst);
+	add_dump_obj(item, CONFIG_KEY_RSTRTLIMITBURST, value);
+	if (f->rstrtlimit_logprefix && strcmp(f->rstrtlimit_logprefix, DEFAULT_LOGPREFIX) != 0)
+		add_dump_obj(item, CONFIG_KEY_RSTRTLIMIT_LOGPREFIX, f->rstrtlimit_logprefix);
 
-			config_dump_int(value, f->persistttl);
-			add_dump_obj(item, CONFIG_KEY_PERSISTTM, value);
+	config_dump_int(value, f->estconnlimit);
+	add_dump_obj(item, CONFIG_KEY_ESTCONNLIMIT, value);
+	if (f->estconnlimit_logprefix && strcmp(f->estconnlimit_logprefix, DEFAULT_LOGPREFIX) != 0)
+		add_dump_obj(item, CONFIG_KEY_ESTCONNLIMIT_LOGPREFIX, f->estconnlimit_logprefix);
 
-			add_dump_obj(item, CONFIG_KEY_HELPER, obj_print_helper(f->helper));
+	add_dump_obj(item, CONFIG_KEY_TCPSTRICT, obj_print_switch(f->tcpstrict));
+	if (f->tcpstrict_logprefix && strcmp(f->tcpstrict_logprefix, DEFAULT_LOGPREFIX) != 0)
+		add_dump_obj(item, CONFIG_KEY_TCPSTRICT_LOGPREFIX, f->tcpstrict_logprefix);
 
-			obj_print_log(f->log, (char *)buf);
-			add_dump_obj(item, CONFIG_KEY_LOG, buf);
-			if (f->logprefix && strcmp(f->logprefix, DEFAULT_LOG_LOGPREFIX) != 0)
-				add_dump_obj(item, CONFIG_KEY_LOGPREFIX, f->logprefix);
-			obj_print_rtlimit(buf, f->logrtlimit, f->logrtlimit_unit);
-			add_dump_obj(item, CONFIG_KEY_LOG_RTLIMIT, buf);
+	config_dump_int(value, f->queue);
+	add_dump_obj(item, CONFIG_KEY_QUEUE, value);
 
-			config_dump_hex(value, f->mark);
-			add_dump_obj(item, CONFIG_KEY_MARK, value);
-			config_dump_int(value, f->priority);
-			add_dump_obj(item, CONFIG_KEY_PRIORITY, value);
-			add_dump_obj(item, CONFIG_KEY_STATE, obj_print_state(f->state));
-
-			config_dump_int(value, f->limitsttl);
-			add_dump_obj(item, CONFIG_KEY_LIMITSTTL, value);
-			obj_print_rtlimit(buf, f->newrtlimit, f->newrtlimit_unit);
-			add_dump_obj(item, CONFIG_KEY_NEWRTLIMIT, buf);
-			config_dump_int(value, f->newrtlimitbst);
-			add_dump_obj(item, CONFIG_KEY_NEWRTLIMITBURST, value);
-			if (f->newrtlimit_logprefix && strcmp(f->newrtlimit_logprefix, DEFAULT_LOGPREFIX) != 0)
-				add_dump_obj(item, CONFIG_KEY_NEWRTLIMIT_LOGPREFIX, f->newrtlimit_logprefix);
-
-			obj_print_rtlimit(buf, f->rstrtlimit, f->newrtlimit_unit);
-			add_dump_obj(item, CONFIG_KEY_RSTRTLIMIT, buf);
-			config_dump_int(value, f->rstrtlimitbst);
-			add_dump_obj(item, CONFIG_KEY_RSTRTLIMITBURST, value);
-			if (f->rstrtlimit_logprefix && strcmp(f->rstrtlimit_logprefix, DEFAULT_LOGPREFIX) != 0)
-				add_dump_obj(item, CONFIG_KEY_RSTRTLIMIT_LOGPREFIX, f->rstrtlimit_logprefix);
-
-			config_dump_int(value, f->estconnlimit);
-			add_dump_obj(item, CONFIG_KEY_ESTCONNLIMIT, value);
-			if (f->estconnlimit_logprefix && strcmp(f->estconnlimit_logprefix, DEFAULT_LOGPREFIX) != 0)
-				add_dump_obj(item, CONFIG_KEY_ESTCONNLIMIT_LOGPREFIX, f->estconnlimit_logprefix);
-
-			add_dump_obj(item, CONFIG_KEY_TCPSTRICT, obj_print_switch(f->tcpstrict));
-			if (f->tcpstrict_logprefix && strcmp(f->tcpstrict_logprefix, DEFAULT_LOGPREFIX) != 0)
-				add_dump_obj(item, CONFIG_KEY_TCPSTRICT_LOGPREFIX, f->tcpstrict_logprefix);
-
-			config_dump_int(value, f->queue);
-			add_dump_obj(item, CONFIG_KEY_QUEUE, value);
-
-			obj_print_verdict(f->verdict, (char *)buf);
-			add_dump_obj(item, CONFIG_KEY_VERDICT, buf);
+	obj_print_verdict(f->verdict, (char *)buf);
+	add_dump_obj(item, CONFIG_KEY_VERDICT, buf);
 
-			if (f->flow_offload)
-				add_dump_obj(item, CONFIG_KEY_FLOWOFFLOAD, obj_print_switch(f->flow_offload));
+	if (f->flow_offload)
+		add_dump_obj(item, CONFIG_KEY_FLOWOFFLOAD, obj_print_switch(f->flow_offload));
 
-			if (f->intra_connect)
-				add_dump_obj(item, CONFIG_KEY_INTRACONNECT, obj_print_switch(f->intra_connect));
+	if (f->intra_connect)
+		add_dump_obj(item, CONFIG_KEY_INTRACONNECT, obj_print_switch(f->intra_connect));
 
-			add_dump_list(item, CONFIG_KEY_ADDRESSES, LEVEL_FARMADDRESS, &f->addresses, NULL);
-			add_dump_list(item, CONFIG_KEY_BCKS, LEVEL_BCKS, &f->backends, NULL);
+	add_dump_list(item, CONFIG_KEY_ADDRESSES, LEVEL_FARMADDRESS, &f->addresses, NULL);
+	add_dump_list(item, CONFIG_KEY_BCKS, LEVEL_BCKS, &f->backends, NULL);
 
-			add_dump_list(item, CONFIG_KEY_POLICIES, LEVEL_FARMPOLICY, &f->policies, NULL);
+	add_dump_list(item, CONFIG_KEY_POLICIES, LEVEL_FARMPOLICY, &f->policies, NULL);
 
-			if (f->total_static_sessions != 0)
-				add_dump_list(item, CONFIG_KEY_SESSIONS, LEVEL_SESSIONS, &f->static_sessions, NULL);
+	return item;
+}
 
-			json_array_append_new(jarray, item);
-			a = NULL;
-		}
-		break;
+static json_t *config_dump_backend(struct backend *b)
+{
+	json_t *item;
+	char value[10];
+
+	item = json_object();
+	add_dump_obj(item, CONFIG_KEY_NAME, b->name);
+	add_dump_obj(item, CONFIG_KEY_IPADDR, b->ipaddr);
+	add_dump_obj(item, CONFIG_KEY_PORT, b->port);
+	add_dump_obj(item, CONFIG_KEY_SRCADDR, b->srcaddr);
+	config_dump_int(value, b->weight);
+	add_dump_obj(item, CONFIG_KEY_WEIGHT, value);
+	config_dump_int(value, b->priority);
+	add_dump_obj(item, CONFIG_KEY_PRIORITY, value);
+	config_dump_hex(value, b->mark);
+	add_dump_obj(item, CONFIG_KEY_MARK, value);
+
+	config_dump_int(value, b->estconnlimit);
+	add_dump_obj(item, CONFIG_KEY_ESTCONNLIMIT, value);
+	if (b->estconnlimit_logprefix && strcmp(b->estconnlimit_logprefix, DEFAULT_B_ESTCONNLIMIT_LOGPREFIX) != 0)
+		add_dump_obj(item, CONFIG_KEY_ESTCONNLIMIT_LOGPREFIX, b->estconnlimit_logprefix);
+
+	add_dump_obj(item, CONFIG_KEY_STATE, obj_print_state(b->state));
+
+	return item;
+}
+
+static json_t *config_dump_policy(struct policy *p)
+{
+	json_t *item;
+	char value[10];
+
+	item = json_object();
+	add_dump_obj(item, CONFIG_KEY_NAME, p->name);
+	add_dump_obj(item, CONFIG_KEY_FAMILY, obj_print_family(p->family));
+	add_dump_obj(item, CONFIG_KEY_TYPE, obj_print_policy_type(p->type));
+
+	add_dump_obj(item, CONFIG_KEY_ROUTE, obj_print_policy_route(p->route));
+	config_dump_int(value, p->timeout);
+	add_dump_obj(item, CONFIG_KEY_TIMEOUT, value);
+	if (p->logprefix && strcmp(p->logprefix, DEFAULT_POLICY_LOGPREFIX) != 0)
+		add_dump_obj(item, CONFIG_KEY_LOGPREFIX, p->logprefix);
+
+	config_dump_int(value, p->used);
+	add_dump_obj(item, CONFIG_KEY_USED, value);
+
+	return item;
+}
+
+static json_t *config_dump_element(struct element *e)
+{
+	json_t *item;
+
+	item = json_object();
+	add_dump_obj(item, CONFIG_KEY_DATA, e->data);
+	if (e->time)
+		add_dump_obj(item, CONFIG_KEY_TIME, e->time);
+
+	add_dump_obj(item, CONFIG_KEY_COUNTER_PACKETS, e->counter_pkts);
+	add_dump_obj(item, CONFIG_KEY_COUNTER_BYTES, e->counter_bytes);
+
+	return item;
+}
+
+static json_t *config_dump_session(struct session *s)
+{
+	json_t *item;
+
+	item = json_object();
+	add_dump_obj(item, CONFIG_KEY_CLIENT, s->client);
+
+	if (!s->bck)
+		add_dump_obj(item, CONFIG_KEY_BACKEND, UNDEFINED_VALUE);
+	else
+		add_dump_obj(item, CONFIG_KEY_BACKEND, s->bck->name);
+
+	if (s->expiration)
+		add_dump_obj(item, CONFIG_KEY_EXPIRATION, s->expiration);
+
+	return item;
+}
+
+static struct json_t *add_dump_list(json_t *obj, const char *objname, int object,
+			  struct list_head *head, char *name)
+{
+	struct backend *b;
+	struct farmpolicy *fp;
+	struct farmaddress *fa;
+	struct address *a = NULL;
+	struct addresspolicy *ap;
+	json_t *jarray;
+	json_t *item;
+	char value[10];
+	char buf[100] = {};
+
+	jarray = json_array();
+
+	switch (object) {
 	case LEVEL_BCKS:
 		list_for_each_entry(b, head, list) {
-			item = json_object();
-			add_dump_obj(item, CONFIG_KEY_NAME, b->name);
-			add_dump_obj(item, CONFIG_KEY_IPADDR, b->ipaddr);
-			add_dump_obj(item, CONFIG_KEY_PORT, b->port);
-			add_dump_obj(item, CONFIG_KEY_SRCADDR, b->srcaddr);
-			config_dump_int(value, b->weight);
-			add_dump_obj(item, CONFIG_KEY_WEIGHT, value);
-			config_dump_int(value, b->priority);
-			add_dump_obj(item, CONFIG_KEY_PRIORITY, value);
-			config_dump_hex(value, b->mark);
-			add_dump_obj(item, CONFIG_KEY_MARK, value);
-
-			config_dump_int(value, b->estconnlimit);
-			add_dump_obj(item, CONFIG_KEY_ESTCONNLIMIT, value);
-			if (b->estconnlimit_logprefix && strcmp(b->estconnlimit_logprefix, DEFAULT_B_ESTCONNLIMIT_LOGPREFIX) != 0)
-				add_dump_obj(item, CONFIG_KEY_ESTCONNLIMIT_LOGPREFIX, b->estconnlimit_logprefix);
-
-			add_dump_obj(item, CONFIG_KEY_STATE, obj_print_state(b->state));
+			item = config_dump_backend(b);
 			json_array_append_new(jarray, item);
 		}
 		break;
@@ -976,28 +1037,6 @@ static struct json_t *add_dump_list(json_t *obj, const char *objname, int object
 			json_array_append_new(jarray, item);
 		}
 		break;
-	case LEVEL_POLICIES:
-		list_for_each_entry(p, head, list) {
-			if (name != NULL && (strcmp(name, "") != 0) && (strcmp(p->name, name) != 0))
-				continue;
-
-			item = json_object();
-			add_dump_obj(item, CONFIG_KEY_NAME, p->name);
-			add_dump_obj(item, CONFIG_KEY_FAMILY, obj_print_family(p->family));
-			add_dump_obj(item, CONFIG_KEY_TYPE, obj_print_policy_type(p->type));
-
-			add_dump_obj(item, CONFIG_KEY_ROUTE, obj_print_policy_route(p->route));
-			config_dump_int(value, p->timeout);
-			add_dump_obj(item, CONFIG_KEY_TIMEOUT, value);
-			if (p->logprefix && strcmp(p->logprefix, DEFAULT_POLICY_LOGPREFIX) != 0)
-				add_dump_obj(item, CONFIG_KEY_LOGPREFIX, p->logprefix);
-
-			config_dump_int(value, p->used);
-			add_dump_obj(item, CONFIG_KEY_USED, value);
-			add_dump_elements(item, p);
-			json_array_append_new(jarray, item);
-		}
-		break;
 	case LEVEL_FARMADDRESS:
 		list_for_each_entry(fa, head, list) {
 			item = json_object();
@@ -1048,59 +1087,170 @@ static struct json_t *add_dump_list(json_t *obj, const char *objname, int object
 			json_array_append_new(jarray, item);
 		}
 		break;
-	case LEVEL_ELEMENTS:
-		list_for_each_entry(e, head, list) {
-			item = json_object();
-			add_dump_obj(item, CONFIG_KEY_DATA, e->data);
-			if (e->time)
-				add_dump_obj(item, CONFIG_KEY_TIME, e->time);
+	default:
+		return NULL;
+	}
 
-			add_dump_obj(item, CONFIG_KEY_COUNTER_PACKETS, e->counter_pkts);
-			add_dump_obj(item, CONFIG_KEY_COUNTER_BYTES, e->counter_bytes);
-			json_array_append_new(jarray, item);
-		}
-		break;
-	case LEVEL_SESSIONS:
-		list_for_each_entry(s, head, list) {
-			item = json_object();
-			add_dump_obj(item, CONFIG_KEY_CLIENT, s->client);
+	json_object_set_new(obj, objname, jarray);
 
-			if (!s->bck)
-				add_dump_obj(item, CONFIG_KEY_BACKEND, UNDEFINED_VALUE);
-			else
-				add_dump_obj(item, CONFIG_KEY_BACKEND, s->bck->name);
+	return jarray;
+}
 
-			if (s->expiration)
-				add_dump_obj(item, CONFIG_KEY_EXPIRATION, s->expiration);
+/*
+ * The large dumps are written while the objects are walked instead of
+ * building the whole document first. Every item is still built with
+ * jansson, so the output is the same as json_dumps() would give.
+ */
+#define CONFIG_STREAM_INDENT		8
+#define CONFIG_STREAM_MAX_DEPTH		8
+
+struct config_stream {
+	config_writer	write;
+	void		*data;
+	int		flags;
+	int		depth;
+	int		first[CONFIG_STREAM_MAX_DEPTH];
+	int		error;
+};
+
+static void stream_init(struct config_stream *s, config_writer write, void *data, int flags)
+{
+	s->write = write;
+	s->data = data;
+	s->flags = flags;
+	s->depth = 0;
+	s->first[0] = 1;
+	s->error = 0;
+}
 
-			json_array_append_new(jarray, item);
-		}
-		break;
-	default:
-		return NULL;
+static void stream_write(struct config_stream *s, const char *buf, size_t len)
+{
+	if (!s->error && len && s->write(s->data, buf, len))
+		s->error = 1;
+}
+
+static void stream_newline(struct config_stream *s)
+{
+	static const char spaces[] = "                                ";
+	int len = s->depth * CONFIG_STREAM_INDENT;
+	int n;
+
+	if (s->flags & CONFIG_DUMP_COMPACT)
+		return;
+
+	stream_write(s, "\n", 1);
+	for (; len > 0; len -= n) {
+		n = len < (int)sizeof(spaces) - 1 ? len : (int)sizeof(spaces) - 1;
+		stream_write(s, spaces, n);
 	}
+}
+
+static void stream_next(struct config_stream *s)
+{
+	if (!s->first[s->depth])
+		stream_write(s, ",", 1);
+	s->first[s->depth] = 0;
+	stream_newline(s);
+}
 
-	if (!continue_obj) {
-		json_object_set_new(obj, objname, jarray);
-		return jarray;
+static void stream_open(struct config_stream *s, const char *token)
+{
+	stream_write(s, token, 1);
+	if (s->depth + 1 >= CONFIG_STREAM_MAX_DEPTH) {
+		s->error = 1;
+		return;
 	}
+	s->first[++s->depth] = 1;
+}
 
-	return NULL;
+static void stream_close(struct config_stream *s, const char *token)
+{
+	int empty = s->first[s->depth];
+
+	if (s->depth > 0)
+		s->depth--;
+	if (!empty)
+		stream_newline(s);
+	stream_write(s, token, 1);
 }
 
-static int add_dump_elements(json_t *jdata, struct policy *p)
+static void stream_value(struct config_stream *s, json_t *value);
+
+static void stream_key(struct config_stream *s, const char *key)
 {
-	element_get_list(p);
-	add_dump_list(jdata, CONFIG_KEY_ELEMENTS, LEVEL_ELEMENTS, &p->elements, NULL);
-	element_s_delete(p);
+	json_t *jkey = json_string(key);
 
-	return 0;
+	stream_next(s);
+	stream_value(s, jkey);
+	json_decref(jkey);
+
+	if (s->flags & CONFIG_DUMP_COMPACT)
+		stream_write(s, ":", 1);
+	else
+		stream_write(s, ": ", 2);
+}
+
+/* indent the lines of a value dumped by jansson to the current depth */
+static int stream_dump_cb(const char *buffer, size_t size, void *data)
+{
+	struct config_stream *s = (struct config_stream *)data;
+	const char *nl;
+
+	while ((nl = memchr(buffer, '\n', size)) != NULL) {
+		stream_write(s, buffer, nl - buffer);
+		stream_newline(s);
+		size -= nl - buffer + 1;
+		buffer = nl + 1;
+	}
+	stream_write(s, buffer, size);
+
+	return s->error ? -1 : 0;
+}
+
+static void stream_value(struct config_stream *s, json_t *value)
+{
+	size_t flags = JSON_ENCODE_ANY;
+
+	if (s->flags & CONFIG_DUMP_COMPACT)
+		flags |= JSON_COMPACT;
+	else
+		flags |= JSON_INDENT(CONFIG_STREAM_INDENT);
+
+	if (json_dump_callback(value, stream_dump_cb, s, flags))
+		s->error = 1;
+}
+
+static void stream_item(struct config_stream *s, json_t *item)
+{
+	stream_next(s);
+	stream_value(s, item);
+	json_decref(item);
 }
 
-int config_print_farms(char **buf, char *name)
+static void stream_fields(struct config_stream *s, json_t *item)
+{
+	const char *key;
+	json_t *value;
+
+	json_object_foreach(item, key, value) {
+		stream_key(s, key);
+		stream_value(s, value);
+	}
+	json_decref(item);
+}
+
+static void stream_sessions(struct config_stream *s, struct list_head *head)
+{
+	struct session *ses;
+
+	list_for_each_entry(ses, head, list)
+		stream_item(s, config_dump_session(ses));
+}
+
+int config_dump_farms(config_writer write, void *data, int flags, char *name)
 {
 	struct list_head *farms = obj_get_farms();
-	json_t *jdata;
+	struct config_stream s;
 	struct farm *f;
 
 	if (name && strcmp(name, "") != 0) {
@@ -1109,23 +1259,39 @@ int config_print_farms(char **buf, char *name)
 			return -1;
 	}
 
-	jdata = json_object();
-	add_dump_list(jdata, CONFIG_KEY_FARMS, LEVEL_FARMS, farms, name);
+	stream_init(&s, write, data, flags);
+	stream_open(&s, "{");
+	stream_key(&s, CONFIG_KEY_FARMS);
+	stream_open(&s, "[");
+
+	list_for_each_entry(f, farms, list) {
+		if (name != NULL && (strcmp(name, "") != 0) && (strcmp(f->name, name) != 0))
+			continue;
+
+		stream_next(&s);
+		stream_open(&s, "{");
+		stream_fields(&s, config_dump_farm(f));
+		if (f->total_static_sessions != 0) {
+			stream_key(&s, CONFIG_KEY_SESSIONS);
+			stream_open(&s, "[");
+			stream_sessions(&s, &f->static_sessions);
+			stream_close(&s, "]");
+		}
+		stream_close(&s, "}");
 
-	free(*buf);
-	*buf = json_dumps(jdata, JSON_INDENT(8));
-	json_decref(jdata);
+		if (s.error)
+			break;
+	}
 
-	if (*buf == NULL)
-		return -1;
+	stream_close(&s, "]");
+	stream_close(&s, "}");
 
-	return 0;
+	return s.error ? -1 : 0;
 }
 
-int config_print_farm_sessions(char **buf, char *name)
+int config_dump_farm_sessions(config_writer write, void *data, int flags, char *name)
 {
-	json_t *jdata = json_object();
-	json_t *jdata_cont;
+	struct config_stream s;
 	struct farm *f;
 
 	if (!name || strcmp(name, "") == 0)
@@ -1135,46 +1301,73 @@ int config_print_farm_sessions(char **buf, char *name)
 	if (!f)
 		return PARSER_OBJ_UNKNOWN;
 
-	jdata_cont = add_dump_list(jdata, CONFIG_KEY_SESSIONS, LEVEL_SESSIONS, &f->static_sessions, name);
-	continue_obj = 1;
-	session_get_timed(f);
-	add_dump_list(jdata_cont, CONFIG_KEY_SESSIONS, LEVEL_SESSIONS, &f->timed_sessions, name);
-	continue_obj = 0;
-	free(*buf);
-	*buf = json_dumps(jdata, JSON_INDENT(8));
+	stream_init(&s, write, data, flags);
+	stream_open(&s, "{");
+	stream_key(&s, CONFIG_KEY_SESSIONS);
+	stream_open(&s, "[");
 
-	json_decref(jdata);
+	stream_sessions(&s, &f->static_sessions);
+	session_get_timed(f);
+	stream_sessions(&s, &f->timed_sessions);
 	session_s_delete(f, SESSION_TYPE_TIMED);
 
-	if (*buf == NULL)
-		return PARSER_FAILED;
+	stream_close(&s, "]");
+	stream_close(&s, "}");
 
-	return PARSER_OK;
+	return s.error ? PARSER_FAILED : PARSER_OK;
 }
 
-int config_print_policies(char **buf, char *name)
+int config_dump_policies(config_writer write, void *data, int flags, char *name)
 {
 	struct list_head *policies = obj_get_policies();
-	json_t* jdata = json_object();
+	struct config_stream s;
+	struct element *e;
+	struct policy *p;
 
-	add_dump_list(jdata, CONFIG_KEY_POLICIES, LEVEL_POLICIES, policies, name);
+	stream_init(&s, write, data, flags);
+	stream_open(&s, "{");
+	stream_key(&s, CONFIG_KEY_POLICIES);
+	stream_open(&s, "[");
 
-	free(*buf);
-	*buf = json_dumps(jdata, JSON_INDENT(8));
-	json_decref(jdata);
+	list_for_each_entry(p, policies, list) {
+		if (name != NULL && (strcmp(name, "") != 0) && (strcmp(p->name, name) != 0))
+			continue;
 
-	if (*buf == NULL)
-		return PARSER_FAILED;
+		stream_next(&s);
+		stream_open(&s, "{");
+		stream_fields(&s, config_dump_policy(p));
 
-	return PARSER_OK;
+		stream_key(&s, CONFIG_KEY_ELEMENTS);
+		stream_open(&s, "[");
+		element_get_list(p);
+		list_for_each_entry(e, &p->elements, list)
+			stream_item(&s, config_dump_element(e));
+		element_s_delete(p);
+		stream_close(&s, "]");
+
+		stream_close(&s, "}");
+
+		if (s.error)
+			break;
+	}
+
+	stream_close(&s, "]");
+	stream_close(&s, "}");
+
+	return s.error ? PARSER_FAILED : PARSER_OK;
 }
 
 int config_set_farm_action(const char *name, const char *value)
 {
 	struct farm *f;
+	int action = config_value_action(value);
 
-	if (!name || strcmp(name, "") == 0)
-		return (farm_s_set_action(config_value_action(value)) >= 0) ? PARSER_OK : PARSER_FAILED;
+	if (!name || strcmp(name, "") == 0) {
+		if (farm_s_set_action(action) < 0)
+			return PARSER_FAILED;
+		obj_set_shared_changed();
+		return PARSER_OK;
+	}
 
 	f = farm_lookup_by_name(name);
 	if (!f) {
@@ -1182,7 +1375,16 @@ int config_set_farm_action(const char *name, const char *value)
 		return PARSER_OBJ_UNKNOWN;
 	}
 
-	return (farm_set_action(f, config_value_action(value)) >= 0) ? PARSER_OK : PARSER_FAILED;
+	if (farm_set_action(f, action) < 0)
+		return PARSER_FAILED;
+
+	/* a farm deleted only changes the listing of all the farms */
+	if (action == ACTION_DELETE)
+		obj_new_generation();
+	else
+		farm_set_changed(f);
+
+	return PARSER_OK;
 }
 
 int config_set_session_backend_action(const char *fname, const char *bname, const char *value)
@@ -1224,6 +1426,8 @@ int config_set_session_backend_action(const char *fname, const char *bname, cons
 	ret = session_backend_action(f, b, config_value_action(value));
 
 	session_s_delete(f, SESSION_TYPE_TIMED);
+	if (ret >= 0)
+		farm_set_changed(f);
 	return ret;
 }
 
@@ -1260,7 +1464,11 @@ int config_set_backend_action(const char *fname, const char *bname, const char *
 
 out:
 	session_s_delete(f, SESSION_TYPE_TIMED);
-	return (ret >= 0) ? PARSER_OK : PARSER_FAILED;
+	if (ret < 0)
+		return PARSER_FAILED;
+
+	farm_set_changed(f);
+	return PARSER_OK;
 }
 
 int config_set_session_action(const char *fname, const char *sname, const char *value)
@@ -1315,6 +1523,9 @@ int config_set_session_action(const char *fname, const char *sname, const char *
 	return PARSER_OBJ_UNKNOWN;
 
 apply:
+	if (ret >= 0)
+		farm_set_changed(f);
+
 	if (ret > 0) {
 		config_set_farm_action(fname, CONFIG_VALUE_ACTION_RELOAD);
 		obj_rulerize(OBJ_START);
@@ -1338,6 +1549,7 @@ int config_set_fpolicy_action(const char *fname, const char *fpname, const char
 {
 	struct farm *f;
 	struct farmpolicy *fp;
+	int ret;
 
 	if (!fname || strcmp(fname, "") == 0) {
 		config_set_output(". Please select a valid farm");
@@ -1350,8 +1562,12 @@ int config_set_fpolicy_action(const char *fname, const char *fpname, const char
 		return PARSER_OBJ_UNKNOWN;
 	}
 
-	if (!fpname || strcmp(fpname, "") == 0)
-		return farmpolicy_s_set_action(f, config_value_action(value));
+	if (!fpname || strcmp(fpname, "") == 0) {
+		ret = farmpolicy_s_set_action(f, config_value_action(value));
+		if (ret >= 0)
+			farm_set_changed(f);
+		return ret;
+	}
 
 	fp = farmpolicy_lookup_by_name(f, fpname);
 	if (!fp) {
@@ -1360,6 +1576,7 @@ int config_set_fpolicy_action(const char *fname, const char *fpname, const char
 	}
 
 	farmpolicy_set_action(fp, config_value_action(value));
+	farm_set_changed(f);
 
 	return PARSER_OK;
 }
@@ -1383,9 +1600,14 @@ int config_check_policy(const char *name)
 int config_set_policy_action(const char *name, const char *value)
 {
 	struct policy *p;
+	int action = config_value_action(value);
 
-	if (!name || strcmp(name, "") == 0)
-		return (policy_s_set_action(config_value_action(value)) >= 0) ? PARSER_OK : PARSER_FAILED;
+	if (!name || strcmp(name, "") == 0) {
+		if (policy_s_set_action(action) < 0)
+			return PARSER_FAILED;
+		obj_set_shared_changed();
+		return PARSER_OK;
+	}
 
 	p = policy_lookup_by_name(name);
 	if (!p) {
@@ -1393,13 +1615,22 @@ int config_set_policy_action(const char *name, const char *value)
 		return PARSER_OBJ_UNKNOWN;
 	}
 
-	return (policy_set_action(p, config_value_action(value)) >= 0) ? PARSER_OK : PARSER_FAILED;
+	if (policy_set_action(p, action) < 0)
+		return PARSER_FAILED;
+
+	/* the farms and addresses using the policy are changed too */
+	obj_set_shared_changed();
+	if (action != ACTION_DELETE)
+		policy_set_changed(p);
+
+	return PARSER_OK;
 }
 
 int config_set_element_action(const char *pname, const char *edata, const char *value)
 {
 	struct policy *p;
 	struct element *e;
+	int ret;
 
 	if (!pname || strcmp(pname, "") == 0) {
 		config_set_output(". Please select a valid policy");
@@ -1413,15 +1644,21 @@ int config_set_element_action(const char *pname, const char *edata, const char *
 	}
 
 	if (!edata || strcmp(edata, "") == 0)
-		return (element_s_set_action(p, config_value_action(value)) >= 0) ? PARSER_OK : PARSER_FAILED;
-
-	e = element_lookup_by_name(p, edata);
-	if (!e) {
-		config_set_output(". Unknown element '%s' in policy '%s'", edata, pname);
-		return PARSER_OBJ_UNKNOWN;
+		ret = element_s_set_action(p, config_value_action(value));
+	else {
+		e = element_lookup_by_name(p, edata);
+		if (!e) {
+			config_set_output(". Unknown element '%s' in policy '%s'", edata, pname);
+			return PARSER_OBJ_UNKNOWN;
+		}
+		ret = element_set_action(e, config_value_action(value));
 	}
 
-	return (element_set_action(e, config_value_action(value)) >= 0) ? PARSER_OK : PARSER_FAILED;
+	if (ret < 0)
+		return PARSER_FAILED;
+
+	policy_set_changed(p);
+	return PARSER_OK;
 }
 
 int config_get_elements(const char *pname)
@@ -1467,23 +1704,31 @@ void config_print_response(char **buf, char *fmt, ...)
 int config_set_address_action(const char *name, const char *value)
 {
 	struct address *a;
+	int ret;
 
 	if (!name || strcmp(name, "") == 0)
-		return (address_s_set_action(config_value_action(value)) >= 0) ? PARSER_OK : PARSER_FAILED;
-
-	a = address_lookup_by_name(name);
-	if (!a) {
-		config_set_output(". Unknown address '%s'", name);
-		return PARSER_OBJ_UNKNOWN;
+		ret = address_s_set_action(config_value_action(value));
+	else {
+		a = address_lookup_by_name(name);
+		if (!a) {
+			config_set_output(". Unknown address '%s'", name);
+			return PARSER_OBJ_UNKNOWN;
+		}
+		ret = address_set_action(a, config_value_action(value));
 	}
 
-	return (address_set_action(a, config_value_action(value)) >= 0) ? PARSER_OK : PARSER_FAILED;
+	if (ret < 0)
+		return PARSER_FAILED;
+
+	obj_set_shared_changed();
+	return PARSER_OK;
 }
 
 int config_set_farmaddress_action(const char *fname, const char *faname, const char *value)
 {
 	struct farm *f;
 	struct farmaddress *fa;
+	int ret;
 
 	if (!fname || strcmp(fname, "") == 0) {
 		config_set_output(". Please select a valid farm");
@@ -1496,8 +1741,12 @@ int config_set_farmaddress_action(const char *fname, const char *faname, const c
 		return PARSER_OBJ_UNKNOWN;
 	}
 
-	if (!faname || strcmp(faname, "") == 0)
-		return farmaddress_s_set_action(f, config_value_action(value));
+	if (!faname || strcmp(faname, "") == 0) {
+		ret = farmaddress_s_set_action(f, config_value_action(value));
+		if (ret >= 0)
+			farm_set_changed(f);
+		return ret;
+	}
 
 	fa = farmaddress_lookup_by_name(f, faname);
 	if (!fa) {
@@ -1506,10 +1755,265 @@ int config_set_farmaddress_action(const char *fname, const char *faname, const c
 	}
 
 	farmaddress_set_action(fa, config_value_action(value));
+	farm_set_changed(f);
 
 	return 0;
 }
 
+static int config_bulk_string(const char *str, int key, int *int_value)
+{
+	char *end;
+	long value;
+
+	if (!str)
+		return -1;
+
+	if (key == KEY_STATE) {
+		if (strcmp(str, CONFIG_VALUE_STATE_UP) != 0 &&
+			strcmp(str, CONFIG_VALUE_STATE_DOWN) != 0 &&
+			strcmp(str, CONFIG_VALUE_STATE_OFF) != 0)
+			return -1;
+		*int_value = config_value_state(str);
+		return 0;
+	}
+
+	value = strtol(str, &end, 10);
+	if (end == str || *end != '\0' || value < 1 || value > INT_MAX)
+		return -1;
+	*int_value = (int)value;
+
+	return 0;
+}
+
+static int config_bulk_value(json_t *value, int key, int *int_value)
+{
+	if (json_is_string(value))
+		return config_bulk_string(json_string_value(value), key, int_value);
+
+	if (key == KEY_STATE || !json_is_integer(value))
+		return -1;
+
+	*int_value = (int)json_integer_value(value);
+
+	return (*int_value >= 1) ? 0 : -1;
+}
+
+static const char *config_bulk_lookup(const char *fname, const char *bname,
+				      struct farm **f, struct backend **b)
+{
+	if (!fname || !bname)
+		return "the structure is invalid";
+
+	*f = farm_lookup_by_name(fname);
+	if (!*f)
+		return "unknown farm";
+
+	*b = backend_lookup_by_key(*f, KEY_NAME, bname, 0);
+	if (!*b)
+		return "unknown backend";
+
+	return NULL;
+}
+
+static const char *config_bulk_apply(struct farm *f, struct backend *b, int key, int value)
+{
+	struct config_pair pair;
+
+	obj_set_current_farm(f);
+	obj_set_current_backend(b);
+
+	init_pair(&pair);
+	pair.level = LEVEL_BCKS;
+	pair.key = key;
+	pair.int_value = value;
+
+	if (obj_set_attribute(&pair, CONFIG_SRC_BUFFER, ACTION_START) != PARSER_OK)
+		return "error applying the change";
+
+	return NULL;
+}
+
+static const char *config_bulk_item(json_t *item)
+{
+	const int keys[] = { KEY_STATE, KEY_WEIGHT, KEY_PRIORITY };
+	const char *names[] = { CONFIG_KEY_STATE, CONFIG_KEY_WEIGHT, CONFIG_KEY_PRIORITY };
+	int values[sizeof(keys) / sizeof(keys[0])];
+	struct backend *b = NULL;
+	struct farm *f = NULL;
+	const char *err;
+	json_t *value;
+	unsigned int i;
+	int found = 0;
+
+	err = config_bulk_lookup(json_string_value(json_object_get(item, CONFIG_KEY_FARM)),
+				 json_string_value(json_object_get(item, CONFIG_KEY_BCK)), &f, &b);
+	if (err)
+		return err;
+
+	for (i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+		value = json_object_get(item, names[i]);
+		if (!value)
+			continue;
+
+		if (config_bulk_value(value, keys[i], &values[i]))
+			return "invalid value";
+		found = 1;
+	}
+
+	if (!found)
+		return "nothing to change";
+
+	for (i = 0; i < sizeof(keys) / sizeof(keys[0]); i++) {
+		if (!json_object_get(item, names[i]))
+			continue;
+
+		err = config_bulk_apply(f, b, keys[i], values[i]);
+		if (err)
+			return err;
+	}
+
+	return "success";
+}
+
+/*
+ * Generation of the farms listing, or of the given farm. It returns 0 if
+ * the farm doesn't exist.
+ */
+unsigned long config_get_generation(const char *name)
+{
+	unsigned long shared = obj_get_shared_generation();
+	struct farm *f;
+
+	if (!name || strcmp(name, "") == 0)
+		return obj_get_generation();
+
+	f = farm_lookup_by_name(name);
+	if (!f)
+		return 0;
+
+	return (f->generation > shared) ? f->generation : shared;
+}
+
+/*
+ * Generation of the policies listing, or of the given policy. It returns 0
+ * if the policy doesn't exist.
+ */
+unsigned long config_get_policy_generation(const char *name)
+{
+	unsigned long shared = obj_get_shared_generation();
+	struct policy *p;
+
+	if (!name || strcmp(name, "") == 0)
+		return obj_get_generation();
+
+	p = policy_lookup_by_name(name);
+	if (!p)
+		return 0;
+
+	return (p->generation > shared) ? p->generation : shared;
+}
+
+/*
+ * Apply a single change of the state, weight or priority of a backend.
+ * It returns NULL on success or the reason of the failure.
+ */
+const char *config_set_backend_value(const char *fname, const char *bname,
+				     const char *key, const char *value)
+{
+	struct backend *b = NULL;
+	struct farm *f = NULL;
+	const char *err;
+	int int_key, int_value;
+
+	if (!key)
+		return "the structure is invalid";
+
+	if (strcmp(key, CONFIG_KEY_STATE) == 0)
+		int_key = KEY_STATE;
+	else if (strcmp(key, CONFIG_KEY_WEIGHT) == 0)
+		int_key = KEY_WEIGHT;
+	else if (strcmp(key, CONFIG_KEY_PRIORITY) == 0)
+		int_key = KEY_PRIORITY;
+	else
+		return "unknown key";
+
+	err = config_bulk_lookup(fname, bname, &f, &b);
+	if (err)
+		return err;
+
+	if (config_bulk_string(value, int_key, &int_value))
+		return "invalid value";
+
+	return config_bulk_apply(f, b, int_key, int_value);
+}
+
+/*
+ * Apply a list of backend changes like
+ *   [ { "farm": "lb01", "backend": "bck1", "state": "down" },
+ *     { "farm": "lb01", "backend": "bck2", "weight": 5 } ]
+ * through the same setters used by the configuration, leaving the rules
+ * of the affected farms to be generated at once. The result of every item
+ * is dumped in buf. If any item fails it returns PARSER_VALID_FAILED, the
+ * changes of the other items are kept.
+ */
+int config_set_backends_state(const char *data, char **buf)
+{
+	json_t *root, *items, *item, *jresults, *jitem, *jdata;
+	const char *response;
+	struct stats_timer t;
+	json_error_t error;
+	size_t i, total, failed = 0;
+
+	stats_phase_begin(&t, STATS_PHASE_JSON);
+	root = json_loadb(data, strlen(data), 0, &error);
+	stats_phase_end(&t);
+	if (!root) {
+		tools_printlog(LOG_ERR, "Configuration error on line %d: %s", error.line, error.text);
+		return PARSER_STRUCT_FAILED;
+	}
+
+	items = json_is_object(root) ? json_object_get(root, CONFIG_KEY_STATES) : root;
+	if (!json_is_array(items)) {
+		json_decref(root);
+		return PARSER_STRUCT_FAILED;
+	}
+
+	total = json_array_size(items);
+	jresults = json_array();
+	json_array_foreach(items, i, item) {
+		response = json_is_object(item) ? config_bulk_item(item) : "the structure is invalid";
+		if (strcmp(response, "success") != 0)
+			failed++;
+
+		jitem = json_object();
+		add_dump_obj(jitem, CONFIG_KEY_FARM, (char *)json_string_value(json_object_get(item, CONFIG_KEY_FARM)));
+		add_dump_obj(jitem, CONFIG_KEY_BCK, (char *)json_string_value(json_object_get(item, CONFIG_KEY_BCK)));
+		add_dump_obj(jitem, CONFIG_KEY_RESPONSE, (char *)response);
+		json_array_append_new(jresults, jitem);
+	}
+	json_decref(root);
+
+	if (!failed)
+		response = "success";
+	else if (failed < total)
+		response = "some changes failed";
+	else
+		response = "every change failed";
+
+	jdata = json_object();
+	add_dump_obj(jdata, CONFIG_KEY_RESPONSE, (char *)response);
+	json_object_set_new(jdata, CONFIG_KEY_RESULTS, jresults);
+
+	free(*buf);
+	*buf = json_dumps(jdata, JSON_COMPACT);
+	json_decref(jdata);
+
+	if (*buf == NULL)
+		return PARSER_FAILED;
+
+	return failed ? PARSER_VALID_FAILED : PARSER_OK;
+}
+
 int config_print_addresses(char **buf, char *name)
 {
 	struct list_head *addresses = obj_get_addresses();
@@ -29,9 +29,11 @@
 #include "tools.h"
 #include "nft.h"
 
+static SLAB_POOL(elements_pool, "elements", struct element);
+
 static struct element * element_create(struct policy *p, char *data, char *time, char *counter_pkts, char *counter_bytes)
 {
-	struct element *e = (struct element *)malloc(sizeof(struct element));
+	struct element *e = (struct element *)slab_alloc(&elements_pool);
 	if (!e) {
 		tools_printlog(LOG_ERR, "element memory allocation error");
 		return NULL;
@@ -43,9 +45,11 @@ static struct element * element_create(struct policy *p, char *data, char *time,
 	e->action = ACTION_START;
 	e->time = DEFAULT_ELEMENT_TIME;
 	if (time && strcmp(time, "") != 0)
-		obj_set_attribute_string(time, &e->time);
-	obj_set_attribute_string(counter_pkts, &e->counter_pkts);
-	obj_set_attribute_string(counter_bytes, &e->counter_bytes);
+		obj_set_attribute_shared(time, &e->time);
+	e->counter_pkts = NULL;
+	e->counter_bytes = NULL;
+	obj_set_attribute_shared(counter_pkts, &e->counter_pkts);
+	obj_set_attribute_shared(counter_bytes, &e->counter_bytes);
 
 	list_add_tail(&e->list, &p->elements);
 	p->total_elem++;
@@ -58,14 +62,11 @@ static int element_delete_node(struct element *e)
 	list_del(&e->list);
 	if (e->data)
 		free(e->data);
-	if (e->time)
-		free(e->time);
-	if (e->counter_pkts)
-		free(e->counter_pkts);
-	if (e->counter_bytes)
-		free(e->counter_bytes);
+	slab_str_put(e->time);
+	slab_str_put(e->counter_pkts);
+	slab_str_put(e->counter_bytes);
 
-	free(e);
+	slab_free(&elements_pool, e);
 
 	return 0;
 }
@@ -228,9 +229,7 @@ int element_set_attribute(struct config_pair *c, int apply_action)
 		obj_set_current_element(e);
 		break;
 	case KEY_TIME:
-		if (e->time)
-			free(e->time);
-		obj_set_attribute_string(c->str_value, &e->time);
+		obj_set_attribute_shared(c->str_value, &e->time);
 		break;
 	case KEY_ACTION:
 		element_set_action(e, c->int_value);
@@ -28,7 +28,11 @@
 struct events_stct {
 	struct ev_loop *loop;
 	struct ev_io *srv_accept;
+	struct ev_io *srv_unix;
+	struct ev_io *srv_line;
 	struct ev_io *net_ntlnk;
+	struct ev_timer *commit;
+	struct ev_async *worker;
 };
 
 static struct events_stct st_ev;
@@ -86,3 +90,87 @@ void events_delete_srv(void)
 	if (st_ev.srv_accept)
 		free(st_ev.srv_accept);
 }
+
+struct ev_io *events_get_srv_unix(void)
+{
+	return st_ev.srv_unix;
+}
+
+struct ev_io *events_create_srv_unix(void)
+{
+	st_ev.srv_unix = (struct ev_io *)malloc(sizeof(struct ev_io));
+	return st_ev.srv_unix;
+}
+
+void events_delete_srv_unix(void)
+{
+	if (!st_ev.srv_unix)
+		return;
+
+	ev_io_stop(st_ev.loop, st_ev.srv_unix);
+	free(st_ev.srv_unix);
+	st_ev.srv_unix = NULL;
+}
+
+struct ev_io *events_get_srv_line(void)
+{
+	return st_ev.srv_line;
+}
+
+struct ev_io *events_create_srv_line(void)
+{
+	st_ev.srv_line = (struct ev_io *)malloc(sizeof(struct ev_io));
+	return st_ev.srv_line;
+}
+
+void events_delete_srv_line(void)
+{
+	if (!st_ev.srv_line)
+		return;
+
+	ev_io_stop(st_ev.loop, st_ev.srv_line);
+	free(st_ev.srv_line);
+	st_ev.srv_line = NULL;
+}
+
+struct ev_timer *events_get_commit(void)
+{
+	return st_ev.commit;
+}
+
+struct ev_timer *events_create_commit(void)
+{
+	st_ev.commit = (struct ev_timer *)malloc(sizeof(struct ev_timer));
+	return st_ev.commit;
+}
+
+void events_delete_commit(void)
+{
+	if (!st_ev.commit)
+		return;
+
+	ev_timer_stop(st_ev.loop, st_ev.commit);
+	free(st_ev.commit);
+	st_ev.commit = NULL;
+}
+
+struct ev_async *events_get_worker(void)
+{
+	return st_ev.worker;
+}
+
+struct ev_async *events_create_worker(void)
+{
+	st_ev.worker = (struct ev_async *)malloc(sizeof(struct ev_async));
+	return st_ev.worker;
+}
+
+void events_delete_worker(void)
+{
+	if (!st_ev.worker)
+		return;
+
+	ev_async_stop(st_ev.loop, st_ev.worker);
+	free(st_ev.worker);
+	st_ev.worker = NULL;
+}
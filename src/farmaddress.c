@@ -31,14 +31,29 @@
 #include "tools.h"
 
 
+static SLAB_POOL(farmaddresses_pool, "farmaddresses", struct farmaddress);
+
+/* farm addresses are indexed by the pair of farm and address */
+static struct objindex farmaddresses_index;
+
+static unsigned int farmaddress_hash(struct farm *f, struct address *a)
+{
+	return objindex_hash_ptr(a, objindex_hash_ptr(f, 0));
+}
+
 static struct farmaddress * farmaddress_create(struct farm *f, struct address *a)
 {
-	struct farmaddress *fa = (struct farmaddress *)malloc(sizeof(struct farmaddress));
+	struct farmaddress *fa = (struct farmaddress *)slab_alloc(&farmaddresses_pool);
 	if (!fa) {
 		tools_printlog(LOG_ERR, "Farm address memory allocation error");
 		return NULL;
 	}
 
+	if (objindex_add(&farmaddresses_index, &fa->hnode, farmaddress_hash(f, a))) {
+		slab_free(&farmaddresses_pool, fa);
+		return NULL;
+	}
+
 	fa->farm = f;
 	fa->address = a;
 	fa->action = DEFAULT_ACTION;
@@ -59,6 +74,7 @@ static int farmaddress_delete(struct farmaddress *fa)
 		return 0;
 
 	list_del(&fa->list);
+	objindex_del(&farmaddresses_index, &fa->hnode);
 
 	if (fa->farm->addresses_used > 0)
 		fa->farm->addresses_used--;
@@ -69,7 +85,7 @@ static int farmaddress_delete(struct farmaddress *fa)
 	if (address_not_used(fa->address))
 		address_delete(fa->address);
 
-	free(fa);
+	slab_free(&farmaddresses_pool, fa);
 
 	return 0;
 }
@@ -108,10 +124,17 @@ void farmaddress_s_print(struct farm *f)
 
 struct farmaddress * farmaddress_lookup_by_name(struct farm *f, const char *name)
 {
+	struct address *a = address_lookup_by_name(name);
 	struct farmaddress *fa;
+	struct hlist_node *pos;
+	unsigned int hash;
 
-	list_for_each_entry(fa, &f->addresses, list) {
-		if (strcmp(fa->address->name, name) == 0)
+	if (!a)
+		return NULL;
+
+	hash = farmaddress_hash(f, a);
+	hlist_for_each_entry(fa, pos, objindex_bucket(&farmaddresses_index, hash), hnode.node) {
+		if (fa->hnode.hash == hash && fa->farm == f && fa->address == a)
 			return fa;
 	}
 
@@ -134,6 +157,7 @@ int farmaddress_set_action(struct farmaddress *fa, int action)
 		if (action != ACTION_RELOAD && f->policies_used) {
 			f->policies_action = action;
 			fa->address->policies_action = action;
+			address_set_dirty(fa->address);
 		}
 
 		return 1;
@@ -174,8 +198,10 @@ int farmaddress_s_lookup_address_action(struct farm *f, char *name, int action)
 	if (fa)
 		ret = farmaddress_set_action(fa, action);
 
-	if (ret)
+	if (ret) {
 		f->action = ACTION_RELOAD;
+		farm_set_dirty(f);
+	}
 
 	return ret;
 }
@@ -369,9 +395,8 @@ int farmaddress_rename_default(struct config_pair *c)
 	if (!strstr(a->name, "-addr"))
 		return 1;
 
-	free(a->name);
 	farmaddress_set_default_addr_name(fa_name, c->str_value);
-	obj_set_attribute_string(fa_name, &a->name);
+	address_rename(a, fa_name);
 
 	return 0;
 }
@@ -31,9 +31,11 @@
 #include "tools.h"
 
 
+static SLAB_POOL(farmpolicies_pool, "farmpolicies", struct farmpolicy);
+
 static struct farmpolicy * farmpolicy_create(struct farm *f, struct policy *p)
 {
-	struct farmpolicy *fp = (struct farmpolicy *)malloc(sizeof(struct farmpolicy));
+	struct farmpolicy *fp = (struct farmpolicy *)slab_alloc(&farmpolicies_pool);
 	if (!fp) {
 		tools_printlog(LOG_ERR, "Farm Policy memory allocation error");
 		return NULL;
@@ -43,6 +45,7 @@ static struct farmpolicy * farmpolicy_create(struct farm *f, struct policy *p)
 	fp->policy = p;
 	fp->action = DEFAULT_ACTION;
 	p->used++;
+	policy_set_changed(p);
 
 	f->policies_action = DEFAULT_ACTION;
 
@@ -67,8 +70,9 @@ static int farmpolicy_delete(struct farmpolicy *fp)
 
 	if (fp->policy->used > 0)
 		fp->policy->used--;
+	policy_set_changed(fp->policy);
 
-	free(fp);
+	slab_free(&farmpolicies_pool, fp);
 
 	return 0;
 }
@@ -111,6 +115,7 @@ int farmpolicy_set_action(struct farmpolicy *fp, int action)
 	if (fp->action > action) {
 		fp->action = action;
 		fp->policy->action = ACTION_RELOAD;
+		policy_set_dirty(fp->policy);
 		// deactivate policies if it's the only one used
 		if (f->policies_used == 1 && fp->action == ACTION_STOP)
 			f->policies_action = action;
@@ -35,13 +35,26 @@
 #include "network.h"
 #include "tools.h"
 #include "nftst.h"
+#include "notify.h"
 
 
+static SLAB_POOL(farms_pool, "farms", struct farm);
+
+static struct objindex farms_index;
+
+/* farms with an action pending, the only ones to be rulerized */
+static LIST_HEAD(farms_dirty);
+
+static unsigned int farm_hash(const char *name)
+{
+	return objindex_hash_str(name, 0);
+}
+
 static struct farm * farm_create(char *name)
 {
 	struct list_head *farms = obj_get_farms();
 
-	struct farm *pfarm = (struct farm *)malloc(sizeof(struct farm));
+	struct farm *pfarm = (struct farm *)slab_alloc(&farms_pool);
 	if (!pfarm) {
 		tools_printlog(LOG_ERR, "Farm memory allocation error");
 		return NULL;
@@ -49,6 +62,12 @@ static struct farm * farm_create(char *name)
 
 	obj_set_attribute_string(name, &pfarm->name);
 
+	if (objindex_add(&farms_index, &pfarm->hnode, farm_hash(name))) {
+		free(pfarm->name);
+		slab_free(&farms_pool, pfarm);
+		return NULL;
+	}
+
 	pfarm->fqdn = DEFAULT_FQDN;
 	pfarm->oface = DEFAULT_IFNAME;
 	pfarm->oethaddr = DEFAULT_ETHADDR;
@@ -62,12 +81,14 @@ static struct farm * farm_create(char *name)
 	pfarm->persistttl = DEFAULT_PERSISTTM;
 	pfarm->helper = DEFAULT_HELPER;
 	pfarm->log = DEFAULT_LOG;
-	pfarm->logprefix = DEFAULT_LOG_LOGPREFIX;
+	pfarm->logprefix = slab_str_get(DEFAULT_LOG_LOGPREFIX);
 	pfarm->logrtlimit = DEFAULT_LOG_RTLIMIT;
 	pfarm->logrtlimit_unit = DEFAULT_RTLIMIT_UNIT;
 	pfarm->mark = DEFAULT_MARK;
 	pfarm->state = DEFAULT_FARM_STATE;
 	pfarm->action = DEFAULT_ACTION;
+	init_list_head(&pfarm->dirty);
+	farm_set_dirty(pfarm);
 	pfarm->reload_action = VALUE_RLD_NONE;
 
 	init_list_head(&pfarm->backends);
@@ -79,15 +100,15 @@ static struct farm * farm_create(char *name)
 	pfarm->newrtlimit = DEFAULT_NEWRTLIMIT;
 	pfarm->newrtlimit_unit = DEFAULT_RTLIMIT_UNIT;
 	pfarm->newrtlimitbst = DEFAULT_RTLIMITBURST;
-	pfarm->newrtlimit_logprefix = DEFAULT_LOGPREFIX;
+	pfarm->newrtlimit_logprefix = slab_str_get(DEFAULT_LOGPREFIX);
 	pfarm->rstrtlimit = DEFAULT_RSTRTLIMIT;
 	pfarm->rstrtlimit_unit = DEFAULT_RTLIMIT_UNIT;
 	pfarm->rstrtlimitbst = DEFAULT_RTLIMITBURST;
-	pfarm->rstrtlimit_logprefix = DEFAULT_LOGPREFIX;
+	pfarm->rstrtlimit_logprefix = slab_str_get(DEFAULT_LOGPREFIX);
 	pfarm->estconnlimit = DEFAULT_ESTCONNLIMIT;
-	pfarm->estconnlimit_logprefix = DEFAULT_LOGPREFIX;
+	pfarm->estconnlimit_logprefix = slab_str_get(DEFAULT_LOGPREFIX);
 	pfarm->tcpstrict = DEFAULT_TCPSTRICT;
-	pfarm->tcpstrict_logprefix = DEFAULT_LOGPREFIX;
+	pfarm->tcpstrict_logprefix = slab_str_get(DEFAULT_LOGPREFIX);
 	pfarm->queue = DEFAULT_QUEUE;
 	pfarm->verdict = DEFAULT_VERDICT;
 	pfarm->flow_offload = DEFAULT_FLOWOFFLOAD;
@@ -102,6 +123,10 @@ static struct farm * farm_create(char *name)
 	pfarm->policies_used = 0;
 	pfarm->policies_action = ACTION_NONE;
 	pfarm->nft_chains = 0;
+	pfarm->nft_bck_maps = 0;
+	pfarm->nft_bck_slots = 0;
+	pfarm->nft_bck_shape = 0;
+	pfarm->generation = obj_new_generation();
 
 	init_list_head(&pfarm->static_sessions);
 	pfarm->total_static_sessions = 0;
@@ -128,6 +153,8 @@ static int farm_delete(struct farm *pfarm)
 	farmpolicy_s_delete(pfarm);
 	farmaddress_s_delete(pfarm);
 	list_del(&pfarm->list);
+	list_del(&pfarm->dirty);
+	objindex_del(&farms_index, &pfarm->hnode);
 
 	if (pfarm->name && strcmp(pfarm->name, "") != 0)
 		free(pfarm->name);
@@ -137,18 +164,16 @@ static int farm_delete(struct farm *pfarm)
 		free(pfarm->oface);
 	if (pfarm->oethaddr && strcmp(pfarm->oethaddr, "") != 0)
 		free(pfarm->oethaddr);
-	if (pfarm->logprefix && strcmp(pfarm->logprefix, DEFAULT_LOG_LOGPREFIX) != 0)
-		free(pfarm->logprefix);
-	if (pfarm->newrtlimit_logprefix && strcmp(pfarm->newrtlimit_logprefix, DEFAULT_LOGPREFIX) != 0)
-		free(pfarm->newrtlimit_logprefix);
-	if (pfarm->rstrtlimit_logprefix && strcmp(pfarm->rstrtlimit_logprefix, DEFAULT_LOGPREFIX) != 0)
-		free(pfarm->rstrtlimit_logprefix);
-	if (pfarm->estconnlimit_logprefix && strcmp(pfarm->estconnlimit_logprefix, DEFAULT_LOGPREFIX) != 0)
-		free(pfarm->estconnlimit_logprefix);
-	if (pfarm->tcpstrict_logprefix && strcmp(pfarm->tcpstrict_logprefix, DEFAULT_LOGPREFIX) != 0)
-		free(pfarm->tcpstrict_logprefix);
-
-	free(pfarm);
+	slab_str_put(pfarm->logprefix);
+	slab_str_put(pfarm->newrtlimit_logprefix);
+	slab_str_put(pfarm->rstrtlimit_logprefix);
+	slab_str_put(pfarm->estconnlimit_logprefix);
+	slab_str_put(pfarm->tcpstrict_logprefix);
+
+	if (obj_get_current_farm() == pfarm)
+		obj_set_current_farm(NULL);
+
+	slab_free(&farms_pool, pfarm);
 	obj_set_total_farms(obj_get_total_farms() - 1);
 
 	return 0;
@@ -323,6 +348,11 @@ static int farm_set_mark(struct farm *f, int new_value)
 	return 0;
 }
 
+void farm_set_changed(struct farm *f)
+{
+	f->generation = obj_new_generation();
+}
+
 static int farm_set_state(struct farm *f, int new_value)
 {
 	int old_value = f->state;
@@ -333,6 +363,12 @@ static int farm_set_state(struct farm *f, int new_value)
 	if (new_value == VALUE_STATE_AVAIL)
 		new_value = VALUE_STATE_UP;
 
+	if (old_value != new_value) {
+		farm_set_changed(f);
+		notify_event(NOTIFY_EVENT_FARM, "{s:s,s:s}",
+			     CONFIG_KEY_FARM, f->name, CONFIG_KEY_STATE, obj_print_state(new_value));
+	}
+
 	if (new_value == VALUE_STATE_CONFERR) {
 		f->state = new_value;
 		farm_set_action(f, ACTION_NONE);
@@ -535,6 +571,7 @@ static void farm_print(struct farm *f)
 	tools_printlog(LOG_DEBUG,"   *[total_static_sessions] %d", f->total_static_sessions);
 	tools_printlog(LOG_DEBUG,"   *[total_timed_sessions] %d", f->total_timed_sessions);
 	tools_printlog(LOG_DEBUG,"   *[nft_chains] %x", f->nft_chains);
+	tools_printlog(LOG_DEBUG,"   *[nft_bck_maps] %x", f->nft_bck_maps);
 	tools_printlog(LOG_DEBUG,"   *[addresses_used] %d", f->addresses_used);
 	tools_printlog(LOG_DEBUG,"   *[reload_action] %x", f->reload_action);
 	tools_printlog(LOG_DEBUG,"   *[%s] %d", CONFIG_KEY_ACTION, f->action);
@@ -874,11 +911,12 @@ void farm_s_print(void)
 
 struct farm * farm_lookup_by_name(const char *name)
 {
-	struct list_head *farms = obj_get_farms();
+	unsigned int hash = farm_hash(name);
+	struct hlist_node *pos;
 	struct farm *f;
 
-	list_for_each_entry(f, farms, list) {
-		if (strcmp(f->name, name) == 0)
+	hlist_for_each_entry(f, pos, objindex_bucket(&farms_index, hash), hnode.node) {
+		if (f->hnode.hash == hash && strcmp(f->name, name) == 0)
 			return f;
 	}
 
@@ -1068,8 +1106,10 @@ int farm_set_attribute(struct config_pair *c)
 		nf = farm_lookup_by_name(c->str_value);
 		if (!nf) {
 			farmaddress_rename_default(c);
+			objindex_del(&farms_index, &f->hnode);
 			free(f->name);
 			obj_set_attribute_string(c->str_value, &f->name);
+			objindex_add(&farms_index, &f->hnode, farm_hash(f->name));
 		}
 		ret = PARSER_OK;
 		break;
@@ -1234,9 +1274,7 @@ int farm_set_attribute(struct config_pair *c)
 		ret = PARSER_OK;
 		break;
 	case KEY_LOGPREFIX:
-		if (strcmp(f->logprefix, DEFAULT_LOG_LOGPREFIX) != 0)
-			free(f->logprefix);
-		ret = obj_set_attribute_string(c->str_value, &f->logprefix);
+		ret = obj_set_attribute_shared(c->str_value, &f->logprefix);
 		break;
 	case KEY_LOG_RTLIMIT:
 		f->logrtlimit = c->int_value;
@@ -1248,24 +1286,16 @@ int farm_set_attribute(struct config_pair *c)
 		ret = PARSER_OK;
 		break;
 	case KEY_NEWRTLIMIT_LOGPREFIX:
-		if (strcmp(f->newrtlimit_logprefix, DEFAULT_LOGPREFIX) != 0)
-			free(f->newrtlimit_logprefix);
-		ret = obj_set_attribute_string(c->str_value, &f->newrtlimit_logprefix);
+		ret = obj_set_attribute_shared(c->str_value, &f->newrtlimit_logprefix);
 		break;
 	case KEY_RSTRTLIMIT_LOGPREFIX:
-		if (strcmp(f->rstrtlimit_logprefix, DEFAULT_LOGPREFIX) != 0)
-			free(f->rstrtlimit_logprefix);
-		ret = obj_set_attribute_string(c->str_value, &f->rstrtlimit_logprefix);
+		ret = obj_set_attribute_shared(c->str_value, &f->rstrtlimit_logprefix);
 		break;
 	case KEY_ESTCONNLIMIT_LOGPREFIX:
-		if (strcmp(f->estconnlimit_logprefix, DEFAULT_LOGPREFIX) != 0)
-			free(f->estconnlimit_logprefix);
-		ret = obj_set_attribute_string(c->str_value, &f->estconnlimit_logprefix);
+		ret = obj_set_attribute_shared(c->str_value, &f->estconnlimit_logprefix);
 		break;
 	case KEY_TCPSTRICT_LOGPREFIX:
-		if (strcmp(f->tcpstrict_logprefix, DEFAULT_LOGPREFIX) != 0)
-			free(f->tcpstrict_logprefix);
-		ret = obj_set_attribute_string(c->str_value, &f->tcpstrict_logprefix);
+		ret = obj_set_attribute_shared(c->str_value, &f->tcpstrict_logprefix);
 		break;
 	case KEY_INTRACONNECT:
 		f->intra_connect = c->int_value;
@@ -1283,6 +1313,10 @@ int farm_set_action(struct farm *f, int action)
 	tools_printlog(LOG_DEBUG, "%s():%d: farm %s action is %d - new action %d state %d", __FUNCTION__, __LINE__, f->name, f->action, action, f->state);
 	int force = 0;
 
+	// any farm action requires the whole farm to be regenerated
+	if (action != ACTION_NONE)
+		f->reload_action &= ~VALUE_RLD_BCKS_STATE;
+
 	if (action == ACTION_STOP && f->state == VALUE_STATE_CONFERR) {
 		f->policies_action = ACTION_NONE;
 		if (farm_validate(f)) {
@@ -1309,6 +1343,7 @@ int farm_set_action(struct farm *f, int action)
 		backend_s_gen_priority(f, ACTION_RELOAD);
 		farm_manage_eventd();
 		f->action = action;
+		farm_set_dirty(f);
 		farm_set_netinfo(f);
 		backend_s_validate(f);
 		if (action == ACTION_STOP || action == ACTION_START)
@@ -1319,6 +1354,29 @@ int farm_set_action(struct farm *f, int action)
 	return 0;
 }
 
+/*
+ * Backend state changes of a running farm only modify the content of the
+ * backend maps, so they're applied as element updates instead of
+ * flushing and regenerating the farm chains.
+ */
+int farm_set_bcks_action(struct farm *f)
+{
+	tools_printlog(LOG_DEBUG, "%s():%d: farm %s action is %d state %d", __FUNCTION__, __LINE__, f->name, f->action, f->state);
+
+	if (f->action == ACTION_RELOAD && (f->reload_action & VALUE_RLD_BCKS_STATE))
+		return 0;
+
+	if (f->action != ACTION_NONE || f->state != VALUE_STATE_UP || !f->nft_bck_maps)
+		return farm_set_action(f, ACTION_RELOAD);
+
+	farm_manage_eventd();
+	f->action = ACTION_RELOAD;
+	f->reload_action |= VALUE_RLD_BCKS_STATE;
+	farm_set_dirty(f);
+
+	return 1;
+}
+
 int farm_s_set_action(int action)
 {
 	struct list_head *farms = obj_get_farms();
@@ -1350,8 +1408,12 @@ int farm_s_clean_nft_chains(void)
 	if (!farms)
 		return 0;
 
-	list_for_each_entry_safe(f, next, farms, list)
+	list_for_each_entry_safe(f, next, farms, list) {
 		f->nft_chains = 0;
+		f->nft_bck_maps = 0;
+		f->nft_bck_slots = 0;
+		f->nft_bck_shape = 0;
+	}
 
 	return 0;
 }
@@ -1365,14 +1427,42 @@ int farm_get_masquerade(struct farm *f)
 	return masq;
 }
 
+/*
+ * Only the farms with a backend using the ip address are updated. They are
+ * collected first, as updating them may rulerize.
+ */
 void farm_s_set_backend_ether_by_oifidx(int interface_idx, const char * ip_bck, char * ether_bck)
 {
-	struct list_head *farms = obj_get_farms();
+	struct backend *b = NULL;
+	struct farm **farms;
 	struct farm *f;
+	int total = 0;
+	int i, n;
 
 	tools_printlog(LOG_DEBUG, "%s():%d: updating farms with backends ip address %s and ether address %s", __FUNCTION__, __LINE__, ip_bck, ether_bck);
 
-	list_for_each_entry(f, farms, list) {
+	while ((b = backend_next_by_ipaddr(ip_bck, b)) != NULL)
+		total++;
+
+	if (!total)
+		return;
+
+	farms = (struct farm **)malloc(total * sizeof(struct farm *));
+	if (!farms) {
+		tools_printlog(LOG_ERR, "%s():%d: farms memory allocation error", __FUNCTION__, __LINE__);
+		return;
+	}
+
+	/* every farm once, in the order its backends are found */
+	for (n = 0, b = NULL; (b = backend_next_by_ipaddr(ip_bck, b)) != NULL; ) {
+		for (i = 0; i < n && farms[i] != b->parent; i++)
+			;
+		if (i == n)
+			farms[n++] = b->parent;
+	}
+
+	for (i = 0; i < n; i++) {
+		f = farms[i];
 
 		tools_printlog(LOG_DEBUG, "%s():%d: farm with oifidx %d found", __FUNCTION__, __LINE__, interface_idx);
 
@@ -1388,6 +1478,8 @@ void farm_s_set_backend_ether_by_oifidx(int interface_idx, const char * ip_bck,
 			farm_rulerize(f);
 		}
 	}
+
+	free(farms);
 }
 
 int farm_s_lookup_policy_action(char *name, int action)
@@ -1421,11 +1513,13 @@ int farm_rulerize(struct farm *f)
 {
 	tools_printlog(LOG_DEBUG, "%s():%d: rulerize farm %s action %d", __FUNCTION__, __LINE__, f->name, f->action);
 
-	farm_print(f);
-
 	if (f->action == ACTION_NONE)
 		return 0;
 
+	farm_print(f);
+
+	farm_set_changed(f);
+
 	if (f->state == VALUE_STATE_CONFERR && farm_validate(f))
 		farm_set_state(f, VALUE_STATE_UP);
 
@@ -1441,16 +1535,27 @@ int farm_rulerize(struct farm *f)
 	return nft_rulerize_farms(f);
 }
 
+void farm_set_dirty(struct farm *f)
+{
+	if (list_empty(&f->dirty))
+		list_add_tail(&f->dirty, &farms_dirty);
+}
+
 int farm_s_rulerize(void)
 {
-	struct list_head *farms = obj_get_farms();
-	struct farm *f, *next;
+	struct farm *f;
 	int ret = 0;
 	int output = 0;
+	LIST_HEAD(dirty);
 
 	tools_printlog(LOG_DEBUG, "%s():%d: rulerize everything", __FUNCTION__, __LINE__);
 
-	list_for_each_entry_safe(f, next, farms, list) {
+	/* farms marked while rulerizing wait for the next round */
+	list_splice_init(&farms_dirty, &dirty);
+
+	while (!list_empty(&dirty)) {
+		f = list_first_entry(&dirty, struct farm, dirty);
+		list_del_init(&f->dirty);
 		ret = farm_rulerize(f);
 		output = output || ret;
 	}
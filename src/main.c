@@ -26,6 +26,7 @@
 #include <errno.h>
 #include <unistd.h>
 #include <execinfo.h>
+#include <time.h>
 
 #include "config.h"
 #include "objects.h"
@@ -44,6 +45,7 @@
 
 unsigned int serialize = NFTLB_NFT_SERIALIZE;
 int masquerade_mark = NFTLB_MASQUERADE_MARK_DEFAULT;
+int nft_backend = NFTLB_BACKEND_TEXT;
 
 static void print_usage(const char *prog_name)
 {
@@ -61,8 +63,16 @@ static void print_usage(const char *prog_name)
             "  [ -6 | --ipv6 ]			Enable IPv6 listening port\n"
             "  [ -H <HOST> | --host <HOST> ]		Set the host for the listening port\n"
             "  [ -P <PORT> | --port <PORT> ]		Set the port for the listening port\n"
+            "  [ -U <PATH> | --unix <PATH> ]		Listen also on the given unix socket\n"
+            "  [ -T <PORT> | --line-port <PORT> ]	Listen also on the given port for line protocol backend updates\n"
             "  [ -S | --serial ]			Serialize nft commands\n"
             "  [ -m | --masquerade-mark ]			Set masquerade mark in hex\n"
+            "  [ -b <BACKEND> | --backend <BACKEND> ]	Set the nft backend for set and backend map elements: text (default) or netlink\n"
+            "  [ -w <MSECS> | --commit-window <MSECS> ]	Coalesce API changes received within the window in a single commit\n"
+            "  [ -t | --server-timing ]		Send the time spent in every phase of the API requests in a Server-Timing header\n"
+            "  [ -C <FILE> | --compile <FILE> ]	Generate the nft script of the given configuration file without applying it\n"
+            "  [ -o <FILE> | --output <FILE> ]	Write the compiled nft script to the given file instead of stdout\n"
+            "  [ -a | --adopt ]			Take over the existing nftlb tables without flushing them on startup\n"
             , prog_name, VERSION, prog_name);
 }
 
@@ -77,8 +87,16 @@ static const struct option options[] = {
         { .name = "ipv6",	.has_arg = 0,	.val = '6' },
         { .name = "host",	.has_arg = 1,	.val = 'H' },
         { .name = "port",	.has_arg = 1,	.val = 'P' },
+        { .name = "unix",	.has_arg = 1,	.val = 'U' },
+        { .name = "line-port",	.has_arg = 1,	.val = 'T' },
         { .name = "serial",	.has_arg = 0,	.val = 'S' },
         { .name = "masquerade-mark",	.has_arg = 1,	.val = 'm' },
+        { .name = "backend",	.has_arg = 1,	.val = 'b' },
+        { .name = "commit-window",	.has_arg = 1,	.val = 'w' },
+        { .name = "server-timing",	.has_arg = 0,	.val = 't' },
+        { .name = "compile",	.has_arg = 1,	.val = 'C' },
+        { .name = "output",	.has_arg = 1,	.val = 'o' },
+        { .name = "adopt",	.has_arg = 0,	.val = 'a' },
         { NULL },
 };
 
@@ -86,6 +104,7 @@ static void nftlb_sighandler(int signo)
 {
     tools_printlog(LOG_INFO, "shutting down %s, bye", PACKAGE);
     server_fini();
+    nft_fini();
     exit(EXIT_SUCCESS);
 }
 
@@ -116,12 +135,68 @@ static void nftlb_trace() {
         exit(EXIT_FAILURE);
 }
 
-static int main_process(const char *config, int mode)
+static double elapsed_msecs(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000. + (end->tv_nsec - start->tv_nsec) / 1000000.;
+}
+
+/*
+ * Run the configuration through the rulerize and write the resulting nft
+ * script instead of applying it, which needs neither root nor nftables.
+ */
+static int compile_process(const char *config, const char *output)
+{
+    struct timespec t_start, t_config, t_rules;
+    FILE *fd = stdout;
+    int ret = EXIT_SUCCESS;
+
+    objects_init();
+    loop_init();
+
+    if (output) {
+        fd = fopen(output, "w");
+        if (!fd) {
+            tools_printlog(LOG_ERR, "Unable to open %s: %s", output, strerror(errno));
+            return EXIT_FAILURE;
+        }
+    }
+
+    nft_compile_start(fd);
+
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+    if (config_file(config) != 0) {
+        ret = EXIT_FAILURE;
+        goto out;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &t_config);
+
+    if (obj_rulerize(OBJ_START) != 0)
+        ret = EXIT_FAILURE;
+    clock_gettime(CLOCK_MONOTONIC, &t_rules);
+
+    fprintf(stderr, "compiled %s: config %.3f ms, rules %.3f ms\n", config,
+            elapsed_msecs(&t_start, &t_config), elapsed_msecs(&t_config, &t_rules));
+
+out:
+    nft_compile_stop();
+    if (output)
+        fclose(fd);
+    nft_fini();
+
+    return ret;
+}
+
+static int main_process(const char *config, int mode, int adopt)
 {
     objects_init();
 
-    if (nft_check_tables())
-        nft_reset();
+    if (nft_check_tables()) {
+        if (adopt && nft_adopt_begin() != 0)
+            adopt = 0;
+        if (!adopt)
+            nft_reset();
+    } else
+        adopt = 0;
 
     loop_init();
 
@@ -133,6 +208,13 @@ static int main_process(const char *config, int mode)
 
     obj_rulerize(OBJ_START);
 
+    /* the tables adopted can't be trusted, so they're loaded from scratch */
+    if (adopt && nft_adopt_commit() != 0) {
+        tools_printlog(LOG_ERR, "Cannot adopt the existing nftlb tables, reloading them");
+        if (!obj_recovery())
+            return EXIT_FAILURE;
+    }
+
     if (mode == NFTLB_EXIT_MODE)
         return EXIT_SUCCESS;
 
@@ -154,6 +236,9 @@ int main(int argc, char *argv[])
     int		loglevel = NFTLB_LOG_LEVEL_DEFAULT;
     int		logoutput = NFTLB_LOG_OUTPUT_DEFAULT;
     const char	*config = NULL;
+    const char	*compile = NULL;
+    const char	*output = NULL;
+    int		adopt = 0;
     pid_t	pid;
 
     char server_key[NFTLB_MAX_KEYSIZE];
@@ -164,7 +249,7 @@ int main(int argc, char *argv[])
         strncpy( server_key, _server_key, NFTLB_MAX_KEYSIZE - 1 );
         server_set_key(server_key);
     }
-    while ((c = getopt_long(argc, argv, "hl:L:c:k:ed6H:P:Sm:", options, NULL)) != -1) {
+    while ((c = getopt_long(argc, argv, "hl:L:c:k:ed6H:P:U:T:Sm:b:w:tC:o:a", options, NULL)) != -1) {
         switch (c) {
             case 'h':
                 print_usage(argv[0]);
@@ -197,12 +282,44 @@ int main(int argc, char *argv[])
             case 'P':
                 server_set_port(optarg);
                 break;
+            case 'U':
+                server_set_unix(optarg);
+                break;
+            case 'T':
+                server_set_line_port(optarg);
+                break;
             case 'S':
                 serialize = 1;
                 break;
             case 'm':
                 masquerade_mark = (int)strtol(optarg, NULL, 16);
                 break;
+            case 'b':
+                if (strcmp(optarg, "netlink") == 0)
+                    nft_backend = NFTLB_BACKEND_NETLINK;
+                else if (strcmp(optarg, "text") == 0)
+                    nft_backend = NFTLB_BACKEND_TEXT;
+                else {
+                    tools_printlog(LOG_ERR, "Unknown nft backend %s", optarg);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'w':
+                if (server_set_commit_window(atoi(optarg)) != 0)
+                    return EXIT_FAILURE;
+                break;
+            case 't':
+                server_set_timing();
+                break;
+            case 'C':
+                compile = optarg;
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            case 'a':
+                adopt = 1;
+                break;
             default:
                 tools_printlog(LOG_ERR, "Unknown option -%c", optopt);
                 return EXIT_FAILURE;
@@ -221,19 +338,23 @@ int main(int argc, char *argv[])
     tools_log_set_level(loglevel);
     tools_log_set_output(logoutput);
 
+    if (compile) {
+        /* set elements can't be sent as netlink messages to a file */
+        nft_backend = NFTLB_BACKEND_TEXT;
+        return compile_process(compile, output);
+    }
+
     if (run_mode) {
         pid = fork();
         if (pid == -1) {
             tools_printlog(LOG_ERR, "Daemon mode aborted: %s", strerror(errno));
             return EXIT_FAILURE;
         } else if (pid == 0) {
-            main_process(config, mode);
+            return main_process(config, mode, adopt);
         } else {
             return EXIT_SUCCESS;
         }
-    } else {
-        main_process(config, mode);
     }
 
-    return EXIT_SUCCESS;
+    return main_process(config, mode, adopt);
 }
\ No newline at end of file
@@ -39,6 +39,9 @@
 #include "farms.h"
 #include "checksum.h"
 #include "tools.h"
+#include "config.h"
+#include "notify.h"
+#include "stats.h"
 
 #define ARP_TABLE_RETRY_SLEEP		1000
 #define ICMP_PROTO					1
@@ -618,6 +621,8 @@ static int data_getev_cb(const struct nlmsghdr *nlh, void *data)
 
 	tools_printlog(LOG_DEBUG, "%s():%d: netlink read new info", __FUNCTION__, __LINE__);
 
+	stats_count(STATS_CNT_NETLINK_EVENTS, 1);
+
 	if (nlh->nlmsg_type != RTM_NEWNEIGH)
 		return MNL_CB_STOP;
 
@@ -635,8 +640,11 @@ static int data_getev_cb(const struct nlmsghdr *nlh, void *data)
 		sprintf(streth, "%02x:%02x:%02x:%02x:%02x:%02x", dst_ethaddr[0], dst_ethaddr[1],
 			dst_ethaddr[2], dst_ethaddr[3], dst_ethaddr[4], dst_ethaddr[5]);
 
-		if ((ndm->ndm_state & NUD_REACHABLE) || (ndm->ndm_state & NUD_PERMANENT) || (ndm->ndm_state & NUD_STALE))
+		if ((ndm->ndm_state & NUD_REACHABLE) || (ndm->ndm_state & NUD_PERMANENT) || (ndm->ndm_state & NUD_STALE)) {
+			notify_event(NOTIFY_EVENT_NEIGH, "{s:i,s:s,s:s}", "ifindex", ndm->ndm_ifindex,
+				     CONFIG_KEY_IPADDR, str_ipaddr, CONFIG_KEY_ETHADDR, streth);
 			farm_s_set_backend_ether_by_oifidx(ndm->ndm_ifindex, str_ipaddr, streth);
+		}
 
 		tools_printlog(LOG_DEBUG, "%s():%d: [NEW NEIGH] family=%u ifindex=%u state=%u dstaddr=%s macaddr=%s",
 					   __FUNCTION__, __LINE__, ndm->ndm_family, ndm->ndm_ifindex, ndm->ndm_state, str_ipaddr,
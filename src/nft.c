@@ -33,14 +33,32 @@
 #include "config.h"
 #include "list.h"
 #include "sbuffer.h"
+#include "nlbatch.h"
+#include "shadow.h"
+#include "worker.h"
+#include "notify.h"
+#include "stats.h"
 #include "tools.h"
 
 #include <stdlib.h>
 #include <nftables/libnftables.h>
+#include <jansson.h>
+#include <arpa/inet.h>
+#include <libmnl/libmnl.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nf_tables.h>
 #include <string.h>
 #include <stdarg.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/time.h>
 
 #define NFTLB_MAX_CMD				2048
+#define NFTLB_GENID_TIMEOUT_MS		500
+#define NFTLB_NL_VALUE_LEN			20
+#define NFTLB_NL_ETHER_LEN			6
 #define NFTLB_MAX_IFACES			100
 #define NFTLB_MAX_PORTS				65535
 #define NFTLB_MAX_OBJ_NAME			256
@@ -107,6 +125,7 @@
 #define NFTLB_MAP_TYPE_MAC			"ether_addr"
 #define NFTLB_MAP_TYPE_MARK			"mark"
 #define NFTLB_MAP_TYPE_PROTO		"inet_proto"
+#define NFTLB_MAP_TYPE_IFACE		"iface_index"
 
 #define NFTLB_IPV4_FAMILY			0
 #define NFTLB_IPV6_FAMILY			1
@@ -154,7 +173,48 @@
 
 extern unsigned int serialize;
 extern int masquerade_mark;
-struct nft_ctx *ctx = NULL;
+extern int nft_backend;
+
+struct nft_ctx_mgr {
+	struct nft_ctx		*ctx;
+	struct nft_ctx		*list_ctx;
+	struct mnl_socket	*nl;
+	unsigned int		portid;
+	uint32_t			genid;
+	int					genid_valid;
+	unsigned int		epoch;
+	unsigned int		seq;
+};
+
+struct nft_cmd_batch {
+	struct sbuffer		cmds;
+	struct sbuffer		full;
+	unsigned int		epoch;
+	struct nlbatch		maps;
+};
+
+static struct nft_ctx_mgr ctx_mgr = { NULL, NULL, NULL, 0, 0, 0, 0, 0 };
+static struct nlbatch *nl_batch = NULL;
+static struct nlbatch *nl_maps = NULL;
+static struct nft_cmd_batch *cmd_batch = NULL;
+static unsigned int shadow_epoch = 0;
+static int sync_depth = 0;
+static unsigned long recovery_seq = 0;
+static nft_commit_fn commit_cb = NULL;
+static FILE *compile_out = NULL;
+
+struct adopt_obj {
+	struct list_head	list;
+	char				kind[NFTLB_MAX_OBJ_NAME];
+	char				family[NFTLB_MAX_OBJ_NAME];
+	char				name[NFTLB_MAX_OBJ_NAME];
+	int					dynamic;
+};
+
+static LIST_HEAD(adopt_objs);
+static int adopting = 0;
+static int adopt_serialize;
+static int adopt_backend;
 
 int nftlb_flowtable_prio = NFTLB_FLOWTABLE_BASE_PRIO;
 
@@ -192,6 +252,26 @@ enum map_modes {
 	BCK_MAP_PORT,
 };
 
+struct bck_map {
+	enum map_modes		key_mode;
+	enum map_modes		data_mode;
+	int					usable;
+};
+
+// per farm named backend maps, the position in the table is the nft_bck_maps bit
+static const struct bck_map bck_maps[] = {
+	{ BCK_MAP_WEIGHT,	BCK_MAP_MARK,			NFTLB_CHECK_AVAIL },
+	{ BCK_MAP_MARK,		BCK_MAP_IPADDR,			NFTLB_CHECK_USABLE },
+	{ BCK_MAP_MARK,		BCK_MAP_IPADDR_PORT,	NFTLB_CHECK_USABLE },
+	{ BCK_MAP_WEIGHT,	BCK_MAP_ETHADDR,		NFTLB_CHECK_AVAIL },
+	{ BCK_MAP_WEIGHT,	BCK_MAP_IPADDR,			NFTLB_CHECK_AVAIL },
+	{ BCK_MAP_IPADDR,	BCK_MAP_ETHADDR,		NFTLB_CHECK_AVAIL },
+	{ BCK_MAP_ETHADDR,	BCK_MAP_PORT,			NFTLB_CHECK_AVAIL },
+	{ BCK_MAP_ETHADDR,	BCK_MAP_OFACE,			NFTLB_CHECK_AVAIL },
+};
+
+#define NFTLB_BCK_MAPS_NUM			(int)(sizeof(bck_maps) / sizeof(bck_maps[0]))
+
 struct if_base_rule {
 	char				*ifname;
 	unsigned int		rules_v4;
@@ -374,6 +454,69 @@ static void print_nft_base_rules(void)
 	tools_printlog(LOG_DEBUG, "%s():    ndv_ingress_dnat_rules = %d", __FUNCTION__, nft_base_rules.ndv_ingress_dnat_rules.n_interfaces);
 }
 
+static void dump_srv_family_metrics(struct sbuffer *buf, const char *chain, const char *family,
+				    struct nft_chain_srv_family_counters *cnt)
+{
+	concat_buf(buf, "nftlb_service_rules{chain=\"%s\",family=\"%s\",match=\"proto-ip-port\"} %u\n",
+		   chain, family, cnt->proto_ip_port_cnt);
+	concat_buf(buf, "nftlb_service_rules{chain=\"%s\",family=\"%s\",match=\"proto-port\"} %u\n",
+		   chain, family, cnt->proto_port_cnt);
+	concat_buf(buf, "nftlb_service_rules{chain=\"%s\",family=\"%s\",match=\"proto-ip\"} %u\n",
+		   chain, family, cnt->proto_ip_cnt);
+	concat_buf(buf, "nftlb_service_rules{chain=\"%s\",family=\"%s\",match=\"mark\"} %u\n",
+		   chain, family, cnt->bckmark_cnt);
+}
+
+static void dump_base_rule_metric(struct sbuffer *buf, const char *chain, unsigned int v4, unsigned int v6)
+{
+	concat_buf(buf, "nftlb_base_rules{chain=\"%s\",family=\"ipv4\"} %u\n", chain, v4);
+	concat_buf(buf, "nftlb_base_rules{chain=\"%s\",family=\"ipv6\"} %u\n", chain, v6);
+}
+
+/* the rules accounting kept to build the base chains, in prometheus format */
+int nft_dump_metrics(struct sbuffer *buf)
+{
+	static const char *chains[NFTLB_F_CHAIN_MAX] = {
+		"ingress-filter",
+		"ingress-dnat",
+		"prerouting-filter",
+		"prerouting-dnat",
+		"forward-filter",
+		"postrouting-snat",
+		"output-filter",
+		"output-dnat",
+	};
+	int i;
+
+	stats_metric_header(buf, "nftlb_service_rules", "gauge", "Services matched in the base chains by chain, family and match.");
+	for (i = 0; i < NFTLB_F_CHAIN_MAX; i++) {
+		dump_srv_family_metrics(buf, chains[i], "ipv4", &service_counters[i].ipv4_counters);
+		dump_srv_family_metrics(buf, chains[i], "ipv6", &service_counters[i].ipv6_counters);
+	}
+
+	stats_metric_header(buf, "nftlb_base_rules", "gauge", "Rules of the base chains by chain and family.");
+	dump_base_rule_metric(buf, "dnat", nft_base_rules.dnat_rules_v4, nft_base_rules.dnat_rules_v6);
+	dump_base_rule_metric(buf, "snat", nft_base_rules.snat_rules_v4, nft_base_rules.snat_rules_v6);
+	dump_base_rule_metric(buf, "filter", nft_base_rules.filter_rules_v4, nft_base_rules.filter_rules_v6);
+	dump_base_rule_metric(buf, "forward", nft_base_rules.fwd_rules_v4, nft_base_rules.fwd_rules_v6);
+	dump_base_rule_metric(buf, "output-filter", nft_base_rules.out_filter_rules_v4, nft_base_rules.out_filter_rules_v6);
+	dump_base_rule_metric(buf, "output-nat", nft_base_rules.out_nat_rules_v4, nft_base_rules.out_nat_rules_v6);
+
+	stats_metric_header(buf, "nftlb_tables", "gauge", "Tables created by family.");
+	concat_buf(buf, "nftlb_tables{family=\"ip\"} %d\n", !!(nft_base_rules.tables & NFTLB_TABLE_IP_ACTIVE));
+	concat_buf(buf, "nftlb_tables{family=\"ip6\"} %d\n", !!(nft_base_rules.tables & NFTLB_TABLE_IP6_ACTIVE));
+	concat_buf(buf, "nftlb_tables{family=\"netdev\"} %d\n", !!(nft_base_rules.tables & NFTLB_TABLE_NETDEV_ACTIVE));
+
+	stats_metric_header(buf, "nftlb_ingress_policies", "gauge", "Policies applied in the netdev ingress chains.");
+	concat_buf(buf, "nftlb_ingress_policies %u\n", nft_base_rules.ndv_ingress_policies);
+
+	stats_metric_header(buf, "nftlb_ingress_interfaces", "gauge", "Interfaces with netdev ingress base chains.");
+	concat_buf(buf, "nftlb_ingress_interfaces{chain=\"filter\"} %d\n", nft_base_rules.ndv_ingress_rules.n_interfaces);
+	concat_buf(buf, "nftlb_ingress_interfaces{chain=\"dnat\"} %d\n", nft_base_rules.ndv_ingress_dnat_rules.n_interfaces);
+
+	return 0;
+}
+
 static int reset_ndv_base(struct if_base_rule_list *ndv_if_rules)
 {
 	int i;
@@ -471,8 +614,191 @@ static int del_ndv_base(struct if_base_rule_list *ndv_if_rules, char *ifname)
 	return 0;
 }
 
+static int nft_genid_attr_cb(const struct nlattr *attr, void *data)
+{
+	uint32_t *genid = data;
+
+	if (mnl_attr_get_type(attr) != NFTA_GEN_ID)
+		return MNL_CB_OK;
+
+	if (mnl_attr_validate(attr, MNL_TYPE_U32) < 0) {
+		tools_printlog(LOG_ERR, "%s():%d: mnl_attr_validate error", __FUNCTION__, __LINE__);
+		return MNL_CB_ERROR;
+	}
+
+	*genid = ntohl(mnl_attr_get_u32(attr));
+
+	return MNL_CB_OK;
+}
+
+static int nft_genid_cb(const struct nlmsghdr *nlh, void *data)
+{
+	return mnl_attr_parse(nlh, sizeof(struct nfgenmsg), nft_genid_attr_cb, data);
+}
+
+/*
+ * The generation is requested before every commit, so the socket has a
+ * receive timeout to never block the caller on an unresponsive kernel.
+ */
+static int nft_genid_open(void)
+{
+	struct timeval tv;
+
+	tv.tv_sec = NFTLB_GENID_TIMEOUT_MS / 1000;
+	tv.tv_usec = (NFTLB_GENID_TIMEOUT_MS % 1000) * 1000;
+
+	ctx_mgr.nl = mnl_socket_open(NETLINK_NETFILTER);
+	if (!ctx_mgr.nl) {
+		tools_printlog(LOG_ERR, "%s():%d: mnl_socket_open error", __FUNCTION__, __LINE__);
+		return -1;
+	}
+
+	if (mnl_socket_bind(ctx_mgr.nl, 0, MNL_SOCKET_AUTOPID) < 0) {
+		tools_printlog(LOG_ERR, "%s():%d: mnl_socket_bind error", __FUNCTION__, __LINE__);
+		goto err;
+	}
+
+	if (setsockopt(mnl_socket_get_fd(ctx_mgr.nl), SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
+		tools_printlog(LOG_ERR, "%s():%d: unable to set the receive timeout", __FUNCTION__, __LINE__);
+		goto err;
+	}
+
+	ctx_mgr.portid = mnl_socket_get_portid(ctx_mgr.nl);
+
+	return 0;
+
+err:
+	mnl_socket_close(ctx_mgr.nl);
+	ctx_mgr.nl = NULL;
+	return -1;
+}
+
+static int nft_get_genid(uint32_t *genid)
+{
+	char buf[MNL_SOCKET_BUFFER_SIZE];
+	struct nlmsghdr *nlh;
+	struct nfgenmsg *nfg;
+	int ret;
+
+	if (!ctx_mgr.nl && nft_genid_open() != 0)
+		return -1;
+
+	nlh = mnl_nlmsg_put_header(buf);
+	nlh->nlmsg_type = (NFNL_SUBSYS_NFTABLES << 8) | NFT_MSG_GETGEN;
+	nlh->nlmsg_flags = NLM_F_REQUEST;
+	nlh->nlmsg_seq = ++ctx_mgr.seq;
+
+	nfg = mnl_nlmsg_put_extra_header(nlh, sizeof(struct nfgenmsg));
+	nfg->nfgen_family = AF_UNSPEC;
+	nfg->version = NFNETLINK_V0;
+	nfg->res_id = 0;
+
+	if (mnl_socket_sendto(ctx_mgr.nl, nlh, nlh->nlmsg_len) < 0) {
+		tools_printlog(LOG_ERR, "%s():%d: mnl_socket_sendto error", __FUNCTION__, __LINE__);
+		return -1;
+	}
+
+	/* replies to requests that timed out before are skipped */
+	do {
+		ret = mnl_socket_recvfrom(ctx_mgr.nl, buf, sizeof(buf));
+		if (ret <= 0) {
+			tools_printlog(LOG_ERR, "%s():%d: mnl_socket_recvfrom error: %s", __FUNCTION__, __LINE__, strerror(errno));
+			return -1;
+		}
+		ret = mnl_cb_run(buf, ret, ctx_mgr.seq, ctx_mgr.portid, nft_genid_cb, genid);
+	} while (ret < 0 && errno == EPROTO);
+
+	if (ret < MNL_CB_STOP)
+		return -1;
+
+	return 0;
+}
+
+static void nft_ctx_mgr_invalidate(void)
+{
+	/* the shadow ruleset is dropped as soon as the main loop notices */
+	__atomic_add_fetch(&ctx_mgr.epoch, 1, __ATOMIC_RELEASE);
+
+	if (ctx_mgr.ctx == NULL)
+		return;
+
+	tools_printlog(LOG_DEBUG, "%s():%d: dropping nft context and cache", __FUNCTION__, __LINE__);
+
+	nft_ctx_unbuffer_error(ctx_mgr.ctx);
+	nft_ctx_free(ctx_mgr.ctx);
+	ctx_mgr.ctx = NULL;
+	ctx_mgr.genid_valid = 0;
+}
+
+static unsigned int nft_ctx_mgr_epoch(void)
+{
+	return __atomic_load_n(&ctx_mgr.epoch, __ATOMIC_ACQUIRE);
+}
+
+/*
+ * Return the long lived nft context. Its cache is only valid for the
+ * ruleset generation we committed last, so if somebody else has touched
+ * the ruleset in between the context is rebuilt from scratch.
+ */
+static struct nft_ctx *nft_ctx_mgr_get(void)
+{
+	uint32_t genid = 0;
+
+	if (ctx_mgr.ctx && ctx_mgr.genid_valid) {
+		if (nft_get_genid(&genid) != 0) {
+			tools_printlog(LOG_INFO, "%s():%d: unable to get the ruleset generation, dropping the cache", __FUNCTION__, __LINE__);
+			nft_ctx_mgr_invalidate();
+		} else if (genid != ctx_mgr.genid) {
+			tools_printlog(LOG_INFO, "%s():%d: ruleset generation changed from %u to %u", __FUNCTION__, __LINE__, ctx_mgr.genid, genid);
+			nft_ctx_mgr_invalidate();
+		}
+	}
+
+	if (ctx_mgr.ctx == NULL) {
+		ctx_mgr.ctx = nft_ctx_new(NFT_CTX_DEFAULT);
+		if (ctx_mgr.ctx == NULL) {
+			tools_printlog(LOG_ERR, "%s():%d: unable to create the nft context", __FUNCTION__, __LINE__);
+			return NULL;
+		}
+		nft_ctx_buffer_error(ctx_mgr.ctx);
+	}
+
+	return ctx_mgr.ctx;
+}
+
+static void nft_ctx_mgr_commit(int error)
+{
+	if (error) {
+		nft_ctx_mgr_invalidate();
+		return;
+	}
+
+	ctx_mgr.genid_valid = (nft_get_genid(&ctx_mgr.genid) == 0);
+}
+
+/*
+ * Listings run in the main loop while the commit worker may be using the
+ * commit context, so they have a context of their own.
+ */
+static struct nft_ctx *nft_list_ctx_get(void)
+{
+	if (ctx_mgr.list_ctx)
+		return ctx_mgr.list_ctx;
+
+	ctx_mgr.list_ctx = nft_ctx_new(NFT_CTX_DEFAULT);
+	if (ctx_mgr.list_ctx == NULL) {
+		tools_printlog(LOG_ERR, "%s():%d: unable to create the nft list context", __FUNCTION__, __LINE__);
+		return NULL;
+	}
+	nft_ctx_buffer_error(ctx_mgr.list_ctx);
+
+	return ctx_mgr.list_ctx;
+}
+
 static int exec_cmd_open(char *cmd, const char **out, int error_output)
 {
+	struct nft_ctx *ctx;
+	const char *err;
 	int error;
 
 	if (strlen(cmd) == 0 || strcmp(cmd, "") == 0)
@@ -480,44 +806,197 @@ static int exec_cmd_open(char *cmd, const char **out, int error_output)
 
 	tools_printlog(LOG_NOTICE, "nft command exec : %s", cmd);
 
-	ctx = nft_ctx_new(0);
-	nft_ctx_buffer_error(ctx);
+	ctx = nft_list_ctx_get();
+	if (ctx == NULL)
+		return -1;
 
-	if (out != NULL)
-		nft_ctx_buffer_output(ctx);
+	nft_ctx_buffer_output(ctx);
 
 	error = nft_run_cmd_from_buffer(ctx, cmd);
 
-	if (error && error_output) {
-		tools_printlog(LOG_ERR, "nft command error : %s", nft_ctx_get_error_buffer(ctx));
-		obj_recovery();
-	}
+	/* reading the error buffer rewinds it for the next command */
+	err = nft_ctx_get_error_buffer(ctx);
 
-	if (out != NULL)
-		*out = nft_ctx_get_output_buffer(ctx);
+	if (error && error_output)
+		tools_printlog(LOG_ERR, "nft command error : %s", err);
+
+	*out = nft_ctx_get_output_buffer(ctx);
 
 	return error;
 }
 
 static void exec_cmd_close(const char *out)
 {
-	if (ctx == NULL)
+	if (ctx_mgr.list_ctx == NULL)
 		return;
 
 	if (out != NULL)
-		nft_ctx_unbuffer_output(ctx);
+		nft_ctx_unbuffer_output(ctx_mgr.list_ctx);
+}
+
+/*
+ * Run a script filtered by the shadow ruleset, or the unfiltered one if
+ * the shadow it was filtered with has been dropped in the meantime.
+ */
+static int exec_cmd_script(char *cmd, char *full, unsigned int epoch)
+{
+	struct nft_ctx *ctx;
+	const char *err;
+	int error;
+
+	ctx = nft_ctx_mgr_get();
+	if (ctx == NULL)
+		return -1;
+
+	if (epoch != nft_ctx_mgr_epoch())
+		cmd = full;
+
+	if (strlen(cmd) == 0)
+		return 0;
+
+	tools_printlog(LOG_NOTICE, "nft command exec : %s", cmd);
+
+	stats_count(STATS_CNT_NFT_CMDS, 1);
+	stats_count(STATS_CNT_NFT_BYTES, strlen(cmd));
+
+	error = nft_run_cmd_from_buffer(ctx, cmd);
+
+	/* reading the error buffer rewinds it for the next command */
+	err = nft_ctx_get_error_buffer(ctx);
+
+	if (error) {
+		tools_printlog(LOG_ERR, "nft command error : %s", err);
+		stats_count(STATS_CNT_NFT_ERRORS, 1);
+	}
 
-	nft_ctx_unbuffer_error(ctx);
-	nft_ctx_free(ctx);
-	ctx = NULL;
+	nft_ctx_mgr_commit(error);
+
+	return error;
+}
+
+static int nft_async(void)
+{
+	return worker_is_running() && !sync_depth;
+}
+
+/* stop the commit worker so the commands can be run from the main loop */
+static void nft_sync_begin(void)
+{
+	if (!worker_is_running())
+		return;
+
+	if (sync_depth++ == 0)
+		worker_lock();
 }
 
+static void nft_sync_end(void)
+{
+	if (!worker_is_running())
+		return;
+
+	if (--sync_depth == 0)
+		worker_unlock();
+}
+
+/*
+ * With the commit worker running, the kernel commit time is accounted by
+ * the server as the time a request waits for it.
+ */
+static int exec_cmd_run(char *cmd, char *full, unsigned int epoch)
+{
+	struct stats_timer t;
+	int error;
+
+	if (nft_async()) {
+		if (worker_submit(cmd, full, epoch))
+			return 0;
+
+		nft_sync_begin();
+		error = exec_cmd_run(cmd, full, epoch);
+		nft_sync_end();
+		return error;
+	}
+
+	stats_phase_begin(&t, STATS_PHASE_COMMIT);
+	error = exec_cmd_script(cmd, full, epoch);
+	stats_phase_end(&t);
+	if (error)
+		obj_recovery();
+
+	notify_event(NOTIFY_EVENT_COMMIT, "{s:s}", CONFIG_KEY_RESPONSE, error ? "error" : "success");
+
+	return error;
+}
+
+/* in compile mode every script is written as a line of an nft -f file */
+static int exec_cmd_compile(char *cmd)
+{
+	while (*cmd == ' ' || *cmd == ';')
+		cmd++;
+
+	if (strlen(cmd) == 0)
+		return 0;
+
+	if (fprintf(compile_out, "%s\n", cmd) < 0) {
+		tools_printlog(LOG_ERR, "%s():%d: unable to write the nft script", __FUNCTION__, __LINE__);
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Commands are filtered through the shadow ruleset so only the changes
+ * against what was committed last reach the kernel.
+ */
 static int exec_cmd(char *cmd)
 {
+	struct sbuffer diff;
+	unsigned int epoch;
+	char *text;
 	int error;
+	int ret;
+
+	if (strlen(cmd) == 0)
+		return 0;
+
+	if (compile_out)
+		return exec_cmd_compile(cmd);
+
+	/* detect changes done by others before trusting the shadow */
+	if (!nft_async())
+		nft_ctx_mgr_get();
+
+	epoch = nft_ctx_mgr_epoch();
+	if (epoch != shadow_epoch) {
+		shadow_reset();
+		shadow_epoch = epoch;
+	}
+
+	if (create_buf(&diff))
+		return -1;
+
+	ret = shadow_filter(cmd, &diff);
+	text = (ret < 0) ? cmd : get_buf_data(&diff);
+
+	if (cmd_batch && !serialize) {
+		if (isempty_buf(&cmd_batch->full))
+			cmd_batch->epoch = epoch;
+		if (strlen(text) != 0)
+			concat_buf(&cmd_batch->cmds, " ; %s", text);
+		concat_buf(&cmd_batch->full, " ; %s", cmd);
+		clean_buf(&diff);
+		return 0;
+	}
 
-	error = exec_cmd_open(cmd, NULL, 1);
-	exec_cmd_close(NULL);
+	/* the worker may still find the shadow outdated, so it gets the job anyway */
+	if (ret == 0 && !nft_async()) {
+		clean_buf(&diff);
+		return 0;
+	}
+
+	error = exec_cmd_run(text, cmd, epoch);
+	clean_buf(&diff);
 
 	return error;
 }
@@ -531,6 +1010,61 @@ static int exec_cmd_unbuffered(struct sbuffer *buf)
 	return error;
 }
 
+static int exec_nlbatch(struct nlbatch *b)
+{
+	struct stats_timer t;
+	int error;
+
+	if (nlbatch_is_empty(b) && !b->error)
+		return 0;
+
+	stats_phase_begin(&t, STATS_PHASE_COMMIT);
+
+	/* the queued scripts may create the sets to be updated */
+	nft_sync_begin();
+
+	error = nlbatch_commit(b);
+	stats_phase_end(&t);
+
+	/* neither the nft cache nor the shadow ruleset know about the batch */
+	nft_ctx_mgr_invalidate();
+
+	stats_count(STATS_CNT_NFT_CMDS, 1);
+	stats_count(STATS_CNT_NFT_BYTES, b->len);
+	if (error)
+		stats_count(STATS_CNT_NFT_ERRORS, 1);
+
+	if (error)
+		obj_recovery();
+
+	nft_sync_end();
+
+	return error;
+}
+
+/* executed by the commit worker */
+static int exec_job(struct worker_job *job)
+{
+	return exec_cmd_script(job->cmd, job->full, job->epoch);
+}
+
+static void exec_job_done(struct worker_job *job)
+{
+	/* a recovery reloads everything queued before it, don't repeat it */
+	if (job->error && job->seq > recovery_seq) {
+		nft_sync_begin();
+		obj_recovery();
+		nft_sync_end();
+		recovery_seq = worker_get_seq();
+	}
+
+	notify_event(NOTIFY_EVENT_COMMIT, "{s:I,s:s}", "seq", (json_int_t)job->seq,
+		     CONFIG_KEY_RESPONSE, job->error ? "error" : "success");
+
+	if (commit_cb)
+		commit_cb(job->seq, job->error);
+}
+
 static void concat_exec_cmd(struct sbuffer *buf, char *fmt, ...)
 {
 	int len;
@@ -909,7 +1443,10 @@ static void get_address_service(char *name, struct address *a, int type, int fam
 static int nft_table_handler(struct sbuffer *buf, char *str_family, int action)
 {
 	int old_serial = serialize;
-	serialize = 1;
+
+	/* while adopting the tables everything goes in the same transaction */
+	if (!adopting)
+		serialize = 1;
 
 	switch (action) {
 	case ACTION_RELOAD:
@@ -1329,7 +1866,7 @@ static int run_base_chain(struct sbuffer *buf, struct nftst *n, int type, int fa
 		get_nft_name_service(service, NFTLB_PROTO_IP_PORT_ACTIVE, trailing, type, family);
 		if (type & NFTLB_F_CHAIN_POS_SNAT) {
 		} else if (type & NFTLB_F_CHAIN_ING_DNAT) {
-			concat_exec_cmd(buf, " ; add map %s %s %s { type %s . %s . %s : verdict ;}", chain_family, NFTLB_TABLE_NAME, service, NFTLB_MAP_TYPE_PROTO, print_nft_family_type(family), NFTLB_MAP_TYPE_INETSRV);
+			concat_exec_cmd(buf, " ; add map %s %s %s { type %s . %s . %s : verdict ; flags interval ;}", chain_family, NFTLB_TABLE_NAME, service, NFTLB_MAP_TYPE_PROTO, print_nft_family_type(family), NFTLB_MAP_TYPE_INETSRV);
 			concat_exec_cmd(buf, " ; add rule %s %s %s %s %s . %s saddr . th sport vmap @%s", chain_family, NFTLB_TABLE_NAME, base_chain, print_nft_family(family), print_nft_family_protocol(family), print_nft_family(family), service);
 			*base_rules |= NFTLB_PROTO_IP_PORT_ACTIVE;
 		} else if (type & NFTLB_F_CHAIN_FWD_FILTER) {
@@ -1337,7 +1874,7 @@ static int run_base_chain(struct sbuffer *buf, struct nftst *n, int type, int fa
 			concat_exec_cmd(buf, " ; add rule %s %s %s ct mark vmap @%s", chain_family, NFTLB_TABLE_NAME, base_chain, service);
 			*base_rules |= NFTLB_PROTO_IP_PORT_ACTIVE;
 		} else {
-			concat_exec_cmd(buf, " ; add map %s %s %s { type %s . %s . %s : verdict ;}", chain_family, NFTLB_TABLE_NAME, service, NFTLB_MAP_TYPE_PROTO, print_nft_family_type(family), NFTLB_MAP_TYPE_INETSRV);
+			concat_exec_cmd(buf, " ; add map %s %s %s { type %s . %s . %s : verdict ; flags interval ;}", chain_family, NFTLB_TABLE_NAME, service, NFTLB_MAP_TYPE_PROTO, print_nft_family_type(family), NFTLB_MAP_TYPE_INETSRV);
 			concat_exec_cmd(buf, " ; add rule %s %s %s %s %s . %s daddr . th dport vmap @%s", chain_family, NFTLB_TABLE_NAME, base_chain, print_nft_family(family), print_nft_family_protocol(family), print_nft_family(family), service);
 			*base_rules |= NFTLB_PROTO_IP_PORT_ACTIVE;
 		}
@@ -1347,7 +1884,7 @@ static int run_base_chain(struct sbuffer *buf, struct nftst *n, int type, int fa
 		get_nft_name_service(service, NFTLB_PROTO_PORT_ACTIVE, trailing, type, family);
 		if (type & NFTLB_F_CHAIN_POS_SNAT) {
 		} else if (type & NFTLB_F_CHAIN_ING_DNAT) {
-			concat_exec_cmd(buf, " ; add map %s %s %s { type %s . %s : verdict ;}", chain_family, NFTLB_TABLE_NAME, service, NFTLB_MAP_TYPE_PROTO, NFTLB_MAP_TYPE_INETSRV);
+			concat_exec_cmd(buf, " ; add map %s %s %s { type %s . %s : verdict ; flags interval ;}", chain_family, NFTLB_TABLE_NAME, service, NFTLB_MAP_TYPE_PROTO, NFTLB_MAP_TYPE_INETSRV);
 			concat_exec_cmd(buf, " ; add rule %s %s %s %s %s . th sport vmap @%s", chain_family, NFTLB_TABLE_NAME, base_chain, print_nft_family(family), print_nft_family_protocol(family), service);
 			*base_rules |= NFTLB_PROTO_PORT_ACTIVE;
 		} else if (type & NFTLB_F_CHAIN_FWD_FILTER) {
@@ -1355,7 +1892,7 @@ static int run_base_chain(struct sbuffer *buf, struct nftst *n, int type, int fa
 			concat_exec_cmd(buf, " ; add rule %s %s %s ct mark vmap @%s", chain_family, NFTLB_TABLE_NAME, base_chain, service);
 			*base_rules |= NFTLB_PROTO_PORT_ACTIVE;
 		} else {
-			concat_exec_cmd(buf, " ; add map %s %s %s { type %s . %s : verdict ;}", chain_family, NFTLB_TABLE_NAME, service, NFTLB_MAP_TYPE_PROTO, NFTLB_MAP_TYPE_INETSRV);
+			concat_exec_cmd(buf, " ; add map %s %s %s { type %s . %s : verdict ; flags interval ;}", chain_family, NFTLB_TABLE_NAME, service, NFTLB_MAP_TYPE_PROTO, NFTLB_MAP_TYPE_INETSRV);
 			concat_exec_cmd(buf, " ; add rule %s %s %s %s %s . th dport vmap @%s", chain_family, NFTLB_TABLE_NAME, base_chain, print_nft_family(family), print_nft_family_protocol(family), service);
 			*base_rules |= NFTLB_PROTO_PORT_ACTIVE;
 		}
@@ -1408,6 +1945,46 @@ static int run_nftst_rules_gen_srv_data(char **buf, struct nftst *n, char *chain
 	return 0;
 }
 
+static void print_port_range(char *str, int first, int last)
+{
+	if (first == last)
+		snprintf(str, NFTLB_MAX_OBJ_NAME, "%d", first);
+	else
+		snprintf(str, NFTLB_MAX_OBJ_NAME, "%d-%d", first, last);
+}
+
+/* services without ports are walked once, as port 1 */
+static int get_nftst_port_range(struct nftst *n, int *index, int *first, int *last)
+{
+	if (nftst_get_proto(n) != VALUE_PROTO_ALL)
+		return address_next_port_range(nftst_get_address(n), index, first, last);
+
+	if (*index > 0)
+		return 0;
+
+	*first = *last = 1;
+	*index = 1;
+
+	return 1;
+}
+
+/* one interval element per range of virtual ports, prefixed by the key */
+static int run_nftst_rules_gen_srv_ports(struct sbuffer *buf, struct address *a, const char *key, const char *data_str)
+{
+	char ports[NFTLB_MAX_OBJ_NAME] = { 0 };
+	int index = 0;
+	int first, last;
+	int output = 0;
+
+	while (address_next_port_range(a, &index, &first, &last)) {
+		print_port_range(ports, first, last);
+		concat_buf(buf, "%s%s . %s %s", output ? ", " : "", key, ports, data_str);
+		output++;
+	}
+
+	return output;
+}
+
 static int run_nftst_rules_gen_srv_map(struct sbuffer *buf, struct nftst *n, int family, int type, int proto, int action, enum map_modes key_mode, enum map_modes data_mode)
 {
 	struct farm *f = nftst_get_farm(n);
@@ -1420,8 +1997,10 @@ static int run_nftst_rules_gen_srv_map(struct sbuffer *buf, struct nftst *n, int
 	char protocol[NFTLB_MAX_OBJ_PROTO] = { 0 };
 	char *nft_family = print_nft_table_family(family, type);
 	struct backend *b;
+	char ports[NFTLB_MAX_OBJ_NAME] = { 0 };
 	int nports = a->nports;
-	int iport = 1;
+	int index = 0;
+	int first, last;
 	int bckmark;
 	int output = 0;
 	int first_port = 1;
@@ -1469,20 +2048,7 @@ static int run_nftst_rules_gen_srv_map(struct sbuffer *buf, struct nftst *n, int
 			break;
 
 		concat_buf(buf, " ; %s element %s %s %s { ", action_str, nft_family, NFTLB_TABLE_NAME, service);
-
-		while (iport <= NFTLB_MAX_PORTS && nports > 0)
-		{
-			if (!address_search_array_port(a, iport)) { iport++; continue; }
-
-			concat_buf(buf, "%s . %d %s", a->ipaddr, iport, data_str);
-
-			if (nports != 1)
-				concat_buf(buf, ", ");
-
-			output++;
-			iport++;
-			nports--;
-		}
+		output += run_nftst_rules_gen_srv_ports(buf, a, a->ipaddr, data_str);
 		concat_exec_cmd(buf, " }");
 		break;
 	case BCK_MAP_PROTO_IPADDR_PORT:
@@ -1491,21 +2057,9 @@ static int run_nftst_rules_gen_srv_map(struct sbuffer *buf, struct nftst *n, int
 		if (nports == 0)
 			break;
 
+		snprintf(key_str, NFTLB_MAX_OBJ_NAME, "%s . %s", protocol, a->ipaddr);
 		concat_buf(buf, " ; %s element %s %s %s { ", action_str, nft_family, NFTLB_TABLE_NAME, service);
-
-		while (iport <= NFTLB_MAX_PORTS && nports > 0)
-		{
-			if (!address_search_array_port(a, iport)) { iport++; continue; }
-
-			concat_buf(buf, "%s . %s . %d %s", protocol, a->ipaddr, iport, data_str);
-
-			if (nports != 1)
-				concat_buf(buf, ", ");
-
-			output++;
-			iport++;
-			nports--;
-		}
+		output += run_nftst_rules_gen_srv_ports(buf, a, key_str, data_str);
 		concat_exec_cmd(buf, " }");
 		break;
 	case BCK_MAP_PROTO_PORT:
@@ -1515,30 +2069,12 @@ static int run_nftst_rules_gen_srv_map(struct sbuffer *buf, struct nftst *n, int
 			break;
 
 		concat_buf(buf, " ; %s element %s %s %s { ", action_str, nft_family, NFTLB_TABLE_NAME, service);
-
-		while (iport <= NFTLB_MAX_PORTS && nports > 0)
-		{
-			if (!address_search_array_port(a, iport)) { iport++; continue; }
-
-			if (nports != 1)
-				concat_buf(buf, ", ");
-
-			concat_buf(buf, "%s . %d %s", protocol, iport, data_str);
-			output++;
-			iport++;
-			nports--;
-		}
+		output += run_nftst_rules_gen_srv_ports(buf, a, protocol, data_str);
 		concat_exec_cmd(buf, " }");
 		break;
 	default:
-		nports = (nftst_get_proto(n) == VALUE_PROTO_ALL) ? 1 : a->nports;
-
-		if (nports == 0)
-			break;
-
-		while (iport <= NFTLB_MAX_PORTS && nports > 0)
-		{
-			if (!address_search_array_port(a, iport) && nftst_get_proto(n) != VALUE_PROTO_ALL) { iport++; continue; }
+		while (get_nftst_port_range(n, &index, &first, &last)) {
+			print_port_range(ports, first, last);
 
 			list_for_each_entry(b, &f->backends, list) {
 				if (!backend_validate(b))
@@ -1556,13 +2092,13 @@ static int run_nftst_rules_gen_srv_map(struct sbuffer *buf, struct nftst *n, int
 					snprintf(key_str, NFTLB_MAX_OBJ_NAME, "0x%x", bckmark);
 					structure = NFTLB_MARK_ACTIVE;
 				} else if ((key_mode == BCK_MAP_BCK_ID || key_mode == BCK_MAP_BCK_PROTO_IPADDR_F_PORT) && backend_no_port(b)) {
-					snprintf(key_str, NFTLB_MAX_OBJ_NAME, "%s . %s . %d", protocol, b->ipaddr, iport);
+					snprintf(key_str, NFTLB_MAX_OBJ_NAME, "%s . %s . %s", protocol, b->ipaddr, ports);
 					structure = NFTLB_PROTO_IP_PORT_ACTIVE;
 				} else if ((key_mode == BCK_MAP_BCK_ID || key_mode == BCK_MAP_BCK_PROTO_IPADDR_F_PORT) && !backend_no_port(b)) {
 					snprintf(key_str, NFTLB_MAX_OBJ_NAME, "%s . %s . %s", protocol, b->ipaddr, b->port);
 					structure = NFTLB_PROTO_IP_PORT_ACTIVE;
 				} else if ((key_mode == BCK_MAP_BCK_ID || key_mode == BCK_MAP_BCK_IPADDR_F_PORT) && backend_no_port(b)) {
-					snprintf(key_str, NFTLB_MAX_OBJ_NAME, "%s . %d", b->ipaddr, iport);
+					snprintf(key_str, NFTLB_MAX_OBJ_NAME, "%s . %s", b->ipaddr, ports);
 					structure = NFTLB_PROTO_PORT_ACTIVE;
 				} else if (key_mode == BCK_MAP_BCK_ID && !backend_no_port(b)) {
 					if (!first_port) { continue; }
@@ -1596,11 +2132,7 @@ static int run_nftst_rules_gen_srv_map(struct sbuffer *buf, struct nftst *n, int
 				output++;
 			}
 			nftst_set_backend(n, NULL);
-
-			iport++;
 			first_port = 0;
-			nports--;
-			continue;
 		}
 		break;
 	}
@@ -1705,25 +2237,61 @@ static int run_farm_snat(struct sbuffer *buf, struct nftst *n, int family, int a
 	return 0;
 }
 
+/*
+ * The scheduler modulus is the weight of all the farm backends, so it
+ * doesn't change when a backend goes up or down. The slots of the
+ * unavailable backends are spread among the available ones through the
+ * weight map.
+ */
+static int get_farm_bck_slots(struct farm *f)
+{
+	struct backend *b;
+	int slots = 0;
+
+	list_for_each_entry(b, &f->backends, list)
+		slots += b->weight;
+
+	return slots;
+}
+
+static int get_farm_bck_shape(struct farm *f)
+{
+	int shape = 0;
+
+	if (f->bcks_available)
+		shape |= (1 << 0);
+	if (f->bcks_usable)
+		shape |= (1 << 1);
+	if (f->bcks_have_port)
+		shape |= (1 << 2);
+	if (f->bcks_have_if)
+		shape |= (1 << 3);
+	if (f->scheduler == VALUE_SCHED_SYMHASH && f->bcks_available == 1)
+		shape |= (1 << 4);
+
+	return shape;
+}
+
 static int run_farm_rules_gen_sched(struct sbuffer *buf, struct nftst *n, int family)
 {
 	struct farm *f = nftst_get_farm(n);
 	struct address *a = nftst_get_address(n);
+	int slots = get_farm_bck_slots(f);
 
 	switch (f->scheduler) {
 	case VALUE_SCHED_RR:
-		concat_buf(buf, " numgen inc mod %d", f->total_weight);
+		concat_buf(buf, " numgen inc mod %d", slots);
 		break;
 	case VALUE_SCHED_WEIGHT:
-		concat_buf(buf, " numgen random mod %d", f->total_weight);
+		concat_buf(buf, " numgen random mod %d", slots);
 		break;
 	case VALUE_SCHED_HASH:
 		concat_buf(buf, " jhash");
 		run_farm_rules_gen_meta_param(buf, a->protocol, family, f->schedparam, NFTLB_MAP_KEY_RULE);
-		concat_buf(buf, " mod %d", f->total_weight);
+		concat_buf(buf, " mod %d", slots);
 		break;
 	case VALUE_SCHED_SYMHASH:
-		concat_buf(buf, " symhash mod %d", f->total_weight);
+		concat_buf(buf, " symhash mod %d", slots);
 		break;
 	default:
 		return -1;
@@ -1735,42 +2303,147 @@ static int run_farm_rules_gen_sched(struct sbuffer *buf, struct nftst *n, int fa
 static int get_nftst_first_port(struct nftst *n)
 {
 	struct address *a = nftst_get_address(n);
-	int iport = 0;
 
-	if (nftst_get_proto(n) == VALUE_PROTO_ALL || a->nports == 0)
+	if (nftst_get_proto(n) == VALUE_PROTO_ALL)
 		return 0;
 
-	while (iport <= NFTLB_MAX_PORTS && a->nports > 0) {
-		if (a->port_list[iport])
-			return ++iport;
-		iport++;
+	return address_get_first_port(a);
+}
+
+static int get_bck_map_index(enum map_modes key_mode, enum map_modes data_mode)
+{
+	int i;
+
+	for (i = 0; i < NFTLB_BCK_MAPS_NUM; i++)
+		if (bck_maps[i].key_mode == key_mode && bck_maps[i].data_mode == data_mode)
+			return i;
+
+	return -1;
+}
+
+static char *print_bck_map_mode(enum map_modes mode)
+{
+	switch (mode) {
+	case BCK_MAP_MARK:
+		return "mark";
+	case BCK_MAP_IPADDR:
+		return "ip";
+	case BCK_MAP_WEIGHT:
+		return "weight";
+	case BCK_MAP_ETHADDR:
+		return "ether";
+	case BCK_MAP_IPADDR_PORT:
+		return "ipport";
+	case BCK_MAP_PORT:
+		return "port";
+	case BCK_MAP_OFACE:
+		return "oface";
+	default:
+		return "";
+	}
+}
+
+static void get_bck_map_name(char *name, struct farm *f, const struct bck_map *m)
+{
+	snprintf(name, NFTLB_MAX_OBJ_NAME, "bck-%s-%s-%s", print_bck_map_mode(m->key_mode), print_bck_map_mode(m->data_mode), f->name);
+}
+
+static void get_bck_map_type(char *type, enum map_modes mode, int family)
+{
+	switch (mode) {
+	case BCK_MAP_MARK:
+		snprintf(type, NFTLB_MAX_OBJ_NAME, "%s", NFTLB_MAP_TYPE_MARK);
+		break;
+	case BCK_MAP_IPADDR:
+		snprintf(type, NFTLB_MAX_OBJ_NAME, "%s", print_nft_family_type(family));
+		break;
+	case BCK_MAP_ETHADDR:
+		snprintf(type, NFTLB_MAX_OBJ_NAME, "%s", NFTLB_MAP_TYPE_MAC);
+		break;
+	case BCK_MAP_IPADDR_PORT:
+		snprintf(type, NFTLB_MAX_OBJ_NAME, "%s . %s", print_nft_family_type(family), NFTLB_MAP_TYPE_INETSRV);
+		break;
+	case BCK_MAP_PORT:
+		snprintf(type, NFTLB_MAX_OBJ_NAME, "%s", NFTLB_MAP_TYPE_INETSRV);
+		break;
+	case BCK_MAP_OFACE:
+		snprintf(type, NFTLB_MAX_OBJ_NAME, "%s", NFTLB_MAP_TYPE_IFACE);
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * The scheduler expressions are plain integers, so the weight maps are
+ * declared with the expressions they're looked up and set with instead of
+ * a mark key.
+ */
+static int run_farm_bck_map_typeof(struct sbuffer *buf, struct nftst *n, int family, const struct bck_map *m)
+{
+	concat_buf(buf, " typeof");
+	if (run_farm_rules_gen_sched(buf, n, family))
+		return -1;
+
+	switch (m->data_mode) {
+	case BCK_MAP_MARK:
+		concat_buf(buf, " : ct mark");
+		break;
+	case BCK_MAP_ETHADDR:
+		concat_buf(buf, " : ether daddr");
+		break;
+	case BCK_MAP_IPADDR:
+		concat_buf(buf, " : %s daddr", print_nft_family(family));
+		break;
+	default:
+		return -1;
 	}
+
 	return 0;
 }
 
-static int run_farm_rules_gen_bck_map(struct sbuffer *buf, struct nftst *n, enum map_modes key_mode, enum map_modes data_mode, int usable)
+static int bck_map_has_backend(struct backend *b, const struct bck_map *m)
+{
+	if (m->usable == NFTLB_CHECK_USABLE && !backend_is_usable(b))
+		return 0;
+	if (m->usable == NFTLB_CHECK_AVAIL && !backend_is_available(b))
+		return 0;
+	if (m->data_mode == BCK_MAP_PORT && backend_no_port(b))
+		return 0;
+
+	return 1;
+}
+
+static int get_bck_map_elements(struct farm *f, const struct bck_map *m)
+{
+	struct backend *b;
+	int elements = 0;
+
+	list_for_each_entry(b, &f->backends, list)
+		elements += bck_map_has_backend(b, m);
+
+	return elements;
+}
+
+static int run_farm_bck_map_elements(struct sbuffer *buf, struct nftst *n, const struct bck_map *m)
 {
 	struct farm *f = nftst_get_farm(n);
 	struct backend *b;
+	int slots = get_farm_bck_slots(f);
+	long long acc = 0;
 	int i = 0;
 	int last = 0;
 	int new;
 	int port;
 
-	concat_buf(buf, " map {");
-
 	list_for_each_entry(b, &f->backends, list) {
-		if (usable == NFTLB_CHECK_USABLE && !backend_is_usable(b))
-			continue;
-		if (usable == NFTLB_CHECK_AVAIL && !backend_is_available(b))
-			continue;
-		if (data_mode == BCK_MAP_PORT && backend_no_port(b))
+		if (!bck_map_has_backend(b, m))
 			continue;
 
 		if (i != 0)
 			concat_buf(buf, ",");
 
-		switch (key_mode) {
+		switch (m->key_mode) {
 		case BCK_MAP_MARK:
 			concat_buf(buf, " 0x%x", backend_get_mark(b));
 			break;
@@ -1778,7 +2451,8 @@ static int run_farm_rules_gen_bck_map(struct sbuffer *buf, struct nftst *n, enum
 			concat_buf(buf, " %s", b->ipaddr);
 			break;
 		case BCK_MAP_WEIGHT:
-			new = last + b->weight - 1;
+			acc += b->weight;
+			new = (int)((acc * slots) / (f->total_weight ? f->total_weight : 1)) - 1;
 			concat_buf(buf, " %d", last);
 			if (new != last)
 				concat_buf(buf, "-%d", new);
@@ -1791,9 +2465,9 @@ static int run_farm_rules_gen_bck_map(struct sbuffer *buf, struct nftst *n, enum
 			break;
 		}
 
-		concat_buf(buf, ":");
+		concat_buf(buf, " :");
 
-		switch (data_mode) {
+		switch (m->data_mode) {
 		case BCK_MAP_MARK:
 			concat_buf(buf, " 0x%x", backend_get_mark(b));
 			break;
@@ -1823,14 +2497,262 @@ static int run_farm_rules_gen_bck_map(struct sbuffer *buf, struct nftst *n, enum
 			break;
 		}
 
-		i++;
+		i++;
+	}
+
+	return i;
+}
+
+static int run_farm_bck_map(struct sbuffer *buf, struct nftst *n, int family, enum map_modes key_mode, enum map_modes data_mode, int action)
+{
+	struct farm *f = nftst_get_farm(n);
+	char *nft_family = print_nft_table_family(family, get_stage_by_farm_mode(f));
+	char name[NFTLB_MAX_OBJ_NAME] = { 0 };
+	char key_type[NFTLB_MAX_OBJ_NAME] = { 0 };
+	char data_type[NFTLB_MAX_OBJ_NAME] = { 0 };
+	const struct bck_map *m;
+	int idx = get_bck_map_index(key_mode, data_mode);
+
+	if (idx < 0)
+		return -1;
+
+	m = &bck_maps[idx];
+	get_bck_map_name(name, f, m);
+
+	switch (action) {
+	case ACTION_START:
+	case ACTION_RELOAD:
+		if (nftst_get_bck_maps(n) & (1 << idx))
+			return 0;
+
+		if (m->key_mode == BCK_MAP_WEIGHT) {
+			concat_buf(buf, " ; add map %s %s %s {", nft_family, NFTLB_TABLE_NAME, name);
+			if (run_farm_bck_map_typeof(buf, n, family, m))
+				return -1;
+			concat_exec_cmd(buf, " ; flags interval ;}");
+		} else {
+			get_bck_map_type(key_type, m->key_mode, family);
+			get_bck_map_type(data_type, m->data_mode, family);
+			concat_exec_cmd(buf, " ; add map %s %s %s { type %s : %s ;}", nft_family, NFTLB_TABLE_NAME, name, key_type, data_type);
+		}
+		concat_exec_cmd(buf, " ; flush map %s %s %s", nft_family, NFTLB_TABLE_NAME, name);
+
+		if (get_bck_map_elements(f, m)) {
+			concat_buf(buf, " ; add element %s %s %s {", nft_family, NFTLB_TABLE_NAME, name);
+			run_farm_bck_map_elements(buf, n, m);
+			concat_exec_cmd(buf, " }");
+		}
+
+		nftst_set_bck_maps(n, nftst_get_bck_maps(n) | (1 << idx));
+		f->nft_bck_maps |= (1 << idx);
+		break;
+	case ACTION_STOP:
+	case ACTION_DELETE:
+		if (!(f->nft_bck_maps & (1 << idx)))
+			return 0;
+		concat_exec_cmd(buf, " ; delete map %s %s %s", nft_family, NFTLB_TABLE_NAME, name);
+		break;
+	default:
+		break;
+	}
+
+	return 0;
+}
+
+static int get_nfproto(int family, unsigned int type)
+{
+	if (family == VALUE_FAMILY_NETDEV || type & NFTLB_F_CHAIN_ING_FILTER || type & NFTLB_F_CHAIN_ING_DNAT)
+		return NFPROTO_NETDEV;
+	else if (family == VALUE_FAMILY_IPV6)
+		return NFPROTO_IPV6;
+	else
+		return NFPROTO_IPV4;
+}
+
+static int get_nl_ether(unsigned char *value, const char *str)
+{
+	if (!str || sscanf(str, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", &value[0], &value[1], &value[2],
+			   &value[3], &value[4], &value[5]) != 6)
+		return -1;
+
+	return NFTLB_NL_ETHER_LEN;
+}
+
+static int get_nl_ipaddr(unsigned char *value, const char *str, int family)
+{
+	int af = (family == VALUE_FAMILY_IPV6) ? AF_INET6 : AF_INET;
+
+	if (!str || inet_pton(af, str, value) != 1)
+		return -1;
+
+	return (family == VALUE_FAMILY_IPV6) ? 16 : 4;
+}
+
+/*
+ * Binary value of a backend as key or data of a backend map. Marks and
+ * interface indexes are in host byte order, addresses and ports in
+ * network byte order, and the fields of a concatenation take 4 bytes at
+ * least. It returns the length or -1 on error.
+ */
+static int get_nl_bck_map_value(unsigned char *value, struct nftst *n, struct backend *b, enum map_modes mode, int family)
+{
+	struct farm *f = nftst_get_farm(n);
+	uint32_t u32;
+	uint16_t port;
+	int len;
+
+	memset(value, 0, NFTLB_NL_VALUE_LEN);
+
+	switch (mode) {
+	case BCK_MAP_MARK:
+		u32 = backend_get_mark(b);
+		memcpy(value, &u32, sizeof(u32));
+		return sizeof(u32);
+	case BCK_MAP_IPADDR:
+		return get_nl_ipaddr(value, b->ipaddr, family);
+	case BCK_MAP_IPADDR_PORT:
+		len = get_nl_ipaddr(value, b->ipaddr, family);
+		if (len < 0)
+			return -1;
+		port = htons(backend_no_port(b) ? get_nftst_first_port(n) : atoi(b->port));
+		memcpy(value + len, &port, sizeof(port));
+		return len + sizeof(uint32_t);
+	case BCK_MAP_ETHADDR:
+		return get_nl_ether(value, b->ethaddr);
+	case BCK_MAP_PORT:
+		port = htons(atoi(b->port));
+		memcpy(value, &port, sizeof(port));
+		return sizeof(port);
+	case BCK_MAP_OFACE:
+		u32 = b->oface ? b->ofidx : f->ofidx;
+		if (!u32)
+			return -1;
+		memcpy(value, &u32, sizeof(u32));
+		return sizeof(u32);
+	default:
+		return -1;
+	}
+}
+
+static int check_nl_bck_map(struct nftst *n, int family, const struct bck_map *m)
+{
+	struct farm *f = nftst_get_farm(n);
+	unsigned char value[NFTLB_NL_VALUE_LEN];
+	struct backend *b;
+
+	list_for_each_entry(b, &f->backends, list) {
+		if (!bck_map_has_backend(b, m))
+			continue;
+		if ((m->key_mode != BCK_MAP_WEIGHT && get_nl_bck_map_value(value, n, b, m->key_mode, family) < 0) ||
+		    get_nl_bck_map_value(value, n, b, m->data_mode, family) < 0) {
+			tools_printlog(LOG_INFO, "%s():%d: backend %s of farm %s can't be sent through netlink", __FUNCTION__, __LINE__, b->name, f->name);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Same elements as run_farm_bck_map_elements(), sent through the netlink
+ * batch. The weight maps are interval maps, whose integer keys are stored
+ * in big endian as nft does, and every range is sent as a start element
+ * with the data and an end element with the first key out of it, the
+ * kernel reports two starts in a row as an overlap. It returns 1 if the
+ * map has to be filled by nft instead, a failure to build the batch makes
+ * it fail on commit.
+ */
+static int run_farm_bck_map_netlink(struct nftst *n, int family, const struct bck_map *m)
+{
+	struct farm *f = nftst_get_farm(n);
+	unsigned char key[NFTLB_NL_VALUE_LEN];
+	unsigned char data[NFTLB_NL_VALUE_LEN];
+	char name[NFTLB_MAX_OBJ_NAME] = { 0 };
+	int nfproto = get_nfproto(family, get_stage_by_farm_mode(f));
+	int idx = get_bck_map_index(m->key_mode, m->data_mode);
+	int slots = get_farm_bck_slots(f);
+	struct backend *b;
+	long long acc = 0;
+	uint32_t last = 0;
+	uint32_t be;
+	int keylen, datalen;
+	int new;
+
+	if (nftst_get_bck_maps(n) & (1 << idx))
+		return 0;
+
+	if (check_nl_bck_map(n, family, m))
+		return 1;
+
+	get_bck_map_name(name, f, m);
+
+	if (nlbatch_set_flush(nl_maps, nfproto, name))
+		return -1;
+
+	list_for_each_entry(b, &f->backends, list) {
+		if (!bck_map_has_backend(b, m))
+			continue;
+
+		if (m->key_mode == BCK_MAP_WEIGHT) {
+			acc += b->weight;
+			new = (int)((acc * slots) / (f->total_weight ? f->total_weight : 1)) - 1;
+			if (new < (int)last)
+				continue;
+			be = htonl(last);
+			memcpy(key, &be, sizeof(be));
+			keylen = sizeof(be);
+			last = new + 1;
+		} else
+			keylen = get_nl_bck_map_value(key, n, b, m->key_mode, family);
+
+		datalen = get_nl_bck_map_value(data, n, b, m->data_mode, family);
+		if (nlbatch_map_elem(nl_maps, nfproto, name, key, keylen, data, datalen, 0))
+			return -1;
+
+		if (m->key_mode != BCK_MAP_WEIGHT)
+			continue;
+
+		be = htonl(last);
+		if (nlbatch_map_elem(nl_maps, nfproto, name, &be, sizeof(be), NULL, 0, NFT_SET_ELEM_INTERVAL_END))
+			return -1;
 	}
 
-	concat_buf(buf, " }");
+	nftst_set_bck_maps(n, nftst_get_bck_maps(n) | (1 << idx));
+
+	return 0;
+}
+
+static int run_farm_bck_maps_delete(struct sbuffer *buf, struct nftst *n, int family, int chains)
+{
+	struct farm *f = nftst_get_farm(n);
+	int i;
+
+	// the maps are still referenced while any of the farm chains remains
+	if (nftst_get_chains(n) & chains)
+		return 0;
+
+	for (i = 0; i < NFTLB_BCK_MAPS_NUM; i++)
+		run_farm_bck_map(buf, n, family, bck_maps[i].key_mode, bck_maps[i].data_mode, ACTION_DELETE);
 
-	if (i == 0)
+	f->nft_bck_maps = 0;
+	f->nft_bck_slots = 0;
+	f->nft_bck_shape = 0;
+
+	return 0;
+}
+
+static int run_farm_rules_gen_bck_map(struct sbuffer *buf, struct nftst *n, enum map_modes key_mode, enum map_modes data_mode)
+{
+	struct farm *f = nftst_get_farm(n);
+	char name[NFTLB_MAX_OBJ_NAME] = { 0 };
+	int idx = get_bck_map_index(key_mode, data_mode);
+
+	if (idx < 0)
 		return -1;
 
+	get_bck_map_name(name, f, &bck_maps[idx]);
+	concat_buf(buf, " map @%s", name);
+
 	return 0;
 }
 
@@ -2071,6 +2993,8 @@ static int run_farm_rules_check_sessions(struct sbuffer *buf, struct nftst *n, i
 	switch (f->mode) {
 	case VALUE_MODE_DSR:
 		get_chain_name(chain, f->name, NFTLB_F_CHAIN_ING_FILTER);
+		if (f->bcks_have_if)
+			run_farm_bck_map(buf, n, family, BCK_MAP_ETHADDR, BCK_MAP_OFACE, action);
 		concat_buf(buf, " ; add rule %s %s %s ether daddr set", print_nft_table_family(family, NFTLB_F_CHAIN_ING_FILTER), NFTLB_TABLE_NAME, chain);
 		run_farm_rules_gen_meta_param(buf, a->protocol, family, f->persistence, NFTLB_MAP_KEY_RULE);
 		concat_exec_cmd(buf, " map @%s ether saddr set %s", map_str, a->iethaddr);
@@ -2081,7 +3005,7 @@ static int run_farm_rules_check_sessions(struct sbuffer *buf, struct nftst *n, i
 		concat_buf(buf, " fwd to");
 		if (f->bcks_have_if) {
 			concat_buf(buf, " ether daddr");
-			run_farm_rules_gen_bck_map(buf, n, BCK_MAP_ETHADDR, BCK_MAP_OFACE, NFTLB_CHECK_AVAIL);
+			run_farm_rules_gen_bck_map(buf, n, BCK_MAP_ETHADDR, BCK_MAP_OFACE);
 		} else
 			concat_buf(buf, " %s", f->oface);
 		concat_exec_cmd(buf, "");
@@ -2089,14 +3013,19 @@ static int run_farm_rules_check_sessions(struct sbuffer *buf, struct nftst *n, i
 
 	case VALUE_MODE_STLSDNAT:
 		get_chain_name(chain, f->name, NFTLB_F_CHAIN_ING_FILTER);
+		run_farm_bck_map(buf, n, family, BCK_MAP_IPADDR, BCK_MAP_ETHADDR, action);
+		if (f->bcks_have_port)
+			run_farm_bck_map(buf, n, family, BCK_MAP_ETHADDR, BCK_MAP_PORT, action);
+		if (f->bcks_have_if)
+			run_farm_bck_map(buf, n, family, BCK_MAP_ETHADDR, BCK_MAP_OFACE, action);
 		concat_buf(buf, " ; add rule %s %s %s %s daddr set", print_nft_table_family(family, NFTLB_F_CHAIN_ING_FILTER), NFTLB_TABLE_NAME, chain, print_nft_family(family));
 		run_farm_rules_gen_meta_param(buf, a->protocol, family, f->persistence, NFTLB_MAP_KEY_RULE);
 		concat_exec_cmd(buf, " map @%s ether daddr set %s daddr", map_str, print_nft_family(family));
-		run_farm_rules_gen_bck_map(buf, n, BCK_MAP_IPADDR, BCK_MAP_ETHADDR, NFTLB_CHECK_AVAIL);
+		run_farm_rules_gen_bck_map(buf, n, BCK_MAP_IPADDR, BCK_MAP_ETHADDR);
 
 		if (f->bcks_have_port) {
 			concat_buf(buf, " th dport set ether daddr");
-			run_farm_rules_gen_bck_map(buf, n, BCK_MAP_ETHADDR, BCK_MAP_PORT, NFTLB_CHECK_AVAIL);
+			run_farm_rules_gen_bck_map(buf, n, BCK_MAP_ETHADDR, BCK_MAP_PORT);
 		}
 
 		concat_buf(buf, " ether saddr set %s", f->oethaddr);
@@ -2107,7 +3036,7 @@ static int run_farm_rules_check_sessions(struct sbuffer *buf, struct nftst *n, i
 		concat_buf(buf, " fwd to");
 		if (f->bcks_have_if) {
 			concat_buf(buf, " ether daddr");
-			run_farm_rules_gen_bck_map(buf, n, BCK_MAP_ETHADDR, BCK_MAP_OFACE, NFTLB_CHECK_AVAIL);
+			run_farm_rules_gen_bck_map(buf, n, BCK_MAP_ETHADDR, BCK_MAP_OFACE);
 		} else
 			concat_buf(buf, " %s", f->oface);
 		concat_exec_cmd(buf, "");
@@ -2289,6 +3218,8 @@ static int run_farm_rules_filter_marks(struct sbuffer *buf, struct nftst *n, int
 
 	if (action == ACTION_START || action == ACTION_RELOAD) {
 		if (f->bcks_available) {
+			if (!(f->scheduler == VALUE_SCHED_SYMHASH && f->bcks_available == 1))
+				run_farm_bck_map(buf, n, family, BCK_MAP_WEIGHT, BCK_MAP_MARK, action);
 			concat_buf(buf, " ; add rule %s %s %s ct state new ct mark 0x0 ct mark set", print_nft_table_family(family, NFTLB_F_CHAIN_PRE_FILTER), NFTLB_TABLE_NAME, chain);
 			if (f->scheduler == VALUE_SCHED_SYMHASH && f->bcks_available == 1) { // FIXME: Control bug in nftables
 				list_for_each_entry(b, &f->backends, list) {
@@ -2299,7 +3230,7 @@ static int run_farm_rules_filter_marks(struct sbuffer *buf, struct nftst *n, int
 			} else {
 				if (run_farm_rules_gen_sched(buf, n, family) == -1)
 					return -1;
-				run_farm_rules_gen_bck_map(buf, n, BCK_MAP_WEIGHT, BCK_MAP_MARK, NFTLB_CHECK_AVAIL);
+				run_farm_rules_gen_bck_map(buf, n, BCK_MAP_WEIGHT, BCK_MAP_MARK);
 			}
 			run_farm_rules_gen_limits_per_bck(buf, f, family, chain, action);
 		} else if (mark != DEFAULT_MARK) {
@@ -2602,18 +3533,21 @@ static int run_farm_rules_gen_nat(struct sbuffer *buf, struct nftst *n, int fami
 		run_farm_rules_check_sessions(buf, n, SESSION_TYPE_TIMED, family, NFTLB_F_CHAIN_ING_FILTER, action);
 
 		if (f->bcks_available) {
+			run_farm_bck_map(buf, n, family, BCK_MAP_WEIGHT, BCK_MAP_ETHADDR, action);
+			if (f->bcks_have_if)
+				run_farm_bck_map(buf, n, family, BCK_MAP_ETHADDR, BCK_MAP_OFACE, action);
 			concat_buf(buf, " ; add rule %s %s %s", print_nft_table_family(family, NFTLB_F_CHAIN_ING_FILTER), NFTLB_TABLE_NAME, chain);
 			run_farm_log_prefix(buf, f, VALUE_LOG_INPUT, NFTLB_F_CHAIN_ING_FILTER, ACTION_START);
 			// TODO: support of different output interfaces per backend during saddr
 			concat_buf(buf, " ether saddr set %s ether daddr set", f->oethaddr);
 			run_farm_rules_gen_sched(buf, n, family);
-			run_farm_rules_gen_bck_map(buf, n, BCK_MAP_WEIGHT, BCK_MAP_ETHADDR, NFTLB_CHECK_AVAIL);
+			run_farm_rules_gen_bck_map(buf, n, BCK_MAP_WEIGHT, BCK_MAP_ETHADDR);
 			run_farm_rules_update_sessions(buf, n, family, chain, action);
 			run_farm_log_prefix(buf, f, VALUE_LOG_OUTPUT, NFTLB_F_CHAIN_ING_DNAT, ACTION_START);
 			concat_buf(buf, " fwd to");
 			if (f->bcks_have_if) {
 				concat_buf(buf, " ether daddr");
-				run_farm_rules_gen_bck_map(buf, n, BCK_MAP_ETHADDR, BCK_MAP_OFACE, NFTLB_CHECK_AVAIL);
+				run_farm_rules_gen_bck_map(buf, n, BCK_MAP_ETHADDR, BCK_MAP_OFACE);
 			} else
 				concat_buf(buf, " %s", f->oface);
 		}
@@ -2627,17 +3561,23 @@ static int run_farm_rules_gen_nat(struct sbuffer *buf, struct nftst *n, int fami
 		run_farm_rules_check_sessions(buf, n, SESSION_TYPE_TIMED, family, NFTLB_F_CHAIN_ING_FILTER, action);
 
 		if (f->bcks_available) {
+			run_farm_bck_map(buf, n, family, BCK_MAP_WEIGHT, BCK_MAP_IPADDR, action);
+			run_farm_bck_map(buf, n, family, BCK_MAP_IPADDR, BCK_MAP_ETHADDR, action);
+			if (f->bcks_have_port)
+				run_farm_bck_map(buf, n, family, BCK_MAP_ETHADDR, BCK_MAP_PORT, action);
+			if (f->bcks_have_if)
+				run_farm_bck_map(buf, n, family, BCK_MAP_ETHADDR, BCK_MAP_OFACE, action);
 			concat_buf(buf, " ; add rule %s %s %s", print_nft_table_family(family, NFTLB_F_CHAIN_ING_FILTER), NFTLB_TABLE_NAME, chain);
 			run_farm_log_prefix(buf, f, VALUE_LOG_INPUT, NFTLB_F_CHAIN_ING_FILTER, ACTION_START);
 			concat_buf(buf, " %s daddr set", print_nft_family(family));
 			run_farm_rules_gen_sched(buf, n, family);
-			run_farm_rules_gen_bck_map(buf, n, BCK_MAP_WEIGHT, BCK_MAP_IPADDR, NFTLB_CHECK_AVAIL);
+			run_farm_rules_gen_bck_map(buf, n, BCK_MAP_WEIGHT, BCK_MAP_IPADDR);
 			concat_buf(buf, " ether daddr set %s daddr", print_nft_family(family));
-			run_farm_rules_gen_bck_map(buf, n, BCK_MAP_IPADDR, BCK_MAP_ETHADDR, NFTLB_CHECK_AVAIL);
+			run_farm_rules_gen_bck_map(buf, n, BCK_MAP_IPADDR, BCK_MAP_ETHADDR);
 
 			if (f->bcks_have_port) {
 				concat_buf(buf, " th dport set ether daddr");
-				run_farm_rules_gen_bck_map(buf, n, BCK_MAP_ETHADDR, BCK_MAP_PORT, NFTLB_CHECK_AVAIL);
+				run_farm_rules_gen_bck_map(buf, n, BCK_MAP_ETHADDR, BCK_MAP_PORT);
 			}
 
 			// TODO: support of different output interfaces per backend during saddr
@@ -2649,7 +3589,7 @@ static int run_farm_rules_gen_nat(struct sbuffer *buf, struct nftst *n, int fami
 			concat_buf(buf, " fwd to");
 			if (f->bcks_have_if) {
 				concat_buf(buf, " ether daddr");
-				run_farm_rules_gen_bck_map(buf, n, BCK_MAP_ETHADDR, BCK_MAP_OFACE, NFTLB_CHECK_AVAIL);
+				run_farm_rules_gen_bck_map(buf, n, BCK_MAP_ETHADDR, BCK_MAP_OFACE);
 			} else {
 				concat_buf(buf, " %s", f->oface);
 			}
@@ -2659,6 +3599,11 @@ static int run_farm_rules_gen_nat(struct sbuffer *buf, struct nftst *n, int fami
 	default:
 		run_farm_gen_log_rules(buf, f, family, chain, VALUE_LOG_INPUT, NFTLB_F_CHAIN_PRE_DNAT, ACTION_START);
 
+		if (f->bcks_have_port && nftst_get_proto(n) != VALUE_PROTO_ALL)
+			bck_map_data = BCK_MAP_IPADDR_PORT;
+
+		run_farm_bck_map(buf, n, family, BCK_MAP_MARK, bck_map_data, action);
+
 		concat_buf(buf, " ; add rule %s %s %s", print_nft_table_family(family, NFTLB_F_CHAIN_PRE_DNAT), NFTLB_TABLE_NAME, chain);
 
 		if (nftst_get_proto(n) != VALUE_PROTO_ALL)
@@ -2666,12 +3611,9 @@ static int run_farm_rules_gen_nat(struct sbuffer *buf, struct nftst *n, int fami
 
 		concat_buf(buf, " dnat");
 
-		if (f->bcks_have_port && nftst_get_proto(n) != VALUE_PROTO_ALL)
-			bck_map_data = BCK_MAP_IPADDR_PORT;
-
 		get_farm_rules_nat_params(buf, family, bck_map_data);
 		concat_buf(buf, " to ct mark");
-		run_farm_rules_gen_bck_map(buf, n, BCK_MAP_MARK, bck_map_data, NFTLB_CHECK_USABLE);
+		run_farm_rules_gen_bck_map(buf, n, BCK_MAP_MARK, bck_map_data);
 
 		concat_exec_cmd(buf, "");
 
@@ -2766,6 +3708,7 @@ static int run_farm_dsr(struct sbuffer *buf, struct nftst *n, int family, int ac
 		run_farm_sessions_map(buf, n, SESSION_TYPE_STATIC, family, action);
 		run_farm_sessions_map(buf, n, SESSION_TYPE_TIMED, family, action);
 		run_base_chain(buf, n, NFTLB_F_CHAIN_ING_FILTER, family, get_rules_needed(a), action);
+		run_farm_bck_maps_delete(buf, n, family, NFTLB_F_CHAIN_ING_FILTER);
 		run_base_table(buf, NFTLB_F_CHAIN_ING_FILTER, family, action);
 		run_nftst_ingress_policies(buf, n, family, f->policies_action);
 		break;
@@ -2818,6 +3761,7 @@ static int run_farm_stlsnat(struct sbuffer *buf, struct nftst *n, int family, in
 		run_farm_map(buf, a, family, NFTLB_F_CHAIN_ING_DNAT, map_str, VALUE_META_SRCIP, VALUE_META_SRCMAC, f->persistttl, action);
 		run_base_chain(buf, n, NFTLB_F_CHAIN_ING_DNAT, family, get_rules_needed(a), action);
 		run_base_chain(buf, n, NFTLB_F_CHAIN_ING_FILTER, family, get_rules_needed(a), action);
+		run_farm_bck_maps_delete(buf, n, family, NFTLB_F_CHAIN_ING_FILTER);
 		run_base_table(buf, NFTLB_F_CHAIN_ING_FILTER, family, action);
 		run_nftst_ingress_policies(buf, n, family, f->policies_action);
 		break;
@@ -2859,6 +3803,7 @@ static int run_farm_nat(struct sbuffer *buf, struct nftst *n, int family, int ac
 		run_nftst_rules_gen_vsrv(buf, n, NFTLB_F_CHAIN_PRE_DNAT, family, naction, action);
 		run_base_chain(buf, n, NFTLB_F_CHAIN_PRE_DNAT, family, get_rules_needed(a), action);
 		run_base_chain(buf, n, NFTLB_F_CHAIN_POS_SNAT, family, get_rules_needed(a), action);
+		run_farm_bck_maps_delete(buf, n, family, NFTLB_F_CHAIN_PRE_FILTER | NFTLB_F_CHAIN_PRE_DNAT);
 		run_base_table(buf, NFTLB_F_CHAIN_PRE_DNAT, family, action);
 		run_nftst_ingress_policies(buf, n, family, f->policies_action);
 		break;
@@ -2908,13 +3853,64 @@ static int run_farm_local(struct sbuffer *buf, struct nftst *n, int family, int
 	return 0;
 }
 
+static int farm_needs_bck_maps_only(struct nftst *n)
+{
+	struct farm *f = nftst_get_farm(n);
+	struct backend *b;
+
+	if (f->reload_action != VALUE_RLD_BCKS_STATE || nftst_get_action(n) != ACTION_NONE ||
+		f->policies_action != ACTION_NONE || !f->nft_bck_maps)
+		return 0;
+
+	if (f->nft_bck_slots != get_farm_bck_slots(f) || f->nft_bck_shape != get_farm_bck_shape(f))
+		return 0;
+
+	// the per backend limits are rules, not elements
+	list_for_each_entry(b, &f->backends, list)
+		if (b->estconnlimit != DEFAULT_ESTCONNLIMIT)
+			return 0;
+
+	return 1;
+}
+
+static int run_farm_bck_maps(struct sbuffer *buf, struct nftst *n, int family)
+{
+	struct farm *f = nftst_get_farm(n);
+	int maps = f->nft_bck_maps;
+	int i;
+
+	tools_printlog(LOG_DEBUG, "%s():%d: updating backend maps of farm %s", __FUNCTION__, __LINE__, f->name);
+
+	for (i = 0; i < NFTLB_BCK_MAPS_NUM; i++) {
+		if (!(maps & (1 << i)))
+			continue;
+		if (nl_maps && run_farm_bck_map_netlink(n, family, &bck_maps[i]) != 1)
+			continue;
+		run_farm_bck_map(buf, n, family, bck_maps[i].key_mode, bck_maps[i].data_mode, ACTION_RELOAD);
+	}
+
+	run_farm_manage_sessions(buf, f, SESSION_TYPE_STATIC, family, ACTION_RELOAD);
+	run_farm_manage_sessions(buf, f, SESSION_TYPE_TIMED, family, ACTION_RELOAD);
+	run_farm_snat(buf, n, family, ACTION_RELOAD);
+
+	if (need_forward(f))
+		run_nftst_rules_gen_srv_map_by_protocol(buf, n, NFTLB_F_CHAIN_FWD_FILTER, family, ACTION_RELOAD);
+
+	return 0;
+}
+
 static int run_farm_rules(struct sbuffer *buf, struct nftst *n, int family)
 {
 	struct farm *f = nftst_get_farm(n);
 	int action = nftst_get_action(n);
 
-	if (f->action == ACTION_RELOAD && action == ACTION_NONE)
+	nftst_set_bck_maps(n, 0);
+
+	if (f->action == ACTION_RELOAD && action == ACTION_NONE) {
+		if (farm_needs_bck_maps_only(n))
+			return run_farm_bck_maps(buf, n, family);
 		action = ACTION_RELOAD;
+	}
 
 	switch (f->mode) {
 	case VALUE_MODE_STLSDNAT:
@@ -2930,6 +3926,11 @@ static int run_farm_rules(struct sbuffer *buf, struct nftst *n, int family)
 		run_farm_nat(buf, n, family, action);
 	}
 
+	if (action == ACTION_START || action == ACTION_RELOAD) {
+		f->nft_bck_slots = get_farm_bck_slots(f);
+		f->nft_bck_shape = get_farm_bck_shape(f);
+	}
+
 	return 0;
 }
 
@@ -2996,23 +3997,292 @@ int nft_check_tables(void)
 		   nft_base_rules.ndv_ingress_rules.n_interfaces;
 }
 
+static struct adopt_obj *adopt_obj_create(const char *kind, const char *family, const char *name)
+{
+	struct adopt_obj *o = (struct adopt_obj *)calloc(1, sizeof(struct adopt_obj));
+
+	if (!o) {
+		tools_printlog(LOG_ERR, "%s():%d: adopt object memory allocation error", __FUNCTION__, __LINE__);
+		return NULL;
+	}
+
+	snprintf(o->kind, NFTLB_MAX_OBJ_NAME, "%s", kind);
+	snprintf(o->family, NFTLB_MAX_OBJ_NAME, "%s", family);
+	snprintf(o->name, NFTLB_MAX_OBJ_NAME, "%s", name);
+	list_add_tail(&o->list, &adopt_objs);
+
+	return o;
+}
+
+static struct adopt_obj *adopt_obj_lookup(const char *kind, const char *family, const char *name)
+{
+	struct adopt_obj *o;
+
+	list_for_each_entry(o, &adopt_objs, list)
+		if (strcmp(o->kind, kind) == 0 && strcmp(o->family, family) == 0 && strcmp(o->name, name) == 0)
+			return o;
+
+	return NULL;
+}
+
+static void adopt_objs_clean(void)
+{
+	struct adopt_obj *o, *next;
+
+	list_for_each_entry_safe(o, next, &adopt_objs, list) {
+		list_del(&o->list);
+		free(o);
+	}
+}
+
+/*
+ * Collect the objects of the given kind from a listing of the family,
+ * only the declarations are listed so the elements aren't dumped.
+ */
+static void adopt_parse_listing(const char *kind, const char *family, const char *out)
+{
+	char kind_str[NFTLB_MAX_OBJ_NAME];
+	char name[NFTLB_MAX_OBJ_NAME];
+	char table[NFTLB_MAX_OBJ_NAME];
+	char fam[NFTLB_MAX_OBJ_NAME];
+	struct adopt_obj *cur = NULL;
+	char *data, *line, *ptr, *saveptr;
+	int in_table = 0;
+
+	data = strdup(out);
+	if (!data)
+		return;
+
+	for (line = strtok_r(data, "\n", &saveptr); line; line = strtok_r(NULL, "\n", &saveptr)) {
+		for (ptr = line; *ptr == '\t' || *ptr == ' '; ptr++);
+
+		if (sscanf(ptr, "table %255s %255s {", fam, table) == 2) {
+			in_table = (strcmp(fam, family) == 0 && strcmp(table, NFTLB_TABLE_NAME) == 0);
+			if (in_table && !adopt_obj_lookup("table", family, ""))
+				adopt_obj_create("table", family, "");
+			cur = NULL;
+			continue;
+		}
+
+		if (!in_table)
+			continue;
+
+		if (sscanf(ptr, "%255s %255s {", kind_str, name) == 2 && strcmp(kind_str, kind) == 0) {
+			cur = adopt_obj_lookup(kind, family, name);
+			if (!cur)
+				cur = adopt_obj_create(kind, family, name);
+			continue;
+		}
+
+		if (strcmp(ptr, "}") == 0) {
+			cur = NULL;
+			continue;
+		}
+
+		/* maps and sets updated from the packet path keep their content */
+		if (cur && (strstr(ptr, "timeout") || strstr(ptr, "dynamic")))
+			cur->dynamic = 1;
+	}
+
+	free(data);
+}
+
+static int adopt_script_has(const char *script, struct adopt_obj *o)
+{
+	char key[NFTLB_MAX_OBJ_NAME * 4];
+	const char *ptr = script;
+	size_t len;
+	char c;
+
+	if (strcmp(o->kind, "table") == 0)
+		snprintf(key, sizeof(key), "table %s %s", o->family, NFTLB_TABLE_NAME);
+	else
+		snprintf(key, sizeof(key), "%s %s %s %s", o->kind, o->family, NFTLB_TABLE_NAME, o->name);
+	len = strlen(key);
+
+	while ((ptr = strstr(ptr, key)) != NULL) {
+		c = ptr[len];
+		if (c == '\0' || c == ' ' || c == ';' || c == '{')
+			return 1;
+		ptr += len;
+	}
+
+	return 0;
+}
+
+static int adopt_table_stale(const char *script, const char *family)
+{
+	struct adopt_obj *o = adopt_obj_lookup("table", family, "");
+
+	return o && !adopt_script_has(script, o);
+}
+
+/*
+ * Instead of deleting the existing nftlb tables, keep them and collect
+ * their objects. The rules generated from the configuration are batched
+ * until nft_adopt_commit().
+ */
+int nft_adopt_begin(void)
+{
+	const char *families[] = { NFTLB_IPV4_FAMILY_STR, NFTLB_IPV6_FAMILY_STR, NFTLB_NETDEV_FAMILY_STR };
+	const char *kinds[] = { "chain", "map", "set", "flowtable" };
+	char cmd[NFTLB_MAX_OBJ_NAME] = { 0 };
+	const char *out;
+	unsigned int i, j;
+
+	for (i = 0; i < sizeof(families) / sizeof(families[0]); i++) {
+		for (j = 0; j < sizeof(kinds) / sizeof(kinds[0]); j++) {
+			snprintf(cmd, NFTLB_MAX_OBJ_NAME, "list %ss %s", kinds[j], families[i]);
+			if (exec_cmd_open(cmd, &out, 0) == 0)
+				adopt_parse_listing(kinds[j], families[i], out);
+			exec_cmd_close(out);
+		}
+	}
+
+	/* nothing is changed until the batch is ready, so the caller can reset instead */
+	if (nft_batch_begin()) {
+		tools_printlog(LOG_ERR, "%s():%d: unable to adopt the existing nftlb tables", __FUNCTION__, __LINE__);
+		adopt_objs_clean();
+		return -1;
+	}
+
+	/* the generator starts from scratch, as after a reset */
+	clean_rules_counters();
+
+	adopting = 1;
+	adopt_serialize = serialize;
+	adopt_backend = nft_backend;
+	serialize = 0;
+	nft_backend = NFTLB_BACKEND_TEXT;
+
+	tools_printlog(LOG_INFO, "%s():%d: adopting the existing nftlb tables", __FUNCTION__, __LINE__);
+
+	return 0;
+}
+
+/*
+ * Apply the generated rules over the adopted tables in one transaction:
+ * the existing chains and static maps are flushed and filled again, and
+ * whatever isn't generated anymore is deleted. Dynamic maps, like the
+ * persistence ones, and flowtables are kept untouched.
+ */
+int nft_adopt_commit(void)
+{
+	const char *kinds[] = { "chain", "map", "set", "flowtable" };
+	struct nft_cmd_batch *batch = cmd_batch;
+	struct sbuffer script;
+	struct adopt_obj *o;
+	char *full;
+	unsigned int i;
+	int error;
+
+	if (!adopting)
+		return 0;
+
+	adopting = 0;
+	serialize = adopt_serialize;
+	nft_backend = adopt_backend;
+
+	if (!batch)
+		return -1;
+
+	cmd_batch = NULL;
+	full = get_buf_data(&batch->full);
+
+	if (create_buf(&script)) {
+		error = -1;
+		goto out;
+	}
+
+	list_for_each_entry(o, &adopt_objs, list) {
+		if (strcmp(o->kind, "chain") == 0)
+			concat_buf(&script, " ; flush chain %s %s %s", o->family, NFTLB_TABLE_NAME, o->name);
+		else if ((strcmp(o->kind, "map") == 0 || strcmp(o->kind, "set") == 0) && !o->dynamic)
+			concat_buf(&script, " ; flush %s %s %s %s", o->kind, o->family, NFTLB_TABLE_NAME, o->name);
+	}
+
+	concat_buf(&script, "%s", full);
+
+	for (i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++) {
+		list_for_each_entry(o, &adopt_objs, list) {
+			if (strcmp(o->kind, kinds[i]) != 0 || adopt_table_stale(full, o->family) || adopt_script_has(full, o))
+				continue;
+			tools_printlog(LOG_DEBUG, "%s():%d: deleting stale %s %s", __FUNCTION__, __LINE__, o->kind, o->name);
+			concat_buf(&script, " ; delete %s %s %s %s", o->kind, o->family, NFTLB_TABLE_NAME, o->name);
+		}
+	}
+
+	list_for_each_entry(o, &adopt_objs, list) {
+		if (strcmp(o->kind, "table") == 0 && adopt_table_stale(full, o->family))
+			concat_buf(&script, " ; delete table %s %s", o->family, NFTLB_TABLE_NAME);
+	}
+
+	error = exec_cmd_run(get_buf_data(&script), get_buf_data(&script), nft_ctx_mgr_epoch());
+	clean_buf(&script);
+
+out:
+	clean_buf(&batch->cmds);
+	clean_buf(&batch->full);
+	free(batch);
+	adopt_objs_clean();
+
+	return error;
+}
+
+static void run_set_element(struct sbuffer *buf, struct policy *p, struct element *e, int action, int *index)
+{
+	if (*index)
+		concat_buf(buf, ", %s", e->data);
+	else {
+		(*index)++;
+		concat_buf(buf, " ; %s element %s %s %s { %s", (action == ACTION_START) ? NFTLB_NFT_ACTION_ADD : NFTLB_NFT_ACTION_DEL,
+				   NFTLB_NETDEV_FAMILY_STR, NFTLB_TABLE_NAME, p->name, e->data);
+	}
+}
+
+/*
+ * The whole content of the set is replaced in a single netlink batch, so
+ * it's never seen empty. The elements are merged here, as the kernel
+ * doesn't and the set is declared with auto-merge.
+ */
+static int run_set_elements_netlink(struct policy *p)
+{
+	struct nlbatch_ranges rs;
+	struct element *e;
+	int ret = 0;
+
+	memset(&rs, 0, sizeof(struct nlbatch_ranges));
+
+	list_for_each_entry(e, &p->elements, list) {
+		if (e->action == ACTION_START && nlbatch_ranges_add(&rs, p->family, e->data))
+			ret = -1;
+		e->action = ACTION_NONE;
+	}
+
+	if (!ret)
+		ret = nlbatch_set_flush(nl_batch, NFPROTO_NETDEV, p->name) ||
+			  nlbatch_set_ranges(nl_batch, NFPROTO_NETDEV, p->name, &rs);
+
+	nlbatch_ranges_free(&rs);
+
+	return ret;
+}
+
 static int run_set_elements(struct sbuffer *buf, struct policy *p)
 {
 	struct element *e;
 	int index = 0;
 
+	if (p->action == ACTION_FLUSH && nl_batch)
+		return run_set_elements_netlink(p);
+
 	if (!p->total_elem)
 		return 0;
 
 	switch (p->action) {
 	case ACTION_START:
 		list_for_each_entry(e, &p->elements, list) {
-			if (index)
-				concat_buf(buf, ", %s", e->data);
-			else {
-				index++;
-				concat_buf(buf, " ; add element %s %s %s { %s", NFTLB_NETDEV_FAMILY_STR, NFTLB_TABLE_NAME, p->name, e->data);
-			}
+			run_set_element(buf, p, e, ACTION_START, &index);
 			e->action = ACTION_NONE;
 		}
 		if (index)
@@ -3025,12 +4295,7 @@ static int run_set_elements(struct sbuffer *buf, struct policy *p)
 		list_for_each_entry(e, &p->elements, list) {
 			if (e->action != ACTION_START)
 				continue;
-			if (index)
-				concat_buf(buf, ", %s", e->data);
-			else {
-				index++;
-				concat_buf(buf, " ; add element %s %s %s { %s", NFTLB_NETDEV_FAMILY_STR, NFTLB_TABLE_NAME, p->name, e->data);
-			}
+			run_set_element(buf, p, e, ACTION_START, &index);
 			e->action = ACTION_NONE;
 		}
 		if (index)
@@ -3040,12 +4305,7 @@ static int run_set_elements(struct sbuffer *buf, struct policy *p)
 		list_for_each_entry(e, &p->elements, list) {
 			if (e->action != ACTION_DELETE && e->action != ACTION_STOP)
 				continue;
-			if (index)
-				concat_buf(buf, ", %s", e->data);
-			else {
-				index++;
-				concat_buf(buf, " ; delete element %s %s %s { %s", NFTLB_NETDEV_FAMILY_STR, NFTLB_TABLE_NAME, p->name, e->data);
-			}
+			run_set_element(buf, p, e, ACTION_DELETE, &index);
 			e->action = ACTION_NONE;
 		}
 		if (index)
@@ -3054,12 +4314,7 @@ static int run_set_elements(struct sbuffer *buf, struct policy *p)
 	case ACTION_DELETE:
 	case ACTION_STOP:
 		list_for_each_entry(e, &p->elements, list) {
-			if (index)
-				concat_buf(buf, ", %s", e->data);
-			else {
-				index++;
-				concat_buf(buf, " ; delete element %s %s %s { %s", NFTLB_NETDEV_FAMILY_STR, NFTLB_TABLE_NAME, p->name, e->data);
-			}
+			run_set_element(buf, p, e, ACTION_DELETE, &index);
 			e->action = ACTION_NONE;
 		}
 		if (index)
@@ -3143,12 +4398,33 @@ static int run_policy_set(struct sbuffer *buf, struct policy *p)
 
 int nft_rulerize_policies(struct policy *p)
 {
+	struct nlbatch *prev_batch = nl_batch;
+	struct stats_timer t;
+	struct nlbatch batch;
 	struct sbuffer buf;
 	int ret = 0;
 
 	create_buf(&buf);
 
+	/*
+	 * Only a full replacement of the elements goes through netlink, the
+	 * incremental changes need the set content to be merged and are left
+	 * to nft. Within a batch, the text keeps it a single transaction.
+	 */
+	if (nft_backend == NFTLB_BACKEND_NETLINK && p->action == ACTION_FLUSH &&
+		!cmd_batch && nlbatch_begin(&batch) == 0)
+		nl_batch = &batch;
+
+	stats_phase_begin(&t, STATS_PHASE_RULES);
 	run_policy_set(&buf, p);
+	stats_phase_end(&t);
+
+	if (nl_batch == &batch) {
+		ret = exec_nlbatch(&batch);
+		nlbatch_end(&batch);
+	}
+	nl_batch = prev_batch;
+
 	exec_cmd(get_buf_data(&buf));
 
 	clean_buf(&buf);
@@ -3191,6 +4467,132 @@ void nft_del_rules_buffer(const char *buf)
 	exec_cmd_close(buf);
 }
 
+/*
+ * While a batch is open, the commands generated by every rulerize call
+ * are accumulated and sent to the kernel as a single transaction in
+ * nft_batch_commit().
+ */
+int nft_batch_begin(void)
+{
+	if (cmd_batch)
+		return 0;
+
+	cmd_batch = (struct nft_cmd_batch *)malloc(sizeof(struct nft_cmd_batch));
+	if (!cmd_batch) {
+		tools_printlog(LOG_ERR, "%s():%d: nft batch memory allocation error", __FUNCTION__, __LINE__);
+		return -1;
+	}
+
+	if (create_buf(&cmd_batch->cmds)) {
+		free(cmd_batch);
+		cmd_batch = NULL;
+		return -1;
+	}
+
+	if (create_buf(&cmd_batch->full)) {
+		clean_buf(&cmd_batch->cmds);
+		free(cmd_batch);
+		cmd_batch = NULL;
+		return -1;
+	}
+
+	cmd_batch->epoch = 0;
+
+	/* the backend maps refilled go in a netlink batch sent after the text */
+	if (nft_backend == NFTLB_BACKEND_NETLINK && nlbatch_begin(&cmd_batch->maps) == 0)
+		nl_maps = &cmd_batch->maps;
+	else
+		memset(&cmd_batch->maps, 0, sizeof(struct nlbatch));
+
+	return 0;
+}
+
+int nft_batch_commit(void)
+{
+	struct nft_cmd_batch *batch = cmd_batch;
+	int error = 0;
+
+	if (!batch)
+		return 0;
+
+	cmd_batch = NULL;
+	nl_maps = NULL;
+	if (!isempty_buf(&batch->full))
+		error = exec_cmd_run(get_buf_data(&batch->cmds), get_buf_data(&batch->full), batch->epoch);
+	if (batch->maps.data) {
+		if (!error && exec_nlbatch(&batch->maps))
+			error = -1;
+		nlbatch_end(&batch->maps);
+	}
+	clean_buf(&batch->cmds);
+	clean_buf(&batch->full);
+	free(batch);
+
+	return error;
+}
+
+/*
+ * From now on the nft scripts are executed by the commit worker, the
+ * callback is called in the main loop once every job is done.
+ */
+int nft_async_start(nft_commit_fn cb)
+{
+	commit_cb = cb;
+
+	return worker_start(exec_job, exec_job_done);
+}
+
+void nft_async_stop(void)
+{
+	worker_stop();
+	commit_cb = NULL;
+}
+
+/*
+ * Write the generated scripts to the given file instead of executing
+ * them, so the rulerize can run without the kernel.
+ */
+void nft_compile_start(FILE *out)
+{
+	compile_out = out;
+}
+
+void nft_compile_stop(void)
+{
+	if (compile_out)
+		fflush(compile_out);
+	compile_out = NULL;
+}
+
+/* sequence number of the last script handed to the commit worker */
+unsigned long nft_get_commit_seq(void)
+{
+	if (!worker_is_running())
+		return 0;
+
+	return worker_get_seq();
+}
+
+void nft_fini(void)
+{
+	nft_async_stop();
+	nft_ctx_mgr_invalidate();
+
+	if (ctx_mgr.list_ctx) {
+		nft_ctx_unbuffer_error(ctx_mgr.list_ctx);
+		nft_ctx_free(ctx_mgr.list_ctx);
+		ctx_mgr.list_ctx = NULL;
+	}
+
+	if (ctx_mgr.nl) {
+		mnl_socket_close(ctx_mgr.nl);
+		ctx_mgr.nl = NULL;
+	}
+
+	nlbatch_fini();
+	shadow_fini();
+}
+
 static int run_address_rules(struct sbuffer *buf, struct nftst *n, int family)
 {
 	struct address *a = nftst_get_address(n);
@@ -3214,6 +4616,10 @@ static int run_address_rules(struct sbuffer *buf, struct nftst *n, int family)
 
 static int run_nftst(struct sbuffer *buf, struct nftst *n)
 {
+	struct stats_timer t;
+
+	stats_phase_begin(&t, STATS_PHASE_RULES);
+
 	if ((nftst_get_family(n) == VALUE_FAMILY_IPV4) || (nftst_get_family(n) == VALUE_FAMILY_INET)) {
 		if (nftst_has_farm(n))
 			run_farm_rules(buf, n, VALUE_FAMILY_IPV4);
@@ -3228,6 +4634,8 @@ static int run_nftst(struct sbuffer *buf, struct nftst *n)
 			run_address_rules(buf, n, VALUE_FAMILY_IPV6);
 	}
 
+	stats_phase_end(&t);
+
 	return 0;
 }
 
@@ -3256,11 +4664,15 @@ int nft_rulerize_farms(struct farm *f)
 {
 	struct farmaddress *fa;
 	struct nftst *n = nftst_create_from_farm(f);
+	struct nlbatch batch;
 	struct sbuffer buf;
 	int ret = 0;
 
 	create_buf(&buf);
 
+	if (nft_backend == NFTLB_BACKEND_NETLINK && !nl_maps && nlbatch_begin(&batch) == 0)
+		nl_maps = &batch;
+
 	list_for_each_entry(fa, &f->addresses, list) {
 		nftst_set_address(n, fa->address);
 		nftst_set_action(n, fa->action);
@@ -3269,6 +4681,12 @@ int nft_rulerize_farms(struct farm *f)
 
 	exec_cmd(get_buf_data(&buf));
 	clean_buf(&buf);
+
+	if (nl_maps == &batch) {
+		ret = exec_nlbatch(&batch);
+		nlbatch_end(&batch);
+		nl_maps = NULL;
+	}
 	nftst_actions_done(n);
 	nftst_delete(n);
 
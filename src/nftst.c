@@ -33,6 +33,7 @@ static struct nftst *nftst_create(void)
 		tools_printlog(LOG_ERR, "nft struct memory allocation error");
 		return NULL;
 	}
+	n->bck_maps = 0;
 	return n;
 }
 
@@ -201,6 +202,16 @@ void nftst_set_chains(struct nftst *n, int chains)
 	return;
 }
 
+void nftst_set_bck_maps(struct nftst *n, int maps)
+{
+	n->bck_maps = maps;
+}
+
+int nftst_get_bck_maps(struct nftst *n)
+{
+	return n->bck_maps;
+}
+
 int nftst_actions_done(struct nftst *n)
 {
 	struct farm *f = n->farm;
@@ -0,0 +1,529 @@
+/*
+ *   This file is part of nftlb, nftables load balancer.
+ *
+ *   Copyright (C) ZEVENET SL.
+ *   Author: Laura Garcia <laura.garcia@zevenet.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Affero General Public License as
+ *   published by the Free Software Foundation, either version 3 of the
+ *   License, or any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Affero General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Affero General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <libmnl/libmnl.h>
+#include <linux/netfilter.h>
+#include <linux/netfilter/nfnetlink.h>
+#include <linux/netfilter/nf_tables.h>
+
+#include "nlbatch.h"
+#include "objects.h"
+#include "tools.h"
+
+#define NLBATCH_TABLE_NAME		"nftlb"
+#define NLBATCH_DEFAULT_SIZE	(64 * 1024)
+#define NLBATCH_MSG_MAX			(32 * 1024)
+#define NLBATCH_ELEM_MAX		128
+#define NLBATCH_ADDR_LEN		16
+#define NLBATCH_ACK_TIMEOUT_MS	5000
+
+static struct mnl_socket *nl = NULL;
+static unsigned int nl_portid = 0;
+
+/* every batch gets its own sequence numbers so acks can't be mistaken */
+static uint32_t nl_seq = 0;
+
+/*
+ * The socket has a receive timeout, so a batch that the kernel doesn't
+ * fully ack never blocks the daemon.
+ */
+static int nlbatch_socket(void)
+{
+	struct timeval tv;
+
+	if (nl)
+		return 0;
+
+	tv.tv_sec = NLBATCH_ACK_TIMEOUT_MS / 1000;
+	tv.tv_usec = (NLBATCH_ACK_TIMEOUT_MS % 1000) * 1000;
+
+	nl = mnl_socket_open(NETLINK_NETFILTER);
+	if (!nl) {
+		tools_printlog(LOG_ERR, "%s():%d: mnl_socket_open error", __FUNCTION__, __LINE__);
+		return -1;
+	}
+
+	if (mnl_socket_bind(nl, 0, MNL_SOCKET_AUTOPID) < 0) {
+		tools_printlog(LOG_ERR, "%s():%d: mnl_socket_bind error", __FUNCTION__, __LINE__);
+		mnl_socket_close(nl);
+		nl = NULL;
+		return -1;
+	}
+
+	if (setsockopt(mnl_socket_get_fd(nl), SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0) {
+		tools_printlog(LOG_ERR, "%s():%d: unable to set the receive timeout", __FUNCTION__, __LINE__);
+		mnl_socket_close(nl);
+		nl = NULL;
+		return -1;
+	}
+
+	nl_portid = mnl_socket_get_portid(nl);
+
+	return 0;
+}
+
+static int nlbatch_reserve(struct nlbatch *b, size_t len)
+{
+	char *pbuf;
+	size_t newsize = b->size;
+	size_t cur_off = 0;
+
+	if (b->len + len <= b->size)
+		return 0;
+
+	if (b->cur)
+		cur_off = (char *)b->cur - b->data;
+
+	while (b->len + len > newsize)
+		newsize *= 2;
+
+	pbuf = (char *)realloc(b->data, newsize);
+	if (!pbuf) {
+		tools_printlog(LOG_ERR, "%s():%d: netlink batch memory allocation error", __FUNCTION__, __LINE__);
+		b->error = 1;
+		return -1;
+	}
+
+	if (b->cur) {
+		if (b->cur_elems)
+			b->cur_elems = (struct nlattr *)(pbuf + ((char *)b->cur_elems - b->data));
+		b->cur = (struct nlmsghdr *)(pbuf + cur_off);
+	}
+
+	b->data = pbuf;
+	b->size = newsize;
+
+	return 0;
+}
+
+static struct nlmsghdr *nlbatch_put_header(struct nlbatch *b, uint16_t type, uint16_t flags, int nfproto, uint16_t res_id)
+{
+	struct nlmsghdr *nlh;
+	struct nfgenmsg *nfg;
+
+	if (nlbatch_reserve(b, NLBATCH_MSG_MAX))
+		return NULL;
+
+	nlh = mnl_nlmsg_put_header(b->data + b->len);
+	nlh->nlmsg_type = type;
+	nlh->nlmsg_flags = NLM_F_REQUEST | flags;
+	nlh->nlmsg_seq = b->seq++;
+
+	nfg = mnl_nlmsg_put_extra_header(nlh, sizeof(struct nfgenmsg));
+	nfg->nfgen_family = nfproto;
+	nfg->version = NFNETLINK_V0;
+	nfg->res_id = htons(res_id);
+
+	return nlh;
+}
+
+static void nlbatch_close_msg(struct nlbatch *b)
+{
+	if (!b->cur)
+		return;
+
+	mnl_attr_nest_end(b->cur, b->cur_elems);
+	b->len += MNL_ALIGN(b->cur->nlmsg_len);
+	b->cur = NULL;
+	b->cur_elems = NULL;
+	b->cur_set[0] = '\0';
+}
+
+static int nlbatch_open_msg(struct nlbatch *b, int nfproto, const char *set, int action)
+{
+	uint16_t type = (action == ACTION_START) ? NFT_MSG_NEWSETELEM : NFT_MSG_DELSETELEM;
+	uint16_t flags = NLM_F_ACK;
+
+	if (action == ACTION_START)
+		flags |= NLM_F_CREATE;
+
+	b->cur = nlbatch_put_header(b, (NFNL_SUBSYS_NFTABLES << 8) | type, flags, nfproto, 0);
+	if (!b->cur)
+		return -1;
+
+	mnl_attr_put_strz(b->cur, NFTA_SET_ELEM_LIST_TABLE, NLBATCH_TABLE_NAME);
+	mnl_attr_put_strz(b->cur, NFTA_SET_ELEM_LIST_SET, set);
+	b->cur_elems = mnl_attr_nest_start(b->cur, NFTA_SET_ELEM_LIST_ELEMENTS);
+
+	b->cur_family = nfproto;
+	b->cur_action = action;
+	snprintf(b->cur_set, NLBATCH_MAX_NAME, "%s", set);
+	b->msgs++;
+
+	return 0;
+}
+
+int nlbatch_begin(struct nlbatch *b)
+{
+	struct nlmsghdr *nlh;
+
+	memset(b, 0, sizeof(struct nlbatch));
+
+	b->data = (char *)malloc(NLBATCH_DEFAULT_SIZE);
+	if (!b->data) {
+		tools_printlog(LOG_ERR, "%s():%d: netlink batch memory allocation error", __FUNCTION__, __LINE__);
+		return -1;
+	}
+	b->size = NLBATCH_DEFAULT_SIZE;
+	if (!nl_seq)
+		nl_seq = time(NULL);
+	b->seq_first = nl_seq;
+	b->seq = b->seq_first;
+
+	nlh = nlbatch_put_header(b, NFNL_MSG_BATCH_BEGIN, 0, AF_UNSPEC, NFNL_SUBSYS_NFTABLES);
+	if (!nlh)
+		return -1;
+	b->len += MNL_ALIGN(nlh->nlmsg_len);
+
+	return 0;
+}
+
+int nlbatch_is_empty(struct nlbatch *b)
+{
+	return (b->msgs == 0);
+}
+
+static int nlbatch_put_elem(struct nlbatch *b, int nfproto, const char *set, const void *key, int keylen,
+			    const void *data, int datalen, uint32_t flags, int action)
+{
+	struct nlattr *nest_elem, *nest_key, *nest_data;
+
+	if (!b->data)
+		return -1;
+
+	if (b->cur && (b->cur_family != nfproto || b->cur_action != action ||
+		strcmp(b->cur_set, set) != 0 || b->cur->nlmsg_len > NLBATCH_MSG_MAX - NLBATCH_ELEM_MAX))
+		nlbatch_close_msg(b);
+
+	if (!b->cur && nlbatch_open_msg(b, nfproto, set, action))
+		return -1;
+
+	nest_elem = mnl_attr_nest_start(b->cur, NFTA_LIST_ELEM);
+	nest_key = mnl_attr_nest_start(b->cur, NFTA_SET_ELEM_KEY);
+	mnl_attr_put(b->cur, NFTA_DATA_VALUE, keylen, key);
+	mnl_attr_nest_end(b->cur, nest_key);
+	if (flags)
+		mnl_attr_put_u32(b->cur, NFTA_SET_ELEM_FLAGS, htonl(flags));
+	if (data) {
+		nest_data = mnl_attr_nest_start(b->cur, NFTA_SET_ELEM_DATA);
+		mnl_attr_put(b->cur, NFTA_DATA_VALUE, datalen, data);
+		mnl_attr_nest_end(b->cur, nest_data);
+	}
+	mnl_attr_nest_end(b->cur, nest_elem);
+
+	return 0;
+}
+
+int nlbatch_set_elem(struct nlbatch *b, int nfproto, const char *set, const void *key, int keylen, uint32_t flags, int action)
+{
+	return nlbatch_put_elem(b, nfproto, set, key, keylen, NULL, 0, flags, action);
+}
+
+/* the end elements of the intervals of a map are sent without data */
+int nlbatch_map_elem(struct nlbatch *b, int nfproto, const char *set, const void *key, int keylen,
+		     const void *data, int datalen, uint32_t flags)
+{
+	return nlbatch_put_elem(b, nfproto, set, key, keylen, data, datalen, flags, ACTION_START);
+}
+
+static int nlbatch_parse_addr(int af, const char *str, unsigned char *addr)
+{
+	char tmp[INET6_ADDRSTRLEN] = { 0 };
+
+	snprintf(tmp, INET6_ADDRSTRLEN, "%s", str);
+
+	return (inet_pton(af, tmp, addr) == 1) ? 0 : -1;
+}
+
+/*
+ * Translate an element as written in the policy (address, prefix or
+ * range) into the pair of interval boundaries the kernel expects.
+ * Returns 1 if the range reaches the end of the address space, so there
+ * is no closing element to send.
+ */
+static int nlbatch_parse_interval(int af, const char *data, unsigned char *start, unsigned char *end, int len)
+{
+	char str[INET6_ADDRSTRLEN * 2 + 2] = { 0 };
+	char *sep;
+	int prefix, i;
+
+	snprintf(str, sizeof(str), "%s", data);
+
+	if ((sep = strchr(str, '-')) != NULL) {
+		*sep = '\0';
+		if (nlbatch_parse_addr(af, str, start) || nlbatch_parse_addr(af, sep + 1, end))
+			return -1;
+	} else if ((sep = strchr(str, '/')) != NULL) {
+		*sep = '\0';
+		prefix = atoi(sep + 1);
+		if (prefix < 0 || prefix > len * 8 || nlbatch_parse_addr(af, str, start))
+			return -1;
+		for (i = 0; i < len; i++) {
+			int bits = prefix - i * 8;
+			unsigned char mask = bits >= 8 ? 0xff : (bits <= 0 ? 0 : (unsigned char)(0xff << (8 - bits)));
+			start[i] &= mask;
+			end[i] = start[i] | ~mask;
+		}
+	} else {
+		if (nlbatch_parse_addr(af, str, start))
+			return -1;
+		memcpy(end, start, len);
+	}
+
+	if (memcmp(start, end, len) > 0)
+		return -1;
+
+	/* the interval end element is the first address out of the range */
+	for (i = len - 1; i >= 0; i--) {
+		if (++end[i] != 0)
+			return 0;
+	}
+
+	return 1;
+}
+
+/* a DELSETELEM message without elements flushes the set */
+int nlbatch_set_flush(struct nlbatch *b, int nfproto, const char *set)
+{
+	struct nlmsghdr *nlh;
+
+	if (!b->data)
+		return -1;
+
+	nlbatch_close_msg(b);
+
+	nlh = nlbatch_put_header(b, (NFNL_SUBSYS_NFTABLES << 8) | NFT_MSG_DELSETELEM, NLM_F_ACK, nfproto, 0);
+	if (!nlh)
+		return -1;
+
+	mnl_attr_put_strz(nlh, NFTA_SET_ELEM_LIST_TABLE, NLBATCH_TABLE_NAME);
+	mnl_attr_put_strz(nlh, NFTA_SET_ELEM_LIST_SET, set);
+	b->len += MNL_ALIGN(nlh->nlmsg_len);
+	b->msgs++;
+
+	return 0;
+}
+
+int nlbatch_ranges_add(struct nlbatch_ranges *rs, int family, const char *data)
+{
+	int af = (family == VALUE_FAMILY_IPV6) ? AF_INET6 : AF_INET;
+	struct nlbatch_range *r;
+	unsigned int size;
+	int ret;
+
+	rs->len = (family == VALUE_FAMILY_IPV6) ? 16 : 4;
+
+	if (rs->n == rs->size) {
+		size = rs->size ? rs->size * 2 : NLBATCH_ELEM_MAX;
+		r = (struct nlbatch_range *)realloc(rs->r, size * sizeof(struct nlbatch_range));
+		if (!r) {
+			tools_printlog(LOG_ERR, "%s():%d: netlink ranges memory allocation error", __FUNCTION__, __LINE__);
+			return -1;
+		}
+		rs->r = r;
+		rs->size = size;
+	}
+
+	r = &rs->r[rs->n];
+	memset(r, 0, sizeof(struct nlbatch_range));
+
+	ret = nlbatch_parse_interval(af, data, r->start, r->end, rs->len);
+	if (ret < 0) {
+		tools_printlog(LOG_ERR, "%s():%d: unable to parse element %s", __FUNCTION__, __LINE__, data);
+		return -1;
+	}
+
+	r->open_end = ret;
+	rs->n++;
+
+	return 0;
+}
+
+/* the unused bytes of the keys are zero, so they compare as well */
+static int nlbatch_range_cmp(const void *a, const void *b)
+{
+	const struct nlbatch_range *ra = a;
+	const struct nlbatch_range *rb = b;
+
+	return memcmp(ra->start, rb->start, sizeof(ra->start));
+}
+
+static int nlbatch_put_range(struct nlbatch *b, int nfproto, const char *set, struct nlbatch_range *r, int len)
+{
+	if (nlbatch_set_elem(b, nfproto, set, r->start, len, 0, ACTION_START))
+		return -1;
+
+	if (!r->open_end && nlbatch_set_elem(b, nfproto, set, r->end, len, NFT_SET_ELEM_INTERVAL_END, ACTION_START))
+		return -1;
+
+	return 0;
+}
+
+/*
+ * The kernel doesn't merge intervals, so the overlapping and adjacent
+ * ones are merged here before they're added, as auto-merge would do.
+ */
+int nlbatch_set_ranges(struct nlbatch *b, int nfproto, const char *set, struct nlbatch_ranges *rs)
+{
+	struct nlbatch_range cur;
+	struct nlbatch_range *r;
+	unsigned int i;
+
+	if (!rs->n)
+		return 0;
+
+	qsort(rs->r, rs->n, sizeof(struct nlbatch_range), nlbatch_range_cmp);
+
+	cur = rs->r[0];
+	for (i = 1; i < rs->n; i++) {
+		r = &rs->r[i];
+
+		if (cur.open_end)
+			break;
+
+		if (memcmp(r->start, cur.end, sizeof(cur.end)) <= 0) {
+			if (r->open_end)
+				cur.open_end = 1;
+			else if (memcmp(r->end, cur.end, sizeof(cur.end)) > 0)
+				memcpy(cur.end, r->end, sizeof(cur.end));
+			continue;
+		}
+
+		if (nlbatch_put_range(b, nfproto, set, &cur, rs->len))
+			return -1;
+		cur = *r;
+	}
+
+	return nlbatch_put_range(b, nfproto, set, &cur, rs->len);
+}
+
+void nlbatch_ranges_free(struct nlbatch_ranges *rs)
+{
+	if (rs->r)
+		free(rs->r);
+	memset(rs, 0, sizeof(struct nlbatch_ranges));
+}
+
+/*
+ * Every message of the batch is acked, also after an error, so all of
+ * them are read before returning to leave the socket clean for the next
+ * batch.
+ */
+static int nlbatch_recv_acks(struct nlbatch *b)
+{
+	char buf[MNL_SOCKET_BUFFER_SIZE];
+	struct nlmsghdr *nlh;
+	struct nlmsgerr *err;
+	unsigned int acks = 0;
+	int error = 0;
+	int ret;
+
+	while (acks < b->msgs) {
+		ret = mnl_socket_recvfrom(nl, buf, sizeof(buf));
+		if (ret <= 0) {
+			if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+				tools_printlog(LOG_ERR, "%s():%d: timeout waiting for the acks, %u of %u received", __FUNCTION__, __LINE__, acks, b->msgs);
+			else
+				tools_printlog(LOG_ERR, "%s():%d: mnl_socket_recvfrom error: %s", __FUNCTION__, __LINE__, strerror(errno));
+			/* the remaining acks are dropped with the socket, the commit failed */
+			nlbatch_fini();
+			return -1;
+		}
+
+		nlh = (struct nlmsghdr *)buf;
+		while (mnl_nlmsg_ok(nlh, ret)) {
+			if (nlh->nlmsg_type == NLMSG_ERROR &&
+				nlh->nlmsg_seq > b->seq_first && nlh->nlmsg_seq < b->seq) {
+				err = mnl_nlmsg_get_payload(nlh);
+				if (err->error && !error) {
+					tools_printlog(LOG_ERR, "nft netlink batch error : %s", strerror(-err->error));
+					error = -1;
+				}
+				acks++;
+			}
+			nlh = mnl_nlmsg_next(nlh, &ret);
+		}
+	}
+
+	return error;
+}
+
+int nlbatch_commit(struct nlbatch *b)
+{
+	struct nlmsghdr *nlh;
+	int sndbuf;
+
+	/* a batch missing any of its messages is never sent */
+	if (b->error) {
+		tools_printlog(LOG_ERR, "%s():%d: the netlink batch is incomplete", __FUNCTION__, __LINE__);
+		return -1;
+	}
+
+	if (!b->data || nlbatch_is_empty(b))
+		return 0;
+
+	nlbatch_close_msg(b);
+
+	nlh = nlbatch_put_header(b, NFNL_MSG_BATCH_END, 0, AF_UNSPEC, NFNL_SUBSYS_NFTABLES);
+	if (!nlh)
+		return -1;
+	b->len += MNL_ALIGN(nlh->nlmsg_len);
+	nl_seq = b->seq;
+
+	if (nlbatch_socket())
+		return -1;
+
+	tools_printlog(LOG_NOTICE, "nft netlink batch exec : %u messages, %zu bytes", b->msgs, b->len);
+
+	sndbuf = b->len;
+	setsockopt(mnl_socket_get_fd(nl), SOL_SOCKET, SO_SNDBUFFORCE, &sndbuf, sizeof(sndbuf));
+
+	if (mnl_socket_sendto(nl, b->data, b->len) < 0) {
+		tools_printlog(LOG_ERR, "%s():%d: mnl_socket_sendto error: %s", __FUNCTION__, __LINE__, strerror(errno));
+		return -1;
+	}
+
+	return nlbatch_recv_acks(b);
+}
+
+void nlbatch_end(struct nlbatch *b)
+{
+	if (b->data)
+		free(b->data);
+	memset(b, 0, sizeof(struct nlbatch));
+}
+
+void nlbatch_fini(void)
+{
+	if (!nl)
+		return;
+
+	mnl_socket_close(nl);
+	nl = NULL;
+}
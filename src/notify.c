@@ -0,0 +1,67 @@
+/*
+ *   This file is part of nftlb, nftables load balancer.
+ *
+ *   Copyright (C) ZEVENET SL.
+ *   Author: Laura Garcia <laura.garcia@zevenet.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Affero General Public License as
+ *   published by the Free Software Foundation, either version 3 of the
+ *   License, or any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Affero General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Affero General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <jansson.h>
+
+#include "notify.h"
+#include "tools.h"
+
+static notify_fn notify_handler;
+
+/*
+ * The handler is only set while somebody listens to the events, so
+ * nothing is built otherwise.
+ */
+void notify_set_handler(notify_fn handler)
+{
+	notify_handler = handler;
+}
+
+/* the event data is a JSON object built as in json_pack() */
+void notify_event(const char *event, const char *fmt, ...)
+{
+	json_error_t error;
+	json_t *data;
+	char *str;
+	va_list ap;
+
+	if (!notify_handler)
+		return;
+
+	va_start(ap, fmt);
+	data = json_vpack_ex(&error, 0, fmt, ap);
+	va_end(ap);
+
+	if (!data) {
+		tools_printlog(LOG_ERR, "%s():%d: unable to build %s event: %s", __FUNCTION__, __LINE__, event, error.text);
+		return;
+	}
+
+	str = json_dumps(data, JSON_COMPACT | JSON_PRESERVE_ORDER);
+	json_decref(data);
+	if (!str)
+		return;
+
+	notify_handler(event, str);
+	free(str);
+}
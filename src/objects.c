@@ -33,6 +33,7 @@
 #include "addresspolicy.h"
 #include "tools.h"
 #include "nft.h"
+#include "stats.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -52,6 +53,16 @@ struct list_head	addresses;
 int			total_addresses = 0;
 static unsigned int cmdtry = 0;
 
+/*
+ * The generation is bumped on every change of the objects, so a listing
+ * can be identified by the generation it was built in. Farms keep the
+ * and policies keep the generation of their last change too, and changes
+ * that may show up in any of them, like the addresses, are tracked in the
+ * shared generation.
+ */
+static unsigned long generation = 1;
+static unsigned long shared_generation = 1;
+
 void objects_init(void)
 {
 	init_list_head(&farms);
@@ -74,6 +85,56 @@ struct list_head * obj_get_addresses(void)
 	return &addresses;
 }
 
+unsigned long obj_get_generation(void)
+{
+	return generation;
+}
+
+unsigned long obj_new_generation(void)
+{
+	return ++generation;
+}
+
+unsigned long obj_get_shared_generation(void)
+{
+	return shared_generation;
+}
+
+void obj_set_shared_changed(void)
+{
+	shared_generation = obj_new_generation();
+}
+
+static void obj_set_changed(int level)
+{
+	struct farm *f = obj_get_current_farm();
+	struct policy *p = obj_get_current_policy();
+
+	switch (level) {
+	case LEVEL_FARMS:
+	case LEVEL_BCKS:
+	case LEVEL_SESSIONS:
+	case LEVEL_FARMPOLICY:
+	case LEVEL_FARMADDRESS:
+		if (f) {
+			farm_set_changed(f);
+			return;
+		}
+		break;
+	case LEVEL_POLICIES:
+	case LEVEL_ELEMENTS:
+		if (p) {
+			policy_set_changed(p);
+			return;
+		}
+		break;
+	default:
+		break;
+	}
+
+	obj_set_shared_changed();
+}
+
 int obj_get_total_farms(void)
 {
 	return total_farms;
@@ -552,7 +613,7 @@ char * obj_print_switch(int state)
 	}
 }
 
-int obj_set_attribute(struct config_pair *c, int actionable, int apply_action)
+static int obj_apply_attribute(struct config_pair *c, int actionable, int apply_action)
 {
 	int ret = 0;
 	int action = ACTION_NONE;
@@ -656,6 +717,21 @@ int obj_set_attribute(struct config_pair *c, int actionable, int apply_action)
 		return PARSER_STRUCT_FAILED;
 	}
 
+	if (ret == PARSER_OK)
+		obj_set_changed(c->level);
+
+	return ret;
+}
+
+int obj_set_attribute(struct config_pair *c, int actionable, int apply_action)
+{
+	struct stats_timer t;
+	int ret;
+
+	stats_phase_begin(&t, STATS_PHASE_APPLY);
+	ret = obj_apply_attribute(c, actionable, apply_action);
+	stats_phase_end(&t);
+
 	return ret;
 }
 
@@ -675,6 +751,22 @@ int obj_set_attribute_string(char *src, char **dst)
 	return 0;
 }
 
+/* the previous value, if any, must be an interned string as well */
+int obj_set_attribute_shared(char *src, char **dst)
+{
+	char *str = slab_str_get(src);
+
+	if (!str) {
+		tools_printlog(LOG_ERR, "Attribute memory allocation error");
+		return -1;
+	}
+
+	slab_str_put(*dst);
+	*dst = str;
+
+	return 0;
+}
+
 int obj_equ_attribute_string(char *stra, char *strb)
 {
 	return (stra == strb ||
@@ -700,6 +792,7 @@ void obj_print(void)
 
 int obj_rulerize(int mode)
 {
+	uint64_t start = stats_now();
 	int out = 0;
 	obj_config_init();
 	if (mode == OBJ_START_INV) {
@@ -711,6 +804,8 @@ int obj_rulerize(int mode)
 		out = out + address_s_rulerize();
 		out = out + farm_s_rulerize();
 	}
+	obj_new_generation();
+	stats_rulerize_done(stats_now() - start);
 	return out;
 }
 
@@ -777,10 +872,36 @@ int obj_recovery(void)
 	reload_err = obj_rulerize(OBJ_START);
 	if (!reload_err) {
 		tools_printlog(LOG_ERR, "nft recovered...");
+		stats_count(STATS_CNT_RECOVERY, 1);
 		cmdtry = 0;
 		return 1;
 	} else
 		tools_printlog(LOG_ERR, "recovery not successful...");
 
+	stats_count(STATS_CNT_RECOVERY_FAILED, 1);
+
+	return 0;
+}
+
+int obj_dump_metrics(struct sbuffer *buf)
+{
+	struct farm *f;
+	struct policy *p;
+	int backends = 0;
+	int elements = 0;
+
+	list_for_each_entry(f, &farms, list)
+		backends += f->total_bcks;
+
+	list_for_each_entry(p, &policies, list)
+		elements += p->total_elem;
+
+	stats_metric_header(buf, "nftlb_objects", "gauge", "Objects configured by type.");
+	concat_buf(buf, "nftlb_objects{type=\"farms\"} %d\n", total_farms);
+	concat_buf(buf, "nftlb_objects{type=\"backends\"} %d\n", backends);
+	concat_buf(buf, "nftlb_objects{type=\"addresses\"} %d\n", total_addresses);
+	concat_buf(buf, "nftlb_objects{type=\"policies\"} %d\n", total_policies);
+	concat_buf(buf, "nftlb_objects{type=\"elements\"} %d\n", elements);
+
 	return 0;
 }
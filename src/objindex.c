@@ -0,0 +1,120 @@
+/*
+ *   This file is part of nftlb, nftables load balancer.
+ *
+ *   Copyright (C) ZEVENET SL.
+ *   Author: Laura Garcia <laura.garcia@zevenet.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Affero General Public License as
+ *   published by the Free Software Foundation, either version 3 of the
+ *   License, or any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Affero General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Affero General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "objindex.h"
+#include "tools.h"
+
+#define OBJINDEX_MIN_SIZE	64
+
+static struct hlist_head objindex_empty;
+
+unsigned int objindex_hash_str(const char *key, unsigned int seed)
+{
+	unsigned int h = 5381 ^ seed;
+
+	while (*key)
+		h = ((h << 5) + h) + (unsigned char)*key++;
+
+	return h;
+}
+
+unsigned int objindex_hash_ptr(const void *ptr, unsigned int seed)
+{
+	uint64_t h = (uintptr_t)ptr ^ seed;
+
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+
+	return (unsigned int)h;
+}
+
+static int objindex_resize(struct objindex *idx, unsigned int size)
+{
+	struct hlist_head *buckets;
+	struct hlist_node *pos, *next;
+	struct objindex_node *n;
+	unsigned int i;
+
+	buckets = (struct hlist_head *)calloc(size, sizeof(struct hlist_head));
+	if (!buckets)
+		return -1;
+
+	for (i = 0; i < idx->size; i++) {
+		hlist_for_each_safe(pos, next, &idx->buckets[i]) {
+			n = hlist_entry(pos, struct objindex_node, node);
+			hlist_add_head(&n->node, &buckets[n->hash & (size - 1)]);
+		}
+	}
+
+	free(idx->buckets);
+	idx->buckets = buckets;
+	idx->size = size;
+
+	return 0;
+}
+
+int objindex_add(struct objindex *idx, struct objindex_node *n, unsigned int hash)
+{
+	if (!idx->size && objindex_resize(idx, OBJINDEX_MIN_SIZE)) {
+		tools_printlog(LOG_ERR, "%s():%d: index memory allocation error", __FUNCTION__, __LINE__);
+		return -1;
+	}
+
+	/* a failed growth only makes the chains longer */
+	if (idx->count >= idx->size)
+		objindex_resize(idx, idx->size * 2);
+
+	n->hash = hash;
+	hlist_add_head(&n->node, &idx->buckets[hash & (idx->size - 1)]);
+	idx->count++;
+
+	return 0;
+}
+
+void objindex_del(struct objindex *idx, struct objindex_node *n)
+{
+	if (hlist_unhashed(&n->node))
+		return;
+
+	hlist_del_init(&n->node);
+	idx->count--;
+}
+
+struct hlist_head *objindex_bucket(struct objindex *idx, unsigned int hash)
+{
+	if (!idx->size)
+		return &objindex_empty;
+
+	return &idx->buckets[hash & (idx->size - 1)];
+}
+
+/* the entries are owned by the caller, only the buckets are released */
+void objindex_free(struct objindex *idx)
+{
+	free(idx->buckets);
+	idx->buckets = NULL;
+	idx->size = 0;
+	idx->count = 0;
+}
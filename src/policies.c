@@ -30,11 +30,23 @@
 #include "nft.h"
 #include "tools.h"
 
+static SLAB_POOL(policies_pool, "policies", struct policy);
+
+static struct objindex policies_index;
+
+/* policies with an action pending, the only ones to be rulerized */
+static LIST_HEAD(policies_dirty);
+
+static unsigned int policy_hash(const char *name)
+{
+	return objindex_hash_str(name, 0);
+}
+
 static struct policy * policy_create(char *name)
 {
 	struct list_head *policies = obj_get_policies();
 
-	struct policy *p = (struct policy *)malloc(sizeof(struct policy));
+	struct policy *p = (struct policy *)slab_alloc(&policies_pool);
 	if (!p) {
 		tools_printlog(LOG_ERR, "Policy memory allocation error");
 		return NULL;
@@ -42,13 +54,22 @@ static struct policy * policy_create(char *name)
 
 	obj_set_attribute_string(name, &p->name);
 
+	if (objindex_add(&policies_index, &p->hnode, policy_hash(name))) {
+		free(p->name);
+		slab_free(&policies_pool, p);
+		return NULL;
+	}
+
 	p->type = DEFAULT_POLICY_TYPE;
 	p->route = DEFAULT_POLICY_ROUTE;
 	p->family = DEFAULT_FAMILY;
 	p->timeout = DEFAULT_POLICY_TIMEOUT;
 	p->used = 0;
-	p->logprefix = DEFAULT_POLICY_LOGPREFIX;
+	p->logprefix = slab_str_get(DEFAULT_POLICY_LOGPREFIX);
 	p->action = DEFAULT_ACTION;
+	p->generation = obj_new_generation();
+	init_list_head(&p->dirty);
+	policy_set_dirty(p);
 
 	init_list_head(&p->elements);
 
@@ -66,13 +87,17 @@ static int policy_delete(struct policy *p)
 		return 0;
 
 	list_del(&p->list);
+	list_del(&p->dirty);
+	objindex_del(&policies_index, &p->hnode);
 
 	if (p->name)
 		free(p->name);
-	if (p->logprefix && strcmp(p->logprefix, DEFAULT_POLICY_LOGPREFIX) != 0)
-		free(p->logprefix);
+	slab_str_put(p->logprefix);
+
+	if (obj_get_current_policy() == p)
+		obj_set_current_policy(NULL);
 
-	free(p);
+	slab_free(&policies_pool, p);
 	obj_set_total_policies(obj_get_total_policies() - 1);
 
 	return 0;
@@ -145,11 +170,12 @@ void policies_s_print(void)
 
 struct policy * policy_lookup_by_name(const char *name)
 {
-	struct list_head *policies = obj_get_policies();
+	unsigned int hash = policy_hash(name);
+	struct hlist_node *pos;
 	struct policy *p;
 
-	list_for_each_entry(p, policies, list) {
-		if (strcmp(p->name, name) == 0)
+	hlist_for_each_entry(p, pos, objindex_bucket(&policies_index, hash), hnode.node) {
+		if (p->hnode.hash == hash && strcmp(p->name, name) == 0)
 			return p;
 	}
 
@@ -224,9 +250,7 @@ int policy_set_attribute(struct config_pair *c)
 		policy_set_action(p, c->int_value);
 		break;
 	case KEY_LOGPREFIX:
-		if (strcmp(p->logprefix, DEFAULT_POLICY_LOGPREFIX) != 0)
-			free(p->logprefix);
-		obj_set_attribute_string(c->str_value, &p->logprefix);
+		obj_set_attribute_shared(c->str_value, &p->logprefix);
 		break;
 	case KEY_USED:
 		break;
@@ -256,6 +280,7 @@ int policy_set_action(struct policy *p, int action)
 	}
 
 	p->action = action;
+	policy_set_dirty(p);
 
 	return 1;
 }
@@ -342,17 +367,31 @@ int policy_rulerize(struct policy *p)
 	return ret;
 }
 
+void policy_set_dirty(struct policy *p)
+{
+	if (list_empty(&p->dirty))
+		list_add_tail(&p->dirty, &policies_dirty);
+}
+
+void policy_set_changed(struct policy *p)
+{
+	p->generation = obj_new_generation();
+}
+
 int policy_s_rulerize(void)
 {
 	struct policy *p;
 	int ret = 0;
 	int output = 0;
+	LIST_HEAD(dirty);
 
 	tools_printlog(LOG_DEBUG, "%s():%d: rulerize all policies", __FUNCTION__, __LINE__);
 
-	struct list_head *policies = obj_get_policies();
+	list_splice_init(&policies_dirty, &dirty);
 
-	list_for_each_entry(p, policies, list) {
+	while (!list_empty(&dirty)) {
+		p = list_first_entry(&dirty, struct policy, dirty);
+		list_del_init(&p->dirty);
 		ret = policy_rulerize(p);
 		output = output || ret;
 	}
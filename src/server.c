@@ -21,6 +21,10 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <limits.h>
+#include <errno.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <ev.h>
@@ -29,20 +33,36 @@
 #include <netdb.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 
 #include "server.h"
 #include "config.h"
 #include "nft.h"
 #include "events.h"
 #include "sbuffer.h"
+#include "list.h"
 #include "tools.h"
+#include "notify.h"
+#include "stats.h"
+#include "slab.h"
 
 #define SRV_MAX_BUF				1024
-#define SRV_MAX_HEADER			300
+#define SRV_MAX_HEADER			512
 #define SRV_MAX_IDENT			200
 #define SRV_KEY_LENGTH			16
 
 #define SRV_PORT_DEF			"5555"
+#define SRV_MAX_COMMIT_WINDOW	1000
+#define SRV_MAX_REQ_HEADER		8192
+#define SRV_CHUNK_SIZE			16384
+#define SRV_EVENTS_PATH			"events"
+#define SRV_STATS_PATH			"stats"
+#define SRV_METRICS_PATH		"metrics"
+#define SRV_MAX_ETAG			32
+#define SRV_CACHE_ENTRIES		32
+#define SRV_CACHE_MAX_BODY		(1024 * 1024)
+#define SRV_MAX_SENDQ			(1024 * 1024)
 
 #define STR_GET_ACTION			"GET"
 #define STR_POST_ACTION			"POST"
@@ -54,6 +74,19 @@
 #define HTTP_LINE_END			"\r\n"
 #define HTTP_HEADER_CONTENTLEN		"Content-Length: "
 #define HTTP_HEADER_KEY			"Key: "
+#define HTTP_HEADER_CONNECTION		"Connection: "
+#define HTTP_HEADER_EXPECT		"Expect: "
+#define HTTP_HEADER_ETAG		"ETag: "
+#define HTTP_HEADER_IFNONEMATCH		"If-None-Match: "
+#define HTTP_HEADER_TIMING		"Server-Timing: "
+#define HTTP_HEADER_CONTENTTYPE		"Content-Type: "
+#define HTTP_CONTENT_METRICS		"text/plain; version=0.0.4"
+#define HTTP_HEADER_CHUNKED		"Transfer-Encoding: chunked"
+#define HTTP_HEADER_EVENTS		"Content-Type: text/event-stream" HTTP_LINE_END \
+					"Cache-Control: no-cache"
+#define HTTP_QUERY_COMPACT		"compact"
+#define HTTP_HEADER_END			HTTP_LINE_END HTTP_LINE_END
+#define HTTP_CONTINUE			HTTP_PROTO "100 Continue" HTTP_HEADER_END
 
 extern struct ev_io *srv_accept;
 
@@ -63,6 +96,7 @@ enum ws_methods {
 	WS_PUT_ACTION,
 	WS_DELETE_ACTION,
 	WS_PATCH_ACTION,
+	WS_UNKNOWN_ACTION,
 };
 
 enum ws_responses {
@@ -71,14 +105,64 @@ enum ws_responses {
 	WS_HTTP_401,	// unauthorized
 	WS_HTTP_404,	// not found
 	WS_HTTP_200,	// ok
+	WS_HTTP_304,	// not modified
+};
+
+static const int ws_http_codes[] = {
+	500,
+	400,
+	401,
+	404,
+	200,
+	304,
+};
+
+enum http_parse {
+	HTTP_PARSE_REQUEST,	// waiting for the request line
+	HTTP_PARSE_HEADERS,	// waiting for the end of the headers
+	HTTP_PARSE_BODY,	// waiting for the rest of the body
+};
+
+/*
+ * Data for a client is sent without blocking the daemon. Whatever the
+ * socket doesn't take is queued, and sent from the write watcher as the
+ * client reads it, in order with anything sent afterwards. The dumps
+ * streamed can't wait for the client, so a client that lets more than
+ * SRV_MAX_SENDQ pile up is dropped.
+ */
+struct nftlb_sendq {
+	struct ev_io		io;
+	struct sbuffer		buf;
+	int			sent;
+	int			dropped;
 };
 
 struct nftlb_http_state {
+	enum http_parse		parse;
+	int			parsed;
+	int			contlength;
+	int			authorized;
+	int			expect;
 	enum ws_methods		method;
 	char			uri[SRV_MAX_IDENT];
 	char			*body;
 	enum ws_responses	status_code;
 	char			*body_response;
+	int			deferred;
+	char			message[SRV_MAX_IDENT];
+	char			*output;
+	int			keepalive;
+	int			chunked;
+	int			compact;
+	int			streamed;
+	int			subscribe;
+	unsigned long		generation;
+	char			etag[SRV_MAX_ETAG];
+	char			match[SRV_MAX_IDENT];
+	const char		*content_type;
+	struct stats_request	timing;
+	uint64_t		parked;
+	struct nftlb_sendq	*sendq;
 };
 
 static const char *ws_str_responses[] = {
@@ -87,6 +171,7 @@ static const char *ws_str_responses[] = {
 	HTTP_PROTO "401 Unauthorized" HTTP_LINE_END,
 	HTTP_PROTO "404 Not Found" HTTP_LINE_END,
 	HTTP_PROTO "200 OK" HTTP_LINE_END,
+	HTTP_PROTO "304 Not Modified" HTTP_LINE_END,
 };
 
 struct nftlb_server {
@@ -95,12 +180,24 @@ struct nftlb_server {
 	char			*host;
 	char			*port;
 	int			sd;
+	char			*unix_path;
+	int			unix_sd;
+	char			*line_port;
+	int			line_sd;
+	int			commit_window;
+	int			timing;
 };
 
 static struct nftlb_server nftserver = {
 	.family	= AF_INET,
 	.host	= NULL,
 	.port	= NULL,
+	.unix_path	= NULL,
+	.unix_sd	= -1,
+	.line_port	= NULL,
+	.line_sd	= -1,
+	.commit_window	= 0,
+	.timing		= 0,
 };
 
 static int parse_to_http_status(int code)
@@ -125,107 +222,179 @@ static int auth_key(const char *recvkey)
 	return (strcmp(nftserver.key, recvkey) == 0);
 }
 
-static int get_request(int fd, struct sbuffer *buf, struct nftlb_http_state *state)
+static int http_parse_request_line(struct nftlb_http_state *state, char *line)
 {
 	char method[SRV_MAX_IDENT] = {0};
-	char strkey[SRV_MAX_IDENT] = {0};
-	int contlength = 0;
-	int times = 0;
-	int total_read_size = 0;
-	char *ptr;
-	int size;
-	int head;
-	int bytes_left;
-	int cont_100 = 0;
-
-	if ((ptr = strstr(get_buf_data(buf), "Key: ")) == NULL) {
-		state->status_code = WS_HTTP_401;
-		return -1;
-	}
+	char version[SRV_MAX_IDENT] = {0};
 
-	sscanf(ptr, "Key: %199[^\r\n]", strkey);
+	char *query, *param;
 
-	if (!auth_key(strkey)) {
-		state->status_code = WS_HTTP_401;
+	if (sscanf(line, "%199[^ ] %199[^ ] %199s", method, state->uri, version) != 3)
 		return -1;
-	}
 
-	sscanf(get_buf_data(buf), "%199[^ ] %199[^ ] ", method, state->uri);
+	query = strchr(state->uri, '?');
+	if (query) {
+		*query++ = '\0';
+		for (param = strtok(query, "&"); param; param = strtok(NULL, "&")) {
+			if (strcmp(param, HTTP_QUERY_COMPACT) == 0 ||
+			    strcmp(param, HTTP_QUERY_COMPACT "=1") == 0 ||
+			    strcmp(param, HTTP_QUERY_COMPACT "=true") == 0)
+				state->compact = 1;
+		}
+	}
 
 	tools_printlog(LOG_NOTICE, "%s():%d: request: %s %s", __FUNCTION__, __LINE__, method, state->uri);
 
-	if (strncmp(method, STR_GET_ACTION, 4) == 0) {
+	if (strcmp(method, STR_GET_ACTION) == 0)
 		state->method = WS_GET_ACTION;
-	} else if (strncmp(method, STR_POST_ACTION, 5) == 0) {
+	else if (strcmp(method, STR_POST_ACTION) == 0)
 		state->method = WS_POST_ACTION;
-	} else if (strncmp(method, STR_PUT_ACTION, 4) == 0) {
+	else if (strcmp(method, STR_PUT_ACTION) == 0)
 		state->method = WS_PUT_ACTION;
-	} else if (strncmp(method, STR_DELETE_ACTION, 7) == 0) {
+	else if (strcmp(method, STR_DELETE_ACTION) == 0)
 		state->method = WS_DELETE_ACTION;
-	} else if (strncmp(method, STR_PATCH_ACTION, 6) == 0) {
+	else if (strcmp(method, STR_PATCH_ACTION) == 0)
 		state->method = WS_PATCH_ACTION;
-	} else {
-		state->status_code = parse_to_http_status(PARSER_STRUCT_FAILED);
-		return -1;
-	}
+	else
+		state->method = WS_UNKNOWN_ACTION;
 
-	if (state->method == WS_GET_ACTION)
-		return 0;
+	state->keepalive = (strcmp(version, "HTTP/1.0") != 0);
+	state->chunked = state->keepalive;
 
-	state->body = strstr(get_buf_data(buf), "\r\n\r\n");
-	if (!state->body) {
-		tools_printlog(LOG_ERR, "Not found body section in the request");
-		state->status_code = parse_to_http_status(PARSER_STRUCT_FAILED);
+	return 0;
+}
+
+static int http_parse_header(struct nftlb_http_state *state, char *line)
+{
+	char *value = strchr(line, ':');
+	char *end;
+	long len;
+
+	if (!value)
 		return -1;
-	}
-	state->body += 4;
-	head = state->body - get_buf_data(buf);
 
-	if ((ptr = strstr(get_buf_data(buf), "Expect: 100-continue")) != NULL) {
-		cont_100 = 1;
-		send(fd, "HTTP/1.1 100 Continue\r\n\r\n", 25, 0);
+	for (value++; *value == ' ' || *value == '\t'; value++);
+
+	if (strncasecmp(line, HTTP_HEADER_CONTENTLEN, strlen(HTTP_HEADER_CONTENTLEN) - 1) == 0) {
+		len = strtol(value, &end, 10);
+		if (end == value || len < 0 || len > INT_MAX - SRV_MAX_REQ_HEADER)
+			return -1;
+		state->contlength = len;
+	} else if (strncasecmp(line, HTTP_HEADER_KEY, strlen(HTTP_HEADER_KEY) - 1) == 0) {
+		state->authorized = auth_key(value);
+	} else if (strncasecmp(line, HTTP_HEADER_CONNECTION, strlen(HTTP_HEADER_CONNECTION) - 1) == 0) {
+		if (strcasecmp(value, "close") == 0)
+			state->keepalive = 0;
+		else if (strcasecmp(value, "keep-alive") == 0)
+			state->keepalive = 1;
+	} else if (strncasecmp(line, HTTP_HEADER_EXPECT, strlen(HTTP_HEADER_EXPECT) - 1) == 0) {
+		state->expect = (strcasecmp(value, "100-continue") == 0);
+	} else if (strncasecmp(line, HTTP_HEADER_IFNONEMATCH, strlen(HTTP_HEADER_IFNONEMATCH) - 1) == 0) {
+		snprintf(state->match, SRV_MAX_IDENT, "%s", value);
 	}
 
-	if ((ptr = strstr(get_buf_data(buf), "Content-Length: ")) != NULL) {
-		sscanf(ptr, "Content-Length: %i[^\r\n]", &contlength);
+	return 0;
+}
 
-		if (head + contlength >= get_buf_size(buf))
-			times = ((head + contlength - get_buf_size(buf)) / EXTRA_SIZE) + 1;
-		if (times == 0)
-			goto receive;
+static int nftlb_sendq_write(struct nftlb_sendq *q, const char *data, int len);
 
-		if (resize_buf(buf, times)) {
-			tools_printlog(LOG_ERR, "Error resizing the buffer %d times from a size of %d!", times, get_buf_size(buf));
-			state->status_code = WS_HTTP_500;
-			return -1;
+/*
+ * Parse the request at the beginning of the buffer as it is received,
+ * every line is only looked at once. It returns the length of the
+ * request, headers and body, once it is complete, 0 if more data is
+ * needed or -1 on error. Pipelined requests can follow it.
+ */
+static int get_request(struct sbuffer *buf, struct nftlb_http_state *state)
+{
+	char *line, *end;
+	int times;
+
+	while (state->parse != HTTP_PARSE_BODY) {
+		line = get_buf_data(buf) + state->parsed;
+		end = strstr(line, HTTP_LINE_END);
+		if (!end) {
+			if (buf->next > SRV_MAX_REQ_HEADER) {
+				tools_printlog(LOG_ERR, "%s():%d: request header too long", __FUNCTION__, __LINE__);
+				goto bad_request;
+			}
+			return 0;
 		}
+		*end = '\0';
+		state->parsed += end - line + strlen(HTTP_LINE_END);
+
+		if (state->parse == HTTP_PARSE_REQUEST) {
+			if (http_parse_request_line(state, line) < 0)
+				goto bad_request;
+			state->parse = HTTP_PARSE_HEADERS;
+		} else if (*line != '\0') {
+			if (http_parse_header(state, line) < 0)
+				goto bad_request;
+		} else
+			state->parse = HTTP_PARSE_BODY;
+
+		*end = '\r';
 	}
 
-receive:
-	state->body = get_buf_data(buf) + head;
-	total_read_size = get_buf_next(buf) - state->body;
-	while ((total_read_size < contlength) || cont_100) {
-		cont_100 = 0;
-		bytes_left = EXTRA_SIZE;
-		if (contlength - total_read_size < EXTRA_SIZE)
-			bytes_left = contlength - total_read_size;
-		if (bytes_left <= 0)
-			goto final;
-		size = recv(fd, get_buf_next(buf), bytes_left, 0);
-		if (size <= 0)
-			goto final;
-		buf->next += size;
-		total_read_size += size;
+	if (!state->authorized) {
+		state->status_code = WS_HTTP_401;
+		return -1;
 	}
 
-final:
-	concat_buf(buf, "\0");
+	if (state->method == WS_UNKNOWN_ACTION)
+		goto bad_request;
+
+	if (buf->next < state->parsed + state->contlength) {
+		/* make room for the whole body at once */
+		if (state->parsed + state->contlength >= get_buf_size(buf)) {
+			times = ((state->parsed + state->contlength - get_buf_size(buf)) / EXTRA_SIZE) + 1;
+			if (resize_buf(buf, times)) {
+				tools_printlog(LOG_ERR, "Error resizing the buffer %d times from a size of %d!", times, get_buf_size(buf));
+				state->status_code = WS_HTTP_500;
+				return -1;
+			}
+		}
 
-	return 0;
+		/* queued as any response, the body is read once it's sent */
+		if (state->expect) {
+			state->expect = 0;
+			if (nftlb_sendq_write(state->sendq, HTTP_CONTINUE, strlen(HTTP_CONTINUE))) {
+				state->status_code = WS_HTTP_500;
+				return -1;
+			}
+		}
+		return 0;
+	}
+
+	state->body = get_buf_data(buf) + state->parsed;
+
+	return state->parsed + state->contlength;
+
+bad_request:
+	state->status_code = parse_to_http_status(PARSER_STRUCT_FAILED);
+	return -1;
 }
 
 static int init_http_state(struct nftlb_http_state *state)
 {
+	state->deferred = 0;
+	state->output = NULL;
+	state->body = NULL;
+	state->keepalive = 0;
+	state->chunked = 0;
+	state->compact = 0;
+	state->streamed = 0;
+	state->subscribe = 0;
+	state->generation = 0;
+	state->etag[0] = '\0';
+	state->match[0] = '\0';
+	state->content_type = NULL;
+	state->parked = 0;
+	stats_request_init(&state->timing);
+	state->parse = HTTP_PARSE_REQUEST;
+	state->parsed = 0;
+	state->contlength = 0;
+	state->authorized = 0;
+	state->expect = 0;
 	state->body_response = malloc(SRV_MAX_BUF);
 	if (!state->body_response) {
 		state->status_code = parse_to_http_status(PARSER_STRUCT_FAILED);
@@ -239,9 +408,422 @@ static int fin_http_state(struct nftlb_http_state *state)
 {
 	if (state->body_response)
 		free(state->body_response);
+	if (state->output)
+		free(state->output);
+	state->body_response = NULL;
+	state->output = NULL;
+	return 0;
+}
+
+static int nftlb_sendq_pending(struct nftlb_sendq *q)
+{
+	return q->buf.data && q->sent < q->buf.next;
+}
+
+static int nftlb_sendq_queued(struct nftlb_sendq *q)
+{
+	return q->buf.data ? q->buf.next - q->sent : 0;
+}
+
+static void nftlb_sendq_clean(struct nftlb_sendq *q)
+{
+	if (q->buf.data)
+		clean_buf(&q->buf);
+	q->buf.data = NULL;
+	q->sent = 0;
+}
+
+/* Returns -1 only if the connection is broken. */
+static int nftlb_sendq_write(struct nftlb_sendq *q, const char *data, int len)
+{
+	ssize_t sent = 0;
+
+	if (!nftlb_sendq_pending(q)) {
+		sent = send(q->io.fd, data, len, MSG_DONTWAIT);
+		if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+			return -1;
+		if (sent == len)
+			return 0;
+		if (sent < 0)
+			sent = 0;
+		if (q->buf.data)
+			reset_buf(&q->buf);
+		q->sent = 0;
+	}
+
+	if (!q->buf.data && create_buf(&q->buf)) {
+		q->buf.data = NULL;
+		return -1;
+	}
+
+	if (concat_buf(&q->buf, "%.*s", len - (int)sent, data + sent))
+		return -1;
+
+	ev_io_start(get_loop(), &q->io);
+
+	return 0;
+}
+
+/*
+ * Rulerize the changes applied by the current request. If a commit window
+ * is configured, the request is parked instead and answered once the
+ * pending changes of every request in the window are committed together.
+ */
+static int commit_request(struct nftlb_http_state *state, char *message)
+{
+	if (nftserver.commit_window) {
+		snprintf(state->message, SRV_MAX_IDENT, "%s", message);
+		state->output = strdup(config_get_output());
+		config_delete_output();
+		state->deferred = 1;
+		return PARSER_OK;
+	}
+
+	if (obj_rulerize(OBJ_START)) {
+		snprintf(message, SRV_MAX_IDENT, "%s", "error generating rules");
+		return PARSER_FAILED;
+	}
+
+	return PARSER_OK;
+}
+
+static char *http_etag_header(struct nftlb_http_state *state, char *buf)
+{
+	buf[0] = '\0';
+	if (state->etag[0] != '\0')
+		sprintf(buf, "%s%s%s", HTTP_HEADER_ETAG, state->etag, HTTP_LINE_END);
+
+	return buf;
+}
+
+static char *http_content_header(struct nftlb_http_state *state, char *buf)
+{
+	buf[0] = '\0';
+	if (state->content_type)
+		sprintf(buf, "%s%s%s", HTTP_HEADER_CONTENTTYPE, state->content_type, HTTP_LINE_END);
+
+	return buf;
+}
+
+static const char *ws_str_methods[] = {
+	STR_GET_ACTION,
+	STR_POST_ACTION,
+	STR_PUT_ACTION,
+	STR_DELETE_ACTION,
+	STR_PATCH_ACTION,
+	"UNKNOWN",
+};
+
+/* requests are accounted by method and first level of the URI */
+static void nftlb_http_timing_done(struct nftlb_http_state *state)
+{
+	char level[SRV_MAX_IDENT] = {0};
+	char endpoint[SRV_MAX_IDENT];
+
+	if (state->parked) {
+		state->timing.phase[STATS_PHASE_COMMIT] += stats_now() - state->parked;
+		state->parked = 0;
+	}
+
+	sscanf(state->uri, "/%199[^/]", level);
+	if (strcmp(level, CONFIG_KEY_FARMS) != 0 &&
+	    strcmp(level, CONFIG_KEY_POLICIES) != 0 &&
+	    strcmp(level, CONFIG_KEY_ADDRESSES) != 0 &&
+	    strcmp(level, SRV_EVENTS_PATH) != 0 &&
+	    strcmp(level, SRV_STATS_PATH) != 0 &&
+	    strcmp(level, SRV_METRICS_PATH) != 0)
+		snprintf(level, SRV_MAX_IDENT, "%s", "other");
+
+	snprintf(endpoint, SRV_MAX_IDENT, "%s /%s", ws_str_methods[state->method], level);
+	stats_request_done(&state->timing, endpoint);
+	stats_http_response(ws_http_codes[state->status_code]);
+}
+
+static char *http_timing_header(struct nftlb_http_state *state, char *buf)
+{
+	int phase, len;
+
+	buf[0] = '\0';
+	if (!nftserver.timing)
+		return buf;
+
+	len = sprintf(buf, "%s", HTTP_HEADER_TIMING);
+	for (phase = 0; phase < STATS_PHASE_MAX; phase++) {
+		if (!state->timing.phase[phase] && phase != STATS_PHASE_TOTAL)
+			continue;
+		len += sprintf(buf + len, "%s;dur=%.3f%s", stats_phase_name(phase),
+			       state->timing.phase[phase] / 1000000.,
+			       phase == STATS_PHASE_TOTAL ? "" : ", ");
+	}
+	sprintf(buf + len, "%s", HTTP_LINE_END);
+
+	return buf;
+}
+
+/* responses of GET requests, valid for the generation they were built in */
+struct nftlb_cache {
+	struct list_head	list;
+	char			uri[SRV_MAX_IDENT];
+	int			compact;
+	unsigned long		generation;
+	char			*body;
+};
+
+static LIST_HEAD(get_cache);
+static int get_cache_entries;
+
+static void nftlb_cache_delete(struct nftlb_cache *entry)
+{
+	list_del(&entry->list);
+	free(entry->body);
+	free(entry);
+	get_cache_entries--;
+}
+
+static struct nftlb_cache *nftlb_cache_lookup(struct nftlb_http_state *state)
+{
+	struct nftlb_cache *entry;
+
+	list_for_each_entry(entry, &get_cache, list) {
+		if (entry->compact != state->compact || strcmp(entry->uri, state->uri) != 0)
+			continue;
+
+		if (entry->generation != state->generation) {
+			nftlb_cache_delete(entry);
+			return NULL;
+		}
+
+		/* the most recently used are kept first */
+		list_del(&entry->list);
+		list_add(&entry->list, &get_cache);
+		return entry;
+	}
+
+	return NULL;
+}
+
+static void nftlb_cache_store(struct nftlb_http_state *state, const char *body)
+{
+	struct nftlb_cache *entry;
+
+	if (!state->generation)
+		return;
+
+	entry = malloc(sizeof(struct nftlb_cache));
+	if (!entry)
+		return;
+
+	entry->body = strdup(body);
+	if (!entry->body) {
+		free(entry);
+		return;
+	}
+
+	snprintf(entry->uri, SRV_MAX_IDENT, "%s", state->uri);
+	entry->compact = state->compact;
+	entry->generation = state->generation;
+
+	list_add(&entry->list, &get_cache);
+	get_cache_entries++;
+
+	if (get_cache_entries > SRV_CACHE_ENTRIES)
+		nftlb_cache_delete(list_entry(get_cache.prev, struct nftlb_cache, list));
+}
+
+static void nftlb_cache_fini(void)
+{
+	struct nftlb_cache *entry, *next;
+
+	list_for_each_entry_safe(entry, next, &get_cache, list)
+		nftlb_cache_delete(entry);
+}
+
+/*
+ * Large dumps are sent with chunked encoding as they are generated, so the
+ * memory used is bounded by the chunk size. Responses fitting in a single
+ * chunk, or requested by HTTP/1.0 clients, are sent as usual.
+ */
+struct nftlb_http_stream {
+	struct nftlb_http_state	*state;
+	struct sbuffer		buf;
+	struct sbuffer		cache;
+	int			started;
+};
+
+static int nftlb_http_stream_flush(struct nftlb_http_stream *st)
+{
+	char header[SRV_MAX_HEADER];
+	char etag[SRV_MAX_HEADER];
+	int len;
+
+	if (!st->started) {
+		sprintf(header, "%s%s%s%s%s%s%s%s", ws_str_responses[WS_HTTP_200],
+			HTTP_HEADER_CHUNKED, HTTP_LINE_END,
+			http_etag_header(st->state, etag),
+			HTTP_HEADER_CONNECTION, st->state->keepalive ? "keep-alive" : "close",
+			HTTP_LINE_END, HTTP_LINE_END);
+		if (nftlb_sendq_write(st->state->sendq, header, strlen(header)))
+			return -1;
+		st->started = 1;
+	}
+
+	if (st->buf.next == 0)
+		return 0;
+
+	if (nftlb_sendq_queued(st->state->sendq) > SRV_MAX_SENDQ) {
+		tools_printlog(LOG_INFO, "%s():%d: dropping a client that doesn't read the dump", __FUNCTION__, __LINE__);
+		st->state->sendq->dropped = 1;
+		return -1;
+	}
+
+	/* keep a copy of the chunks sent for the cache, if it's not too big */
+	if (st->cache.data &&
+	    (st->cache.next + st->buf.next > SRV_CACHE_MAX_BODY ||
+	     concat_buf(&st->cache, "%.*s", st->buf.next, get_buf_data(&st->buf)))) {
+		clean_buf(&st->cache);
+		st->cache.data = NULL;
+	}
+
+	len = sprintf(header, "%x%s", st->buf.next, HTTP_LINE_END);
+	if (nftlb_sendq_write(st->state->sendq, header, len) ||
+	    nftlb_sendq_write(st->state->sendq, get_buf_data(&st->buf), st->buf.next) ||
+	    nftlb_sendq_write(st->state->sendq, HTTP_LINE_END, strlen(HTTP_LINE_END)))
+		return -1;
+
+	reset_buf(&st->buf);
+
+	return 0;
+}
+
+static int nftlb_http_stream_write(void *data, const char *buf, size_t len)
+{
+	struct nftlb_http_stream *st = (struct nftlb_http_stream *)data;
+
+	if (concat_buf(&st->buf, "%.*s", (int)len, buf))
+		return -1;
+
+	if (st->state->chunked && st->buf.next >= SRV_CHUNK_SIZE)
+		return nftlb_http_stream_flush(st);
+
+	return 0;
+}
+
+static int send_get_stream(struct nftlb_http_state *state,
+			   int (*dump)(config_writer, void *, int, char *), char *name)
+{
+	struct nftlb_http_stream st = { .state = state, .started = 0 };
+	int ret;
+
+	if (create_buf(&st.buf))
+		return PARSER_FAILED;
+
+	if (state->generation && create_buf(&st.cache))
+		st.cache.data = NULL;
+
+	ret = dump(nftlb_http_stream_write, &st, state->compact ? CONFIG_DUMP_COMPACT : 0, name);
+
+	if (!st.started) {
+		if (ret == 0) {
+			free(state->body_response);
+			state->body_response = get_buf_data(&st.buf);
+			if (state->generation)
+				nftlb_cache_store(state, state->body_response);
+		} else
+			clean_buf(&st.buf);
+		if (st.cache.data)
+			clean_buf(&st.cache);
+		return ret;
+	}
+
+	/* the client can only learn about a failure by the connection closed */
+	if (ret || nftlb_http_stream_flush(&st) ||
+	    nftlb_sendq_write(state->sendq, "0" HTTP_HEADER_END, 5))
+		state->keepalive = 0;
+	else if (st.cache.data)
+		nftlb_cache_store(state, get_buf_data(&st.cache));
+
+	if (st.cache.data)
+		clean_buf(&st.cache);
+
+	state->streamed = 1;
+	clean_buf(&st.buf);
+
+	return 0;
+}
+
+/*
+ * The listings built only from the configuration are identified by its
+ * generation, that is sent as the ETag. A client that already has it gets
+ * a 304 and the responses are cached, so several clients asking for the
+ * same listing in the same generation only build it once.
+ */
+static int send_get_cached(struct nftlb_http_state *state, unsigned long generation)
+{
+	struct nftlb_cache *entry;
+
+	if (!generation)
+		return -1;
+
+	state->generation = generation;
+	snprintf(state->etag, SRV_MAX_ETAG, "\"%lu%s\"", generation, state->compact ? "-c" : "");
+
+	if (strcmp(state->match, "*") == 0 || strstr(state->match, state->etag)) {
+		state->status_code = WS_HTTP_304;
+		state->body_response[0] = '\0';
+		return 0;
+	}
+
+	entry = nftlb_cache_lookup(state);
+	if (!entry)
+		return -1;
+
+	free(state->body_response);
+	state->body_response = strdup(entry->body);
+	if (!state->body_response)
+		return -1;
+
+	state->status_code = WS_HTTP_200;
 	return 0;
 }
 
+static int send_get_stats(struct nftlb_http_state *state)
+{
+	struct sbuffer buf;
+
+	if (create_buf(&buf))
+		return PARSER_FAILED;
+
+	stats_dump_latency(&buf);
+
+	free(state->body_response);
+	state->body_response = get_buf_data(&buf);
+
+	return PARSER_OK;
+}
+
+/*
+ * Scraped often, so the metrics are printed straight into the response
+ * instead of being built as json objects.
+ */
+static int send_get_metrics(struct nftlb_http_state *state)
+{
+	struct sbuffer buf;
+
+	if (create_buf(&buf))
+		return PARSER_FAILED;
+
+	obj_dump_metrics(&buf);
+	nft_dump_metrics(&buf);
+	slab_dump_metrics(&buf);
+	stats_dump_metrics(&buf);
+
+	free(state->body_response);
+	state->body_response = get_buf_data(&buf);
+	state->content_type = HTTP_CONTENT_METRICS;
+
+	return PARSER_OK;
+}
+
 static int send_get_response(struct nftlb_http_state *state)
 {
 	char firstlevel[SRV_MAX_IDENT] = {0};
@@ -256,18 +838,41 @@ static int send_get_response(struct nftlb_http_state *state)
 	if (strcmp(firstlevel, CONFIG_KEY_FARMS) == 0) {
 
 		if (strcmp(thirdlevel, CONFIG_KEY_SESSIONS) == 0)
-			ret = config_print_farm_sessions(&state->body_response, secondlevel);
-		else if (strcmp(thirdlevel, "") == 0)
-			ret = config_print_farms(&state->body_response, secondlevel);
+			ret = send_get_stream(state, config_dump_farm_sessions, secondlevel);
+		else if (strcmp(thirdlevel, "") == 0) {
+			if (send_get_cached(state, config_get_generation(secondlevel)) == 0)
+				return 0;
+			ret = send_get_stream(state, config_dump_farms, secondlevel);
+		}
 
-	} else if (strcmp(firstlevel, CONFIG_KEY_POLICIES) == 0)
-		ret = config_print_policies(&state->body_response, secondlevel);
+	} else if (strcmp(firstlevel, CONFIG_KEY_POLICIES) == 0) {
+		if (send_get_cached(state, config_get_policy_generation(secondlevel)) == 0)
+			return 0;
+		ret = send_get_stream(state, config_dump_policies, secondlevel);
+	}
 
-	else if (strcmp(firstlevel, CONFIG_KEY_ADDRESSES) == 0)
+	else if (strcmp(firstlevel, CONFIG_KEY_ADDRESSES) == 0) {
+		if (send_get_cached(state, config_get_generation(NULL)) == 0)
+			return 0;
 		ret = config_print_addresses(&state->body_response, secondlevel);
+		if (ret == 0)
+			nftlb_cache_store(state, state->body_response);
+	}
+
+	else if (strcmp(firstlevel, SRV_STATS_PATH) == 0 && strcmp(secondlevel, "") == 0)
+		ret = send_get_stats(state);
+
+	else if (strcmp(firstlevel, SRV_METRICS_PATH) == 0 && strcmp(secondlevel, "") == 0)
+		ret = send_get_metrics(state);
+
+	else if (strcmp(firstlevel, SRV_EVENTS_PATH) == 0 && strcmp(secondlevel, "") == 0) {
+		state->subscribe = 1;
+		ret = PARSER_OK;
+	}
 
 	state->status_code = parse_to_http_status(ret);
 	if (ret) {
+		state->etag[0] = '\0';
 		config_print_response(&state->body_response, "%s%s", "invalid request",
 							  config_get_output());
 		config_delete_output();
@@ -483,10 +1088,9 @@ static int send_post_response(struct nftlb_http_state *state)
 		goto post_end;
 	}
 
-	if (obj_rulerize(OBJ_START)) {
-		snprintf(message, SRV_MAX_IDENT, "%s", "error generating rules");
-		ret = PARSER_FAILED;
-	}
+	ret = commit_request(state, message);
+	if (state->deferred)
+		return 0;
 
 post_end:
 	config_print_response(&state->body_response, "%s%s", message, config_get_output());
@@ -496,53 +1100,121 @@ post_end:
 	return 0;
 }
 
-static int send_patch_response(struct nftlb_http_state *state)
+static int put_is_bulk_states(struct nftlb_http_state *state)
 {
 	char firstlevel[SRV_MAX_IDENT] = {0};
 	char secondlevel[SRV_MAX_IDENT] = {0};
-	char thirdlevel[SRV_MAX_IDENT] = {0};
-	char message[SRV_MAX_IDENT] = {0};
-	int ret = 0;
 
-	sscanf(state->uri, "/%199[^/]/%199[^/]/%199[^\n]",
-	       firstlevel, secondlevel, thirdlevel);
+	sscanf(state->uri, "/%199[^/]/%199[^\n]", firstlevel, secondlevel);
 
-	if ((strcmp(firstlevel, CONFIG_KEY_POLICIES) != 0) &&
-		(strcmp(thirdlevel, CONFIG_KEY_ELEMENTS) != 0)) {
-		snprintf(message, SRV_MAX_IDENT, "%s", "invalid request");
-		ret = PARSER_OBJ_UNKNOWN;
-		goto patch_end;
-	}
+	return strcmp(firstlevel, CONFIG_KEY_FARMS) == 0 &&
+		strcmp(secondlevel, CONFIG_KEY_STATES) == 0;
+}
 
-	if (config_check_policy(secondlevel) != PARSER_OK) {
-		snprintf(message, SRV_MAX_IDENT, "%s", "the object to modify is unknown");
-		ret = PARSER_OBJ_UNKNOWN;
-		goto patch_end;
-	}
+/*
+ * Bulk backend changes are applied and committed as a single transaction,
+ * answering with the result of every item. The changes pending in the
+ * commit window are committed before, see nftlb_client_process().
+ */
+static int send_put_response(struct nftlb_http_state *state)
+{
+	char message[SRV_MAX_IDENT] = {0};
+	char *output = NULL;
+	int error;
+	int ret;
 
-	snprintf(message, SRV_MAX_IDENT, "%s", "success");
-	ret = config_buffer(state->body, ACTION_START);
+	if (!put_is_bulk_states(state))
+		return send_post_response(state);
+
+	ret = config_set_backends_state(state->body, &output);
 	switch (ret) {
 	case PARSER_OK:
+	case PARSER_VALID_FAILED:
+		/* the items that failed are reported in the results */
 		break;
 	case PARSER_STRUCT_FAILED:
 		snprintf(message, SRV_MAX_IDENT, "%s", "the structure is invalid");
-		goto patch_end;
-	case PARSER_OBJ_UNKNOWN:
-		snprintf(message, SRV_MAX_IDENT, "%s", "the object to modify is unknown");
-		goto patch_end;
+		goto put_end;
 	default:
 		snprintf(message, SRV_MAX_IDENT, "%s", "error parsing buffer");
-		goto patch_end;
+		goto put_end;
 	}
 
-	config_set_policy_action(secondlevel, CONFIG_VALUE_ACTION_FLUSH);
-
-	if (obj_rulerize(OBJ_START)) {
+	nft_batch_begin();
+	error = obj_rulerize(OBJ_START);
+	if (nft_batch_commit() || error) {
 		snprintf(message, SRV_MAX_IDENT, "%s", "error generating rules");
 		ret = PARSER_FAILED;
+		goto put_end;
+	}
+
+	state->status_code = parse_to_http_status(ret);
+
+	if (strlen(output) < SRV_MAX_BUF) {
+		strcpy(state->body_response, output);
+		free(output);
+	} else {
+		free(state->body_response);
+		state->body_response = output;
+	}
+
+	return 0;
+
+put_end:
+	free(output);
+	config_print_response(&state->body_response, "%s%s", message, config_get_output());
+	config_delete_output();
+	state->status_code = parse_to_http_status(ret);
+
+	return 0;
+}
+
+static int send_patch_response(struct nftlb_http_state *state)
+{
+	char firstlevel[SRV_MAX_IDENT] = {0};
+	char secondlevel[SRV_MAX_IDENT] = {0};
+	char thirdlevel[SRV_MAX_IDENT] = {0};
+	char message[SRV_MAX_IDENT] = {0};
+	int ret = 0;
+
+	sscanf(state->uri, "/%199[^/]/%199[^/]/%199[^\n]",
+	       firstlevel, secondlevel, thirdlevel);
+
+	if ((strcmp(firstlevel, CONFIG_KEY_POLICIES) != 0) &&
+		(strcmp(thirdlevel, CONFIG_KEY_ELEMENTS) != 0)) {
+		snprintf(message, SRV_MAX_IDENT, "%s", "invalid request");
+		ret = PARSER_OBJ_UNKNOWN;
+		goto patch_end;
+	}
+
+	if (config_check_policy(secondlevel) != PARSER_OK) {
+		snprintf(message, SRV_MAX_IDENT, "%s", "the object to modify is unknown");
+		ret = PARSER_OBJ_UNKNOWN;
+		goto patch_end;
+	}
+
+	snprintf(message, SRV_MAX_IDENT, "%s", "success");
+	ret = config_buffer(state->body, ACTION_START);
+	switch (ret) {
+	case PARSER_OK:
+		break;
+	case PARSER_STRUCT_FAILED:
+		snprintf(message, SRV_MAX_IDENT, "%s", "the structure is invalid");
+		goto patch_end;
+	case PARSER_OBJ_UNKNOWN:
+		snprintf(message, SRV_MAX_IDENT, "%s", "the object to modify is unknown");
+		goto patch_end;
+	default:
+		snprintf(message, SRV_MAX_IDENT, "%s", "error parsing buffer");
+		goto patch_end;
 	}
 
+	config_set_policy_action(secondlevel, CONFIG_VALUE_ACTION_FLUSH);
+
+	ret = commit_request(state, message);
+	if (state->deferred)
+		return 0;
+
 patch_end:
 	config_print_response(&state->body_response, "%s%s", message, config_get_output());
 	config_delete_output();
@@ -557,8 +1229,9 @@ static int send_response(struct nftlb_http_state *state)
 	case WS_GET_ACTION:
 		return send_get_response(state);
 	case WS_POST_ACTION:
-	case WS_PUT_ACTION:
 		return send_post_response(state);
+	case WS_PUT_ACTION:
+		return send_put_response(state);
 	case WS_DELETE_ACTION:
 		return send_delete_response(state);
 	case WS_PATCH_ACTION:
@@ -570,13 +1243,36 @@ static int send_response(struct nftlb_http_state *state)
 
 /* If client doesn't send us anything in 30 seconds, close connection. */
 #define NFTLB_CLIENT_TIMEOUT	30
+/* Event stream subscribers get a comment line after 15 idle seconds. */
+#define NFTLB_EVENTS_PING	15
 
+/*
+ * Connections are persistent unless the client asks otherwise. The data
+ * received is kept in buf until every pipelined request in it is served,
+ * and state holds the request in progress, or the one waiting for its
+ * commit while the client is parked.
+ */
 struct nftlb_client {
 	struct ev_io		io;
 	struct ev_timer		timer;
 	struct sockaddr_storage	addr;
+	struct list_head	list;
+	struct sbuffer		buf;
+	struct nftlb_http_state	state;
+	int			line;
+	int			authorized;
+	int			events;
+	int			closing;
+	struct nftlb_sendq	sendq;
+	unsigned long		seq_first;
+	unsigned long		seq_last;
 };
 
+static LIST_HEAD(commit_clients);
+static LIST_HEAD(commit_waiting);
+static LIST_HEAD(event_clients);
+static unsigned long event_id;
+
 static char *nftlb_client_address(struct sockaddr_storage *addr, char *str)
 {
 	unsigned short port;
@@ -599,7 +1295,11 @@ static char *nftlb_client_address(struct sockaddr_storage *addr, char *str)
 			&(((struct sockaddr_in *)addr)->sin_addr), str, 
 			INET6_ADDRSTRLEN + 6),port);
 		break;
+	case AF_UNIX:
+		sprintf(str, "%s", "local");
+		break;
 	default:
+		str[0] = 0;
 		break;
 	}
 	return str;
@@ -608,75 +1308,607 @@ static char *nftlb_client_address(struct sockaddr_storage *addr, char *str)
 static void nftlb_client_release(struct ev_loop *loop, struct nftlb_client *cli)
 {
 	ev_io_stop(loop, &cli->io);
+	ev_io_stop(loop, &cli->sendq.io);
+	ev_timer_stop(loop, &cli->timer);
 	close(cli->io.fd);
+	fin_http_state(&cli->state);
+	clean_buf(&cli->buf);
+	nftlb_sendq_clean(&cli->sendq);
+
+	if (cli->events) {
+		list_del(&cli->list);
+		if (list_empty(&event_clients))
+			notify_set_handler(NULL);
+	}
+
 	free(cli);
 }
 
-static void nftlb_http_send_response(struct ev_io *io,
-				     struct nftlb_http_state *state, int size)
+/* Release the client once the queued data is sent. */
+static void nftlb_client_close(struct ev_loop *loop, struct nftlb_client *cli)
 {
-	char response[SRV_MAX_HEADER];
+	if (!nftlb_sendq_pending(&cli->sendq) || cli->sendq.dropped) {
+		nftlb_client_release(loop, cli);
+		return;
+	}
 
-	sprintf(response, "%s%s%d%s%s", ws_str_responses[state->status_code],
-		HTTP_HEADER_CONTENTLEN, size,
-		HTTP_LINE_END, HTTP_LINE_END);
-	send(io->fd, response, strlen(response), 0);
+	ev_io_stop(loop, &cli->io);
+	cli->closing = 1;
 }
 
-static void nftlb_read_cb(struct ev_loop *loop, struct ev_io *io, int revents)
+/*
+ * Subscribers of GET /events get the state changes as server-sent events.
+ * The socket is never allowed to block the daemon, so a subscriber that
+ * doesn't keep up is disconnected and has to fetch the state again.
+ */
+static int nftlb_events_send(struct nftlb_client *cli, const char *buf, int len)
+{
+	return (send(cli->io.fd, buf, len, MSG_DONTWAIT) == len) ? 0 : -1;
+}
+
+static void nftlb_events_notify(const char *event, const char *data)
 {
+	struct ev_loop *loop = get_loop();
+	struct nftlb_client *cli, *next;
 	struct sbuffer buf;
-	struct nftlb_http_state state;
-	struct nftlb_client *cli;
-	ssize_t size;
+
+	if (create_buf(&buf))
+		return;
+
+	concat_buf(&buf, "id: %lu\nevent: %s\ndata: %s\n\n", ++event_id, event, data);
+
+	list_for_each_entry_safe(cli, next, &event_clients, list) {
+		if (nftlb_events_send(cli, get_buf_data(&buf), buf.next) == 0)
+			continue;
+
+		tools_printlog(LOG_INFO, "%s():%d: dropping slow event subscriber", __FUNCTION__, __LINE__);
+		nftlb_client_release(loop, cli);
+	}
+
+	clean_buf(&buf);
+}
+
+static void nftlb_events_subscribe(struct ev_loop *loop, struct nftlb_client *cli)
+{
+	char header[SRV_MAX_HEADER];
+
+	sprintf(header, "%s%s%s%s%s%s", ws_str_responses[WS_HTTP_200],
+		HTTP_HEADER_EVENTS, HTTP_LINE_END,
+		HTTP_HEADER_CONNECTION, "keep-alive", HTTP_HEADER_END);
+
+	fin_http_state(&cli->state);
+
+	if (nftlb_events_send(cli, header, strlen(header))) {
+		nftlb_client_release(loop, cli);
+		return;
+	}
+
+	/* anything else sent by the subscriber is ignored */
+	reset_buf(&cli->buf);
+
+	cli->events = 1;
+	list_add_tail(&cli->list, &event_clients);
+	notify_set_handler(nftlb_events_notify);
+
+	ev_timer_stop(loop, &cli->timer);
+	ev_timer_set(&cli->timer, NFTLB_EVENTS_PING, NFTLB_EVENTS_PING);
+	ev_timer_start(loop, &cli->timer);
+}
+
+static void nftlb_http_send_response(struct nftlb_http_state *state, int size)
+{
+	char response[SRV_MAX_HEADER];
+	char timing[SRV_MAX_HEADER];
+	char etag[SRV_MAX_HEADER];
+	char content[SRV_MAX_HEADER];
+
+	sprintf(response, "%s%s%d%s%s%s%s%s%s%s%s", ws_str_responses[state->status_code],
+		HTTP_HEADER_CONTENTLEN, size, HTTP_LINE_END, http_content_header(state, content),
+		http_etag_header(state, etag), http_timing_header(state, timing),
+		HTTP_HEADER_CONNECTION, state->keepalive ? "keep-alive" : "close",
+		HTTP_LINE_END, HTTP_LINE_END);
+	nftlb_sendq_write(state->sendq, response, strlen(response));
+}
+
+/*
+ * Send the response of the current request. It returns -1 if the
+ * connection was closed afterwards.
+ */
+static int nftlb_client_reply(struct ev_loop *loop, struct nftlb_client *cli)
+{
 	char cli_address[INET6_ADDRSTRLEN + 6]; //max address length + port length
 
-	if (EV_ERROR & revents) {
-		tools_printlog(LOG_ERR, "Server got invalid event from client read");
+	if (!cli->line)
+		nftlb_http_timing_done(&cli->state);
+
+	if (cli->line) {
+		nftlb_sendq_write(&cli->sendq, cli->state.body_response, strlen(cli->state.body_response));
+	} else if (!cli->state.streamed) {
+		nftlb_http_send_response(&cli->state, strlen(cli->state.body_response));
+		nftlb_sendq_write(&cli->sendq, cli->state.body_response, strlen(cli->state.body_response));
+	}
+
+	fin_http_state(&cli->state);
+
+	if (cli->state.keepalive) {
+		/* the next requests wait until the client reads this response */
+		if (nftlb_sendq_pending(&cli->sendq))
+			ev_io_stop(loop, &cli->io);
+		return 0;
+	}
+
+	tools_printlog(LOG_DEBUG, "connection closed by server %s\n",
+				   nftlb_client_address(&cli->addr, cli_address));
+	nftlb_client_close(loop, cli);
+	return -1;
+}
+
+static void nftlb_client_process(struct ev_loop *loop, struct nftlb_client *cli);
+
+/* Serve the requests pipelined behind the one answered after its commit. */
+static void nftlb_client_resume(struct ev_loop *loop, struct nftlb_client *cli)
+{
+	if (nftlb_client_reply(loop, cli))
+		return;
+
+	ev_timer_again(loop, &cli->timer);
+	if (nftlb_sendq_pending(&cli->sendq))
+		return;
+
+	ev_io_start(loop, &cli->io);
+	nftlb_client_process(loop, cli);
+}
+
+/* The client reads the queued data, serve what it requested meanwhile. */
+static void nftlb_sendq_cb(struct ev_loop *loop, struct ev_io *io, int revents)
+{
+	struct nftlb_client *cli = container_of(io, struct nftlb_client, sendq.io);
+	struct nftlb_sendq *q = &cli->sendq;
+	ssize_t sent;
+
+	sent = send(io->fd, q->buf.data + q->sent, q->buf.next - q->sent, MSG_DONTWAIT);
+	if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return;
+
+	if (sent < 0) {
+		tools_printlog(LOG_DEBUG, "%s():%d: unable to send to the client: %s", __FUNCTION__, __LINE__, strerror(errno));
+		nftlb_client_release(loop, cli);
 		return;
 	}
-	cli = container_of(io, struct nftlb_client, io);
 
-	create_buf(&buf);
-	size = recv(io->fd, get_buf_data(&buf), DEFAULT_BUFFER_SIZE - 1, 0);
-	if (size < 0)
+	ev_timer_again(loop, &cli->timer);
+
+	q->sent += sent;
+	if (nftlb_sendq_pending(q))
 		return;
 
-	buf.next = size;
+	ev_io_stop(loop, io);
+	nftlb_sendq_clean(q);
 
-	if (size == 0) {
-		tools_printlog(LOG_DEBUG, "connection closed by client %s\n",
-					   nftlb_client_address(&cli->addr, cli_address));
-		goto end_no_state;
+	if (cli->closing) {
+		nftlb_client_release(loop, cli);
+		return;
 	}
 
-	if (init_http_state(&state))
-		goto end_no_state;
+	ev_io_start(loop, &cli->io);
+	nftlb_client_process(loop, cli);
+}
 
-	if (get_request(io->fd, &buf, &state) < 0) {
-		nftlb_http_send_response(io, &state, 0);
-		goto end;
+/*
+ * The nft scripts of a request are executed by the commit worker, so the
+ * response is held until the last one queued since seq is done.
+ */
+static void nftlb_commit_wait(struct ev_loop *loop, struct nftlb_client *cli, unsigned long seq)
+{
+	if (nft_get_commit_seq() == seq) {
+		nftlb_client_resume(loop, cli);
+		return;
 	}
 
-	if (send_response(&state) < 0) {
-		nftlb_http_send_response(io, &state, 0);
-		goto end;
+	cli->seq_first = seq + 1;
+	cli->seq_last = nft_get_commit_seq();
+	list_add_tail(&cli->list, &commit_waiting);
+}
+
+/*
+ * Line protocol: every command is answered with a line, "OK" or
+ * "ERR <reason>", once the changes of all the commands received in the
+ * same read are committed in a single transaction.
+ */
+#define LINE_CMD_AUTH			"AUTH"
+#define LINE_CMD_SET			"SET"
+#define LINE_CMD_QUIT			"QUIT"
+#define LINE_OK				"OK\n"
+#define LINE_AUTHORIZED			"OK authorized\n"
+#define LINE_BYE			"BYE\n"
+#define LINE_ERR			"ERR "
+#define LINE_ERR_COMMIT			LINE_ERR "error generating rules\n"
+
+/* the changes answered with a bare OK didn't reach the kernel */
+static void nftlb_line_failed(struct nftlb_client *cli)
+{
+	struct sbuffer out;
+	char *line, *next;
+
+	if (create_buf(&out))
+		return;
+
+	for (line = cli->state.body_response; *line; line = next) {
+		next = strchr(line, '\n');
+		next = next ? next + 1 : line + strlen(line);
+		if (strncmp(line, LINE_OK, strlen(LINE_OK)) == 0)
+			concat_buf(&out, "%s", LINE_ERR_COMMIT);
+		else
+			concat_buf(&out, "%.*s", (int)(next - line), line);
 	}
 
-	nftlb_http_send_response(io, &state, strlen(state.body_response));
-	send(io->fd, state.body_response, strlen(state.body_response), 0);
+	free(cli->state.body_response);
+	cli->state.body_response = get_buf_data(&out);
+}
 
-	tools_printlog(LOG_DEBUG, "connection closed by server %s\n",
-				   nftlb_client_address(&cli->addr, cli_address));
-end:
-	fin_http_state(&state);
-end_no_state:
-	clean_buf(&buf);
+static void nftlb_commit_done(unsigned long seq, int error)
+{
+	struct nftlb_client *cli, *next;
+	LIST_HEAD(waiting);
+
+	/* resumed clients can serve pipelined requests and wait again */
+	list_splice_init(&commit_waiting, &waiting);
+
+	list_for_each_entry_safe(cli, next, &waiting, list) {
+		list_del(&cli->list);
+
+		if (seq < cli->seq_first) {
+			list_add_tail(&cli->list, &commit_waiting);
+			continue;
+		}
+
+		if (error && seq <= cli->seq_last) {
+			if (cli->line)
+				nftlb_line_failed(cli);
+			else
+				config_print_response(&cli->state.body_response, "%s", "error generating rules");
+			cli->state.status_code = parse_to_http_status(PARSER_FAILED);
+		}
+
+		if (seq < cli->seq_last) {
+			list_add_tail(&cli->list, &commit_waiting);
+			continue;
+		}
+
+		nftlb_client_resume(get_loop(), cli);
+	}
+}
 
+static void nftlb_commit_run(struct ev_loop *loop)
+{
+	struct nftlb_client *cli, *next;
+	unsigned long seq;
+	int ret = PARSER_OK;
+	LIST_HEAD(clients);
+
+	/* without a commit window every request is rulerized on its own */
+	if (!nftserver.commit_window)
+		return;
+
+	ev_timer_stop(loop, events_get_commit());
+
+	if (list_empty(&commit_clients))
+		return;
+
+	list_splice_init(&commit_clients, &clients);
+
+	tools_printlog(LOG_DEBUG, "%s():%d: committing the pending requests", __FUNCTION__, __LINE__);
+
+	seq = nft_get_commit_seq();
+	nft_batch_begin();
+	if (obj_rulerize(OBJ_START))
+		ret = PARSER_FAILED;
+	if (nft_batch_commit())
+		ret = PARSER_FAILED;
+
+	list_for_each_entry_safe(cli, next, &clients, list) {
+		list_del(&cli->list);
+
+		if (ret != PARSER_OK)
+			snprintf(cli->state.message, SRV_MAX_IDENT, "%s", "error generating rules");
+
+		config_print_response(&cli->state.body_response, "%s%s", cli->state.message,
+							  cli->state.output ? cli->state.output : "");
+		cli->state.status_code = parse_to_http_status(ret);
+
+		nftlb_commit_wait(loop, cli, seq);
+	}
+}
+
+static void nftlb_commit_cb(struct ev_loop *loop, ev_timer *timer, int events)
+{
+	nftlb_commit_run(loop);
+}
+
+static void nftlb_client_park(struct ev_loop *loop, struct nftlb_client *cli)
+{
+	ev_io_stop(loop, &cli->io);
 	ev_timer_stop(loop, &cli->timer);
-	nftlb_client_release(loop, cli);
 
-	return;
+	cli->state.body = NULL;
+	cli->state.parked = stats_now();
+}
+
+static void nftlb_commit_defer(struct ev_loop *loop, struct nftlb_client *cli)
+{
+	struct ev_timer *commit = events_get_commit();
+
+	nftlb_client_park(loop, cli);
+	list_add_tail(&cli->list, &commit_clients);
+
+	if (!ev_is_active(commit)) {
+		ev_timer_set(commit, nftserver.commit_window / 1000., 0.);
+		ev_timer_start(loop, commit);
+	}
+}
+
+/* Drop the request already served from the client buffer. */
+static void nftlb_client_consume(struct nftlb_client *cli, int len)
+{
+	struct sbuffer *buf = &cli->buf;
+
+	memmove(buf->data, buf->data + len, buf->next - len + 1);
+	buf->next -= len;
+}
+
+static const char *nftlb_line_cmd(struct nftlb_client *cli, char *line,
+				  struct sbuffer *out, int *changes)
+{
+	char *cmd, *fname, *bname, *key, *value, *extra, *saveptr;
+	const char *err;
+
+	cmd = strtok_r(line, " \t", &saveptr);
+
+	if (strcmp(cmd, LINE_CMD_QUIT) == 0) {
+		cli->state.keepalive = 0;
+		concat_buf(out, "%s", LINE_BYE);
+		return NULL;
+	}
+
+	if (strcmp(cmd, LINE_CMD_AUTH) == 0) {
+		value = strtok_r(NULL, "", &saveptr);
+		cli->authorized = (value && auth_key(value));
+		if (!cli->authorized)
+			return "unauthorized";
+		concat_buf(out, "%s", LINE_AUTHORIZED);
+		return NULL;
+	}
+
+	if (!cli->authorized)
+		return "unauthorized";
+
+	if (strcmp(cmd, LINE_CMD_SET) != 0)
+		return "unknown command";
+
+	fname = strtok_r(NULL, " \t", &saveptr);
+	bname = strtok_r(NULL, " \t", &saveptr);
+	key = strtok_r(NULL, " \t", &saveptr);
+	value = strtok_r(NULL, " \t", &saveptr);
+	extra = strtok_r(NULL, " \t", &saveptr);
+	if (!value || extra)
+		return "usage: SET <farm> <backend> state|weight|priority <value>";
+
+	err = config_set_backend_value(fname, bname, key, value);
+	if (err)
+		return err;
+
+	concat_buf(out, "%s", LINE_OK);
+	(*changes)++;
+	return NULL;
+}
+
+static void nftlb_line_process(struct ev_loop *loop, struct nftlb_client *cli)
+{
+	struct nftlb_http_state *state = &cli->state;
+	char *data = get_buf_data(&cli->buf);
+	struct sbuffer out;
+	unsigned long seq;
+	const char *err;
+	int consumed = 0;
+	int changes = 0;
+	int error;
+	char *line, *nl;
+
+	if (!strchr(data, '\n')) {
+		if (cli->buf.next > SRV_MAX_REQ_HEADER) {
+			tools_printlog(LOG_ERR, "%s():%d: command line too long", __FUNCTION__, __LINE__);
+			nftlb_client_release(loop, cli);
+		}
+		return;
+	}
+
+	if (create_buf(&out)) {
+		nftlb_client_release(loop, cli);
+		return;
+	}
+
+	state->keepalive = 1;
+
+	/* the pending requests have their own answers, commit them apart */
+	nftlb_commit_run(loop);
+
+	while (state->keepalive && (nl = strchr(data + consumed, '\n')) != NULL) {
+		line = data + consumed;
+		consumed = nl - data + 1;
+
+		if (nl > line && nl[-1] == '\r')
+			nl--;
+		*nl = '\0';
+
+		if (line[strspn(line, " \t")] == '\0')
+			continue;
+
+		err = nftlb_line_cmd(cli, line, &out, &changes);
+		if (err)
+			concat_buf(&out, "%s%s\n", LINE_ERR, err);
+	}
+
+	nftlb_client_consume(cli, consumed);
+
+	free(state->body_response);
+	state->body_response = get_buf_data(&out);
+
+	if (!changes) {
+		nftlb_client_reply(loop, cli);
+		return;
+	}
+
+	tools_printlog(LOG_DEBUG, "%s():%d: committing %d changes", __FUNCTION__, __LINE__, changes);
+
+	seq = nft_get_commit_seq();
+	nft_batch_begin();
+	error = obj_rulerize(OBJ_START);
+	if (nft_batch_commit() || error)
+		nftlb_line_failed(cli);
+
+	if (nft_get_commit_seq() != seq) {
+		nftlb_client_park(loop, cli);
+		nftlb_commit_wait(loop, cli, seq);
+		return;
+	}
+
+	nftlb_client_reply(loop, cli);
+}
+
+static void nftlb_client_process(struct ev_loop *loop, struct nftlb_client *cli)
+{
+	struct nftlb_http_state *state = &cli->state;
+	unsigned long seq;
+	uint64_t start;
+	char next;
+	int len;
+	int ret;
+
+	/* resumed from nftlb_sendq_cb() once the client reads the responses */
+	if (nftlb_sendq_pending(&cli->sendq))
+		return;
+
+	if (cli->line) {
+		if (!isempty_buf(&cli->buf))
+			nftlb_line_process(loop, cli);
+		return;
+	}
+
+	if (cli->events) {
+		reset_buf(&cli->buf);
+		return;
+	}
+
+	while (!isempty_buf(&cli->buf) && !nftlb_sendq_pending(&cli->sendq)) {
+		if (!state->body_response && init_http_state(state)) {
+			nftlb_client_release(loop, cli);
+			return;
+		}
+
+		state->sendq = &cli->sendq;
+		start = stats_now();
+		len = get_request(&cli->buf, state);
+		state->timing.phase[STATS_PHASE_PARSE] += stats_now() - start;
+		if (len == 0)
+			return;
+
+		if (len < 0) {
+			state->keepalive = 0;
+			stats_http_response(ws_http_codes[state->status_code]);
+			nftlb_http_send_response(state, 0);
+			nftlb_client_close(loop, cli);
+			return;
+		}
+
+		/* terminate the body, the next request may follow it */
+		next = cli->buf.data[len];
+		cli->buf.data[len] = '\0';
+
+		/*
+		 * deletions rulerize in several steps and bulk state changes are
+		 * committed on their own, so pending changes go first
+		 */
+		if (state->method == WS_DELETE_ACTION ||
+			(state->method == WS_PUT_ACTION && put_is_bulk_states(state)))
+			nftlb_commit_run(loop);
+
+		seq = nft_get_commit_seq();
+
+		stats_request_set(&state->timing);
+		ret = send_response(state);
+		stats_request_set(NULL);
+
+		if (ret < 0) {
+			state->keepalive = 0;
+			stats_http_response(ws_http_codes[state->status_code]);
+			nftlb_http_send_response(state, 0);
+			nftlb_client_close(loop, cli);
+			return;
+		}
+
+		cli->buf.data[len] = next;
+		nftlb_client_consume(cli, len);
+
+		if (state->subscribe) {
+			nftlb_events_subscribe(loop, cli);
+			return;
+		}
+
+		if (state->deferred) {
+			nftlb_commit_defer(loop, cli);
+			return;
+		}
+
+		if (nft_get_commit_seq() != seq) {
+			nftlb_client_park(loop, cli);
+			nftlb_commit_wait(loop, cli, seq);
+			return;
+		}
+
+		if (nftlb_client_reply(loop, cli))
+			return;
+	}
+}
+
+static void nftlb_read_cb(struct ev_loop *loop, struct ev_io *io, int revents)
+{
+	struct nftlb_client *cli;
+	struct sbuffer *buf;
+	ssize_t size;
+	char cli_address[INET6_ADDRSTRLEN + 6]; //max address length + port length
+
+	if (EV_ERROR & revents) {
+		tools_printlog(LOG_ERR, "Server got invalid event from client read");
+		return;
+	}
+	cli = container_of(io, struct nftlb_client, io);
+	buf = &cli->buf;
+
+	/* the body has already room in the buffer */
+	if ((!cli->state.body_response || cli->state.parse != HTTP_PARSE_BODY) &&
+	    get_buf_size(buf) - buf->next - 1 < EXTRA_SIZE && resize_buf(buf, 1)) {
+		tools_printlog(LOG_ERR, "No memory available to read from client %s",
+					   nftlb_client_address(&cli->addr, cli_address));
+		nftlb_client_release(loop, cli);
+		return;
+	}
+
+	size = recv(io->fd, get_buf_next(buf), get_buf_size(buf) - buf->next - 1, 0);
+	if (size < 0 && (errno == EAGAIN || errno == EINTR))
+		return;
+
+	if (size <= 0) {
+		tools_printlog(LOG_DEBUG, "connection closed by client %s\n",
+					   nftlb_client_address(&cli->addr, cli_address));
+		nftlb_client_release(loop, cli);
+		return;
+	}
+
+	buf->next += size;
+	buf->data[buf->next] = '\0';
+	ev_timer_again(loop, &cli->timer);
+
+	nftlb_client_process(loop, cli);
 }
 
 static void nftlb_timer_cb(struct ev_loop *loop, ev_timer *timer, int events)
@@ -686,8 +1918,18 @@ static void nftlb_timer_cb(struct ev_loop *loop, ev_timer *timer, int events)
 
 	cli = container_of(timer, struct nftlb_client, timer);
 
-	tools_printlog(LOG_ERR, "timeout for client %s\n",
-				   nftlb_client_address(&cli->addr, cli_address));
+	if (cli->events) {
+		if (nftlb_events_send(cli, ":\n\n", 3))
+			nftlb_client_release(loop, cli);
+		return;
+	}
+
+	if (isempty_buf(&cli->buf))
+		tools_printlog(LOG_DEBUG, "idle timeout for client %s\n",
+					   nftlb_client_address(&cli->addr, cli_address));
+	else
+		tools_printlog(LOG_ERR, "timeout for client %s\n",
+					   nftlb_client_address(&cli->addr, cli_address));
 
 	nftlb_client_release(loop, cli);
 }
@@ -717,22 +1959,162 @@ static void accept_cb(struct ev_loop *loop, struct ev_io *io, int revents)
 	}
 	memcpy(&cli->addr, &client_addr, sizeof(cli->addr));
 
+	if (create_buf(&cli->buf)) {
+		tools_printlog(LOG_ERR, "No memory available to allocate new client");
+		close(client_sd);
+		free(cli);
+		return;
+	}
+	cli->state.body_response = NULL;
+	cli->state.output = NULL;
+	cli->state.parse = HTTP_PARSE_REQUEST;
+	cli->line = (io == events_get_srv_line());
+	cli->authorized = 0;
+	cli->events = 0;
+	cli->closing = 0;
+	cli->state.sendq = &cli->sendq;
+	cli->sendq.buf.data = NULL;
+	cli->sendq.sent = 0;
+	cli->sendq.dropped = 0;
+
 	ev_io_init(&cli->io, nftlb_read_cb, client_sd, EV_READ);
+	ev_io_init(&cli->sendq.io, nftlb_sendq_cb, client_sd, EV_WRITE);
 	ev_io_start(loop, &cli->io);
-	ev_timer_init(&cli->timer, nftlb_timer_cb, NFTLB_CLIENT_TIMEOUT, 0.);
-	ev_timer_start(loop, &cli->timer);
+	ev_timer_init(&cli->timer, nftlb_timer_cb, 0., NFTLB_CLIENT_TIMEOUT);
+	ev_timer_again(loop, &cli->timer);
 }
 
-int server_init(void)
+/*
+ * Local clients can reach the API through a unix socket, served along with
+ * the TCP port by the same request handling.
+ */
+static int server_init_unix(struct ev_loop *loop)
+{
+	struct ev_io *st_ev_accept;
+	struct sockaddr_un addr = {};
+	int sd;
+
+	if (strlen(nftserver.unix_path) >= sizeof(addr.sun_path)) {
+		tools_printlog(LOG_ERR, "%s():%d: unix socket path %s too long", __FUNCTION__, __LINE__, nftserver.unix_path);
+		return -1;
+	}
+
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", nftserver.unix_path);
+
+	sd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sd < 0) {
+		tools_printlog(LOG_ERR, "Server unix socket error");
+		return -1;
+	}
+
+	/* a previous instance could have left the socket behind */
+	unlink(nftserver.unix_path);
+
+	if (bind(sd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		tools_printlog(LOG_ERR, "Server unix bind error on %s", nftserver.unix_path);
+		close(sd);
+		return -1;
+	}
+	chmod(nftserver.unix_path, S_IRUSR | S_IWUSR);
+
+	if (listen(sd, 2) < 0) {
+		tools_printlog(LOG_ERR, "Server unix listen error");
+		close(sd);
+		return -1;
+	}
+
+	st_ev_accept = events_create_srv_unix();
+	if (!st_ev_accept) {
+		close(sd);
+		return -1;
+	}
+	nftserver.unix_sd = sd;
+
+	ev_io_init(st_ev_accept, accept_cb, sd, EV_READ);
+	ev_io_start(loop, st_ev_accept);
+
+	tools_printlog(LOG_INFO, "%s():%d: listening on %s", __FUNCTION__, __LINE__, nftserver.unix_path);
+
+	return 0;
+}
+
+static int server_listen(const char *host, const char *port)
 {
 	struct addrinfo hints = {};
 	struct addrinfo *result;
+	int server_sd;
+	int yes = 1, s;
+
+	hints.ai_family = AF_UNSPEC;    /* Allow IPv4 or IPv6 */
+	hints.ai_socktype = SOCK_STREAM; /* Datagram socket */
+	hints.ai_flags = AI_PASSIVE;    /* For wildcard IP address */
+
+	s = getaddrinfo(host, port, &hints, &result);
+	if (s != 0) {
+		tools_printlog(LOG_ERR, "getaddrinfo: %s\n", gai_strerror(s));
+		return -1;
+	}
+
+	server_sd = socket(result->ai_family, SOCK_STREAM, 0);
+	if (server_sd < 0) {
+		tools_printlog(LOG_ERR, "Server socket error");
+		freeaddrinfo(result);
+		return -1;
+	}
+	setsockopt(server_sd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int));
+
+	if (bind(server_sd, result->ai_addr, result->ai_addrlen) != 0) {
+		tools_printlog(LOG_ERR, "Server bind error");
+		freeaddrinfo(result);
+		close(server_sd);
+		return -1;
+	}
+	freeaddrinfo(result);
+
+	if (listen(server_sd, 2) < 0) {
+		tools_printlog(LOG_ERR, "Server listen error");
+		close(server_sd);
+		return -1;
+	}
+
+	return server_sd;
+}
+
+/*
+ * Health checkers can push backend changes through a plain text line
+ * protocol on its own port, sharing the API host and key.
+ */
+static int server_init_line(struct ev_loop *loop, const char *host)
+{
+	struct ev_io *st_ev_accept = events_create_srv_line();
+	int sd;
+
+	if (!st_ev_accept) {
+		tools_printlog(LOG_ERR, "No memory available to allocate the line listener");
+		return -1;
+	}
+
+	sd = server_listen(host, nftserver.line_port);
+	if (sd < 0)
+		return -1;
+	nftserver.line_sd = sd;
+
+	ev_io_init(st_ev_accept, accept_cb, sd, EV_READ);
+	ev_io_start(loop, st_ev_accept);
+
+	tools_printlog(LOG_INFO, "%s():%d: line protocol listening on port %s", __FUNCTION__, __LINE__, nftserver.line_port);
+
+	return 0;
+}
+
+int server_init(void)
+{
 	const char *host;
 	const char *port;
 	struct ev_loop *st_ev_loop = get_loop();
 	struct ev_io *st_ev_accept = events_create_srv();
 	int server_sd;
-	int yes = 1, s;
 
 	if (!nftserver.key)
 		server_set_key(NULL);
@@ -758,46 +2140,58 @@ int server_init(void)
 	else
 		port = nftserver.port;
 
-	hints.ai_family = AF_UNSPEC;    /* Allow IPv4 or IPv6 */
-	hints.ai_socktype = SOCK_STREAM; /* Datagram socket */
-	hints.ai_flags = AI_PASSIVE;    /* For wildcard IP address */
-
-	s = getaddrinfo(host, port, &hints, &result);
-	if (s != 0) {
-		tools_printlog(LOG_ERR, "getaddrinfo: %s\n", gai_strerror(s));
+	server_sd = server_listen(host, port);
+	if (server_sd < 0)
 		return -1;
-	}
+	nftserver.sd = server_sd;
 
-	server_sd = socket(result->ai_family, SOCK_STREAM, 0);
-	if (server_sd < 0) {
-		tools_printlog(LOG_ERR, "Server socket error");
-		return -1;
-	}
-	setsockopt(server_sd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(int));
+	ev_io_init(st_ev_accept, accept_cb, server_sd, EV_READ);
+	ev_io_start(st_ev_loop, st_ev_accept);
 
-	if (bind(server_sd, result->ai_addr, result->ai_addrlen) != 0) {
-		tools_printlog(LOG_ERR, "Server bind error");
-		freeaddrinfo(result);
+	if (nftserver.unix_path && server_init_unix(st_ev_loop) != 0)
 		return -1;
-	}
-	freeaddrinfo(result);
 
-	if (listen(server_sd, 2) < 0) {
-		tools_printlog(LOG_ERR, "Server listen error");
+	if (nftserver.line_port && server_init_line(st_ev_loop, host) != 0)
 		return -1;
+
+	if (nftserver.commit_window) {
+		tools_printlog(LOG_INFO, "%s():%d: coalescing commits every %d ms", __FUNCTION__, __LINE__, nftserver.commit_window);
+		ev_timer_init(events_create_commit(), nftlb_commit_cb, nftserver.commit_window / 1000., 0.);
 	}
-	nftserver.sd = server_sd;
 
-	ev_io_init(st_ev_accept, accept_cb, server_sd, EV_READ);
-	ev_io_start(st_ev_loop, st_ev_accept);
+	if (nft_async_start(nftlb_commit_done))
+		tools_printlog(LOG_ERR, "%s():%d: nft commands will be executed from the event loop", __FUNCTION__, __LINE__);
 
 	return 0;
 }
 
 void server_fini(void)
 {
+	struct nftlb_client *cli, *next;
+
+	list_for_each_entry_safe(cli, next, &event_clients, list)
+		nftlb_client_release(get_loop(), cli);
+
+	nftlb_cache_fini();
+
+	if (nftserver.commit_window) {
+		nftlb_commit_run(get_loop());
+		events_delete_commit();
+	}
+	nft_async_stop();
 	events_delete_srv();
 	close(nftserver.sd);
+
+	if (nftserver.unix_sd >= 0) {
+		events_delete_srv_unix();
+		close(nftserver.unix_sd);
+		unlink(nftserver.unix_path);
+	}
+
+	if (nftserver.line_sd >= 0) {
+		events_delete_srv_line();
+		close(nftserver.line_sd);
+	}
 }
 
 void server_set_host(const char *host)
@@ -848,3 +2242,42 @@ void server_set_ipv6(void)
 {
 	nftserver.family = AF_INET6;
 }
+
+void server_set_unix(const char *path)
+{
+	nftserver.unix_path = malloc(strlen(path)+1);
+	if (!nftserver.unix_path) {
+		tools_printlog(LOG_ERR, "No memory available to allocate the server unix path");
+		return;
+	}
+
+	sprintf(nftserver.unix_path, "%s", path);
+}
+
+void server_set_line_port(const char *port)
+{
+	nftserver.line_port = malloc(strlen(port)+1);
+	if (!nftserver.line_port) {
+		tools_printlog(LOG_ERR, "No memory available to allocate the line protocol port");
+		return;
+	}
+
+	sprintf(nftserver.line_port, "%s", port);
+}
+
+void server_set_timing(void)
+{
+	nftserver.timing = 1;
+}
+
+int server_set_commit_window(int msecs)
+{
+	if (msecs < 0 || msecs > SRV_MAX_COMMIT_WINDOW) {
+		tools_printlog(LOG_ERR, "Invalid commit window %d, it must be between 0 and %d ms", msecs, SRV_MAX_COMMIT_WINDOW);
+		return -1;
+	}
+
+	nftserver.commit_window = msecs;
+
+	return 0;
+}
@@ -30,6 +30,8 @@
 #include "tools.h"
 #include "nft.h"
 
+static SLAB_POOL(sessions_pool, "sessions", struct session);
+
 static struct session * session_create(struct farm *f, int type, char *client, char *bck, char *expiration)
 {
 	struct session *s;
@@ -42,7 +44,7 @@ static struct session * session_create(struct farm *f, int type, char *client, c
 		return NULL;
 	}
 
-	s = (struct session *)malloc(sizeof(struct session));
+	s = (struct session *)slab_alloc(&sessions_pool);
 	if (!s) {
 		tools_printlog(LOG_ERR, "Session memory allocation error");
 		return NULL;
@@ -82,7 +84,7 @@ cont:
 		s->state = VALUE_STATE_UP;
 		list_add_tail(&s->list, &f->timed_sessions);
 		f->total_timed_sessions++;
-		obj_set_attribute_string(expiration, &s->expiration);
+		obj_set_attribute_shared(expiration, &s->expiration);
 	} else {
 		list_add_tail(&s->list, &f->static_sessions);
 		f->total_static_sessions++;
@@ -167,10 +169,9 @@ static int session_delete_node(struct session *s, int type)
 
 	if (s->client)
 		free(s->client);
-	if (s->expiration)
-		free(s->expiration);
+	slab_str_put(s->expiration);
 
-	free(s);
+	slab_free(&sessions_pool, s);
 
 	return 0;
 }
@@ -0,0 +1,1145 @@
+/*
+ *   This file is part of nftlb, nftables load balancer.
+ *
+ *   Copyright (C) ZEVENET SL.
+ *   Author: Laura Garcia <laura.garcia@zevenet.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Affero General Public License as
+ *   published by the Free Software Foundation, either version 3 of the
+ *   License, or any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Affero General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Affero General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * Shadow model of the ruleset committed by nftlb. Every script generated
+ * by the rulerize is filtered here before being sent to the kernel: rule
+ * sets of flushed chains and contents of flushed maps are compared
+ * against what was committed last, and only the operations that change
+ * something are emitted. Objects whose content isn't fully known (created
+ * before a reset, updated from the packet path, etc.) are passed through
+ * untouched until a flush makes them known again.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <ctype.h>
+
+#include "shadow.h"
+#include "list.h"
+#include "objindex.h"
+#include "tools.h"
+
+#define SHADOW_HASH_SIZE		1024
+#define SHADOW_MAX_NAME			256
+#define SHADOW_INIT_CMDS		64
+
+enum shadow_types {
+	SHADOW_TABLE,
+	SHADOW_CHAIN,
+	SHADOW_MAP,
+};
+
+enum shadow_verbs {
+	SHADOW_VERB_NONE,
+	SHADOW_VERB_ADD,
+	SHADOW_VERB_CREATE,
+	SHADOW_VERB_DELETE,
+	SHADOW_VERB_FLUSH,
+	SHADOW_VERB_OTHER,
+};
+
+enum shadow_objects {
+	SHADOW_OBJ_NONE,
+	SHADOW_OBJ_TABLE,
+	SHADOW_OBJ_CHAIN,
+	SHADOW_OBJ_RULE,
+	SHADOW_OBJ_MAP,
+	SHADOW_OBJ_SET,
+	SHADOW_OBJ_ELEMENT,
+	SHADOW_OBJ_RULESET,
+	SHADOW_OBJ_OTHER,
+};
+
+struct shadow_item {
+	struct list_head	list;
+	struct objindex_node	hnode;
+	char				*key;
+	char				*data;
+};
+
+/* items in order of insertion, indexed by key for the diffs */
+struct shadow_items {
+	struct list_head	list;
+	struct objindex		index;
+};
+
+struct shadow_obj {
+	struct list_head	list;
+	int					type;
+	char				*key;
+	char				*table;
+	int					known;
+	int					dynamic;
+	int					group;
+	struct shadow_items	items;
+};
+
+struct shadow_cmd {
+	char				*text;
+	char				*replace;
+	int					drop;
+};
+
+struct shadow_group {
+	struct shadow_obj	*obj;
+	int					flush;
+	int					forced;
+	int					*cmds;
+	int					ncmds;
+	struct shadow_items	items;
+};
+
+struct shadow_script {
+	struct shadow_cmd	*cmds;
+	int					ncmds;
+	int					size;
+	struct shadow_group	**groups;
+	int					ngroups;
+};
+
+struct shadow_parsed {
+	int					verb;
+	int					object;
+	char				family[SHADOW_MAX_NAME];
+	char				table[SHADOW_MAX_NAME];
+	char				name[SHADOW_MAX_NAME];
+	char				*rest;
+};
+
+static struct list_head shadow_hash[SHADOW_HASH_SIZE];
+static int shadow_ready = 0;
+
+static unsigned int shadow_hash_key(const char *key)
+{
+	unsigned int h = 5381;
+
+	while (*key)
+		h = ((h << 5) + h) + (unsigned char)*key++;
+
+	return h % SHADOW_HASH_SIZE;
+}
+
+static void shadow_init(void)
+{
+	int i;
+
+	if (shadow_ready)
+		return;
+
+	for (i = 0; i < SHADOW_HASH_SIZE; i++)
+		init_list_head(&shadow_hash[i]);
+
+	shadow_ready = 1;
+}
+
+static struct shadow_item *shadow_item_create(const char *key, const char *data)
+{
+	struct shadow_item *it = (struct shadow_item *)calloc(1, sizeof(struct shadow_item));
+
+	if (!it) {
+		tools_printlog(LOG_ERR, "%s():%d: shadow item memory allocation error", __FUNCTION__, __LINE__);
+		return NULL;
+	}
+
+	it->key = strdup(key);
+	it->data = data ? strdup(data) : NULL;
+	if (!it->key || (data && !it->data)) {
+		free(it->key);
+		free(it->data);
+		free(it);
+		return NULL;
+	}
+
+	return it;
+}
+
+static void shadow_items_init(struct shadow_items *items)
+{
+	init_list_head(&items->list);
+	memset(&items->index, 0, sizeof(struct objindex));
+}
+
+static int shadow_items_add(struct shadow_items *items, struct shadow_item *it)
+{
+	if (objindex_add(&items->index, &it->hnode, objindex_hash_str(it->key, 0)))
+		return -1;
+
+	list_add_tail(&it->list, &items->list);
+	return 0;
+}
+
+static void shadow_items_unlink(struct shadow_items *items, struct shadow_item *it)
+{
+	objindex_del(&items->index, &it->hnode);
+	list_del(&it->list);
+}
+
+static void shadow_item_delete(struct shadow_items *items, struct shadow_item *it)
+{
+	shadow_items_unlink(items, it);
+	free(it->key);
+	free(it->data);
+	free(it);
+}
+
+static void shadow_items_clean(struct shadow_items *items)
+{
+	struct shadow_item *it, *next;
+
+	list_for_each_entry_safe(it, next, &items->list, list)
+		shadow_item_delete(items, it);
+
+	objindex_free(&items->index);
+}
+
+/* replace the content of dst with the items of src, leaving src empty */
+static void shadow_items_move(struct shadow_items *dst, struct shadow_items *src)
+{
+	shadow_items_clean(dst);
+	list_splice_init(&src->list, &dst->list);
+	dst->index = src->index;
+	memset(&src->index, 0, sizeof(struct objindex));
+}
+
+static struct shadow_item *shadow_items_lookup(struct shadow_items *items, const char *key)
+{
+	unsigned int hash = objindex_hash_str(key, 0);
+	struct hlist_node *pos;
+	struct shadow_item *it;
+
+	hlist_for_each_entry(it, pos, objindex_bucket(&items->index, hash), hnode.node) {
+		if (it->hnode.hash == hash && strcmp(it->key, key) == 0)
+			return it;
+	}
+
+	return NULL;
+}
+
+static int shadow_items_set(struct shadow_items *items, const char *key, const char *data)
+{
+	struct shadow_item *it = shadow_items_lookup(items, key);
+
+	if (it)
+		shadow_item_delete(items, it);
+
+	it = shadow_item_create(key, data);
+	if (!it)
+		return -1;
+
+	if (shadow_items_add(items, it)) {
+		free(it->key);
+		free(it->data);
+		free(it);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int shadow_data_equal(const char *a, const char *b)
+{
+	if (!a || !b)
+		return a == b;
+
+	return strcmp(a, b) == 0;
+}
+
+static void shadow_obj_key(char *key, int type, const char *family, const char *table, const char *name)
+{
+	switch (type) {
+	case SHADOW_TABLE:
+		snprintf(key, SHADOW_MAX_NAME * 4, "t %s %s", family, table);
+		break;
+	case SHADOW_CHAIN:
+		snprintf(key, SHADOW_MAX_NAME * 4, "c %s %s %s", family, table, name);
+		break;
+	default:
+		snprintf(key, SHADOW_MAX_NAME * 4, "m %s %s %s", family, table, name);
+		break;
+	}
+}
+
+static struct shadow_obj *shadow_obj_lookup(int type, const char *family, const char *table, const char *name)
+{
+	char key[SHADOW_MAX_NAME * 4];
+	struct shadow_obj *o;
+
+	shadow_obj_key(key, type, family, table, name);
+
+	list_for_each_entry(o, &shadow_hash[shadow_hash_key(key)], list)
+		if (strcmp(o->key, key) == 0)
+			return o;
+
+	return NULL;
+}
+
+static struct shadow_obj *shadow_obj_create(int type, const char *family, const char *table, const char *name, int known)
+{
+	char key[SHADOW_MAX_NAME * 4];
+	char tkey[SHADOW_MAX_NAME * 2];
+	struct shadow_obj *o = (struct shadow_obj *)calloc(1, sizeof(struct shadow_obj));
+
+	if (!o) {
+		tools_printlog(LOG_ERR, "%s():%d: shadow object memory allocation error", __FUNCTION__, __LINE__);
+		return NULL;
+	}
+
+	shadow_obj_key(key, type, family, table, name);
+	snprintf(tkey, sizeof(tkey), "%s %s", family, table);
+
+	o->key = strdup(key);
+	o->table = strdup(tkey);
+	if (!o->key || !o->table) {
+		free(o->key);
+		free(o->table);
+		free(o);
+		return NULL;
+	}
+
+	o->type = type;
+	o->known = known;
+	o->group = -1;
+	shadow_items_init(&o->items);
+	list_add_tail(&o->list, &shadow_hash[shadow_hash_key(key)]);
+
+	return o;
+}
+
+static void shadow_obj_delete(struct shadow_script *s, struct shadow_obj *o)
+{
+	if (s && o->group >= 0) {
+		s->groups[o->group]->obj = NULL;
+		s->groups[o->group]->forced = 1;
+	}
+
+	list_del(&o->list);
+	shadow_items_clean(&o->items);
+	free(o->key);
+	free(o->table);
+	free(o);
+}
+
+static void shadow_obj_forget(struct shadow_script *s, struct shadow_obj *o)
+{
+	if (s && o->group >= 0)
+		s->groups[o->group]->forced = 1;
+
+	shadow_items_clean(&o->items);
+	o->known = 0;
+}
+
+static int shadow_table_known(const char *family, const char *table)
+{
+	struct shadow_obj *t = shadow_obj_lookup(SHADOW_TABLE, family, table, NULL);
+
+	return t && t->known;
+}
+
+static struct shadow_obj *shadow_obj_get(int type, const char *family, const char *table, const char *name)
+{
+	struct shadow_obj *o = shadow_obj_lookup(type, family, table, name);
+
+	if (o)
+		return o;
+
+	return shadow_obj_create(type, family, table, name, shadow_table_known(family, table));
+}
+
+/* drop or forget every object of a table, the table itself is kept */
+static void shadow_table_objs(struct shadow_script *s, const char *family, const char *table, int remove)
+{
+	char tkey[SHADOW_MAX_NAME * 2];
+	struct shadow_obj *o, *next;
+	int i;
+
+	snprintf(tkey, sizeof(tkey), "%s %s", family, table);
+
+	for (i = 0; i < SHADOW_HASH_SIZE; i++) {
+		list_for_each_entry_safe(o, next, &shadow_hash[i], list) {
+			if (o->type == SHADOW_TABLE || strcmp(o->table, tkey) != 0)
+				continue;
+			if (remove)
+				shadow_obj_delete(s, o);
+			else
+				shadow_obj_forget(s, o);
+		}
+	}
+}
+
+static char *shadow_trim(char *str)
+{
+	char *end;
+
+	while (isspace((unsigned char)*str))
+		str++;
+
+	end = str + strlen(str);
+	while (end > str && isspace((unsigned char)end[-1]))
+		end--;
+	*end = '\0';
+
+	return str;
+}
+
+static char *shadow_next_token(char *p, char *tok)
+{
+	int len = 0;
+
+	while (isspace((unsigned char)*p))
+		p++;
+
+	while (*p && !isspace((unsigned char)*p)) {
+		if (len < SHADOW_MAX_NAME - 1)
+			tok[len++] = *p;
+		p++;
+	}
+	tok[len] = '\0';
+
+	return p;
+}
+
+static int shadow_parse_verb(const char *tok)
+{
+	if (strcmp(tok, "add") == 0)
+		return SHADOW_VERB_ADD;
+	if (strcmp(tok, "create") == 0)
+		return SHADOW_VERB_CREATE;
+	if (strcmp(tok, "delete") == 0 || strcmp(tok, "destroy") == 0)
+		return SHADOW_VERB_DELETE;
+	if (strcmp(tok, "flush") == 0)
+		return SHADOW_VERB_FLUSH;
+	return SHADOW_VERB_OTHER;
+}
+
+static int shadow_parse_object(const char *tok)
+{
+	if (strcmp(tok, "table") == 0)
+		return SHADOW_OBJ_TABLE;
+	if (strcmp(tok, "chain") == 0)
+		return SHADOW_OBJ_CHAIN;
+	if (strcmp(tok, "rule") == 0)
+		return SHADOW_OBJ_RULE;
+	if (strcmp(tok, "map") == 0)
+		return SHADOW_OBJ_MAP;
+	if (strcmp(tok, "set") == 0)
+		return SHADOW_OBJ_SET;
+	if (strcmp(tok, "element") == 0)
+		return SHADOW_OBJ_ELEMENT;
+	if (strcmp(tok, "ruleset") == 0)
+		return SHADOW_OBJ_RULESET;
+	return SHADOW_OBJ_OTHER;
+}
+
+static int shadow_parse(char *text, struct shadow_parsed *p)
+{
+	char tok[SHADOW_MAX_NAME];
+	char *c = text;
+
+	memset(p, 0, sizeof(struct shadow_parsed));
+
+	c = shadow_next_token(c, tok);
+	p->verb = shadow_parse_verb(tok);
+
+	c = shadow_next_token(c, tok);
+	p->object = shadow_parse_object(tok);
+
+	if (p->object == SHADOW_OBJ_OTHER)
+		return 0;
+
+	if (p->object == SHADOW_OBJ_RULESET)
+		return 1;
+
+	c = shadow_next_token(c, p->family);
+	c = shadow_next_token(c, p->table);
+	if (p->object != SHADOW_OBJ_TABLE)
+		c = shadow_next_token(c, p->name);
+
+	p->rest = shadow_trim(c);
+
+	return p->table[0] != '\0';
+}
+
+/* split a script into its commands, honouring braces and quotes */
+static int shadow_split(const char *script, struct shadow_script *s)
+{
+	const char *p = script;
+	const char *start = script;
+	int depth = 0;
+	int quoted = 0;
+	char *text, *trimmed;
+	size_t len;
+
+	for (;; p++) {
+		if (*p == '"')
+			quoted = !quoted;
+		else if (!quoted && *p == '{')
+			depth++;
+		else if (!quoted && *p == '}' && depth > 0)
+			depth--;
+
+		if (*p != '\0' && (*p != ';' || quoted || depth > 0))
+			continue;
+
+		len = p - start;
+		text = (char *)malloc(len + 1);
+		if (!text)
+			return -1;
+		memcpy(text, start, len);
+		text[len] = '\0';
+
+		trimmed = shadow_trim(text);
+		if (*trimmed == '\0') {
+			free(text);
+		} else {
+			memmove(text, trimmed, strlen(trimmed) + 1);
+			if (s->ncmds == s->size) {
+				struct shadow_cmd *cmds = (struct shadow_cmd *)realloc(s->cmds, sizeof(struct shadow_cmd) * s->size * 2);
+				if (!cmds) {
+					free(text);
+					return -1;
+				}
+				s->cmds = cmds;
+				s->size *= 2;
+			}
+			s->cmds[s->ncmds].text = text;
+			s->cmds[s->ncmds].replace = NULL;
+			s->cmds[s->ncmds].drop = 0;
+			s->ncmds++;
+		}
+
+		if (*p == '\0')
+			break;
+		start = p + 1;
+	}
+
+	return 0;
+}
+
+/* parse the elements of a "{ k : v, ... }" expression into a list */
+static int shadow_parse_elements(const char *rest, struct shadow_items *items)
+{
+	const char *open = strchr(rest, '{');
+	const char *close = strrchr(rest, '}');
+	const char *p, *start;
+	char elem[SHADOW_MAX_NAME * 4];
+	char *e, *sep;
+	int quoted = 0;
+	size_t len;
+
+	if (!open || !close || close < open)
+		return -1;
+
+	start = open + 1;
+	for (p = start; p <= close; p++) {
+		if (*p == '"')
+			quoted = !quoted;
+		if (p != close && (*p != ',' || quoted))
+			continue;
+
+		len = p - start;
+		if (len >= sizeof(elem))
+			return -1;
+		memcpy(elem, start, len);
+		elem[len] = '\0';
+		start = p + 1;
+
+		e = shadow_trim(elem);
+		if (*e == '\0')
+			continue;
+
+		sep = strstr(e, " : ");
+		if (sep) {
+			*sep = '\0';
+			if (shadow_items_set(items, shadow_trim(e), shadow_trim(sep + 3)))
+				return -1;
+		} else if (shadow_items_set(items, e, NULL))
+			return -1;
+	}
+
+	return 0;
+}
+
+static void shadow_concat_elements(struct sbuffer *buf, struct shadow_items *items, int keys_only)
+{
+	struct shadow_item *it;
+	int i = 0;
+
+	list_for_each_entry(it, &items->list, list) {
+		concat_buf(buf, "%s %s", i ? "," : "", it->key);
+		if (!keys_only && it->data)
+			concat_buf(buf, " : %s", it->data);
+		i++;
+	}
+}
+
+static char *shadow_gen_elements(struct shadow_parsed *p, struct shadow_items *dels, struct shadow_items *adds)
+{
+	struct sbuffer buf;
+	char *out;
+
+	if (list_empty(&dels->list) && list_empty(&adds->list))
+		return NULL;
+
+	if (create_buf(&buf))
+		return NULL;
+
+	if (!list_empty(&dels->list)) {
+		concat_buf(&buf, "delete element %s %s %s {", p->family, p->table, p->name);
+		shadow_concat_elements(&buf, dels, 1);
+		concat_buf(&buf, " }");
+	}
+
+	if (!list_empty(&adds->list)) {
+		concat_buf(&buf, "%sadd element %s %s %s {", list_empty(&dels->list) ? "" : " ; ", p->family, p->table, p->name);
+		shadow_concat_elements(&buf, adds, 0);
+		concat_buf(&buf, " }");
+	}
+
+	out = strdup(get_buf_data(&buf));
+	clean_buf(&buf);
+
+	return out;
+}
+
+static struct shadow_group *shadow_group_start(struct shadow_script *s, struct shadow_obj *o, int cmd)
+{
+	struct shadow_group **groups;
+	struct shadow_group *g;
+
+	if (o->group >= 0) {
+		// flushed twice in the same script, keep it as it is
+		s->groups[o->group]->forced = 1;
+		return s->groups[o->group];
+	}
+
+	groups = (struct shadow_group **)realloc(s->groups, sizeof(struct shadow_group *) * (s->ngroups + 1));
+	if (!groups)
+		return NULL;
+	s->groups = groups;
+
+	g = (struct shadow_group *)malloc(sizeof(struct shadow_group));
+	if (!g)
+		return NULL;
+	s->groups[s->ngroups] = g;
+
+	g->obj = o;
+	g->flush = cmd;
+	g->forced = 0;
+	g->cmds = NULL;
+	g->ncmds = 0;
+	shadow_items_init(&g->items);
+	o->group = s->ngroups++;
+
+	return g;
+}
+
+static int shadow_group_add_cmd(struct shadow_group *g, int cmd)
+{
+	int *cmds = (int *)realloc(g->cmds, sizeof(int) * (g->ncmds + 1));
+
+	if (!cmds) {
+		g->forced = 1;
+		return -1;
+	}
+
+	g->cmds = cmds;
+	g->cmds[g->ncmds++] = cmd;
+	return 0;
+}
+
+/* true if the reference at c is the target of an update from the packet path */
+static int shadow_rule_updates(const char *rest, const char *c)
+{
+	static const char *verbs[] = { "update ", "add ", "delete ", NULL };
+	size_t len;
+	int i;
+
+	for (i = 0; verbs[i]; i++) {
+		len = strlen(verbs[i]);
+		if ((size_t)(c - rest) >= len && strncmp(c - len, verbs[i], len) == 0 &&
+			(c - rest == (ptrdiff_t)len || isspace((unsigned char)c[-len - 1])))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * A rule updating a map from the packet path makes its content unknown.
+ * Only the map the statement writes to is affected, the ones the rule
+ * just looks up are still diffed.
+ */
+static void shadow_rule_refs(struct shadow_script *s, struct shadow_parsed *p)
+{
+	char name[SHADOW_MAX_NAME];
+	struct shadow_obj *o;
+	char *c = p->rest;
+	int len;
+
+	while ((c = strchr(c, '@')) != NULL) {
+		if (!shadow_rule_updates(p->rest, c++))
+			continue;
+
+		for (len = 0; c[len] && !isspace((unsigned char)c[len]) && c[len] != '{' && len < SHADOW_MAX_NAME - 1; len++)
+			name[len] = c[len];
+		name[len] = '\0';
+
+		o = shadow_obj_lookup(SHADOW_MAP, p->family, p->table, name);
+		if (!o)
+			o = shadow_obj_create(SHADOW_MAP, p->family, p->table, name, 0);
+		if (!o)
+			continue;
+
+		o->dynamic = 1;
+		shadow_obj_forget(s, o);
+	}
+}
+
+static void shadow_cmd_table(struct shadow_script *s, struct shadow_parsed *p)
+{
+	struct shadow_obj *t = shadow_obj_lookup(SHADOW_TABLE, p->family, p->table, NULL);
+
+	switch (p->verb) {
+	case SHADOW_VERB_ADD:
+	case SHADOW_VERB_CREATE:
+		if (!t)
+			shadow_obj_create(SHADOW_TABLE, p->family, p->table, NULL, 0);
+		break;
+	case SHADOW_VERB_DELETE:
+		shadow_table_objs(s, p->family, p->table, 1);
+		if (!t)
+			t = shadow_obj_create(SHADOW_TABLE, p->family, p->table, NULL, 1);
+		if (t)
+			t->known = 1;
+		break;
+	default:
+		shadow_table_objs(s, p->family, p->table, 0);
+		break;
+	}
+}
+
+static void shadow_cmd_chain(struct shadow_script *s, struct shadow_parsed *p, int cmd)
+{
+	struct shadow_obj *o = shadow_obj_lookup(SHADOW_CHAIN, p->family, p->table, p->name);
+	struct shadow_group *g;
+
+	switch (p->verb) {
+	case SHADOW_VERB_ADD:
+	case SHADOW_VERB_CREATE:
+		if (!o)
+			shadow_obj_get(SHADOW_CHAIN, p->family, p->table, p->name);
+		break;
+	case SHADOW_VERB_DELETE:
+		if (o)
+			shadow_obj_delete(s, o);
+		break;
+	case SHADOW_VERB_FLUSH:
+		o = shadow_obj_get(SHADOW_CHAIN, p->family, p->table, p->name);
+		if (!o)
+			break;
+		g = shadow_group_start(s, o, cmd);
+		if (!g)
+			shadow_obj_forget(s, o);
+		break;
+	default:
+		if (o)
+			shadow_obj_forget(s, o);
+		break;
+	}
+}
+
+static void shadow_cmd_rule(struct shadow_script *s, struct shadow_parsed *p, int cmd)
+{
+	struct shadow_obj *o = shadow_obj_get(SHADOW_CHAIN, p->family, p->table, p->name);
+	struct shadow_group *g;
+	struct shadow_item *it;
+
+	shadow_rule_refs(s, p);
+
+	if (!o)
+		return;
+
+	if (p->verb != SHADOW_VERB_ADD) {
+		shadow_obj_forget(s, o);
+		return;
+	}
+
+	if (o->group >= 0) {
+		g = s->groups[o->group];
+		it = shadow_item_create(p->rest, NULL);
+		if (!it || shadow_group_add_cmd(g, cmd) || shadow_items_add(&g->items, it)) {
+			g->forced = 1;
+			free(it ? it->key : NULL);
+			free(it);
+			return;
+		}
+		return;
+	}
+
+	if (!o->known)
+		return;
+
+	it = shadow_item_create(p->rest, NULL);
+	if (!it || shadow_items_add(&o->items, it)) {
+		free(it ? it->key : NULL);
+		free(it);
+		shadow_obj_forget(s, o);
+		return;
+	}
+}
+
+static void shadow_cmd_map(struct shadow_script *s, struct shadow_parsed *p, int cmd)
+{
+	struct shadow_obj *o = shadow_obj_lookup(SHADOW_MAP, p->family, p->table, p->name);
+
+	switch (p->verb) {
+	case SHADOW_VERB_ADD:
+	case SHADOW_VERB_CREATE:
+		if (!o)
+			o = shadow_obj_get(SHADOW_MAP, p->family, p->table, p->name);
+		if (o && (strstr(p->rest, "timeout") || strstr(p->rest, "dynamic"))) {
+			o->dynamic = 1;
+			shadow_obj_forget(s, o);
+		}
+		break;
+	case SHADOW_VERB_DELETE:
+		if (o)
+			shadow_obj_delete(s, o);
+		break;
+	case SHADOW_VERB_FLUSH:
+		o = shadow_obj_get(SHADOW_MAP, p->family, p->table, p->name);
+		if (!o)
+			break;
+		if (o->dynamic || !shadow_group_start(s, o, cmd))
+			shadow_obj_forget(s, o);
+		break;
+	default:
+		if (o)
+			shadow_obj_forget(s, o);
+		break;
+	}
+}
+
+static void shadow_cmd_element(struct shadow_script *s, struct shadow_parsed *p, int cmd)
+{
+	struct shadow_obj *o = shadow_obj_lookup(SHADOW_MAP, p->family, p->table, p->name);
+	struct shadow_items elems, dels, adds;
+	struct shadow_item *it, *next, *cur;
+	struct shadow_group *g;
+
+	// sets aren't tracked, they may be auto-merged by the kernel
+	if (!o || o->dynamic)
+		return;
+
+	shadow_items_init(&elems);
+	shadow_items_init(&dels);
+	shadow_items_init(&adds);
+
+	if (shadow_parse_elements(p->rest, &elems)) {
+		shadow_items_clean(&elems);
+		shadow_obj_forget(s, o);
+		return;
+	}
+
+	if (o->group >= 0) {
+		g = s->groups[o->group];
+		shadow_group_add_cmd(g, cmd);
+		list_for_each_entry_safe(it, next, &elems.list, list) {
+			if (p->verb == SHADOW_VERB_ADD) {
+				if (shadow_items_set(&g->items, it->key, it->data))
+					g->forced = 1;
+			} else if (p->verb == SHADOW_VERB_DELETE) {
+				cur = shadow_items_lookup(&g->items, it->key);
+				if (cur)
+					shadow_item_delete(&g->items, cur);
+			} else {
+				g->forced = 1;
+			}
+		}
+		shadow_items_clean(&elems);
+		return;
+	}
+
+	if (!o->known) {
+		shadow_items_clean(&elems);
+		return;
+	}
+
+	switch (p->verb) {
+	case SHADOW_VERB_ADD:
+		list_for_each_entry_safe(it, next, &elems.list, list) {
+			cur = shadow_items_lookup(&o->items, it->key);
+			if (cur && shadow_data_equal(cur->data, it->data)) {
+				shadow_item_delete(&elems, it);
+				continue;
+			}
+			// a different value for an existing key has to be replaced
+			if (cur && shadow_items_set(&dels, it->key, NULL))
+				goto forget;
+			if (shadow_items_set(&o->items, it->key, it->data))
+				goto forget;
+			shadow_items_unlink(&elems, it);
+			if (shadow_items_add(&adds, it)) {
+				free(it->key);
+				free(it->data);
+				free(it);
+				goto forget;
+			}
+		}
+		s->cmds[cmd].replace = shadow_gen_elements(p, &dels, &adds);
+		if (!s->cmds[cmd].replace)
+			s->cmds[cmd].drop = 1;
+		break;
+	case SHADOW_VERB_DELETE:
+		list_for_each_entry(it, &elems.list, list) {
+			cur = shadow_items_lookup(&o->items, it->key);
+			if (cur)
+				shadow_item_delete(&o->items, cur);
+		}
+		break;
+	default:
+		goto forget;
+	}
+
+	shadow_items_clean(&elems);
+	shadow_items_clean(&dels);
+	shadow_items_clean(&adds);
+	return;
+
+forget:
+	shadow_items_clean(&elems);
+	shadow_items_clean(&dels);
+	shadow_items_clean(&adds);
+	s->cmds[cmd].replace = NULL;
+	s->cmds[cmd].drop = 0;
+	shadow_obj_forget(s, o);
+}
+
+static int shadow_rules_equal(struct shadow_items *ra, struct shadow_items *rb)
+{
+	struct list_head *a = &ra->list;
+	struct list_head *b = &rb->list;
+	struct shadow_item *ia = list_entry(a->next, struct shadow_item, list);
+	struct shadow_item *ib = list_entry(b->next, struct shadow_item, list);
+
+	while (&ia->list != a && &ib->list != b) {
+		if (strcmp(ia->key, ib->key) != 0)
+			return 0;
+		ia = list_entry(ia->list.next, struct shadow_item, list);
+		ib = list_entry(ib->list.next, struct shadow_item, list);
+	}
+
+	return &ia->list == a && &ib->list == b;
+}
+
+static void shadow_group_drop(struct shadow_script *s, struct shadow_group *g)
+{
+	int i;
+
+	s->cmds[g->flush].drop = 1;
+	for (i = 0; i < g->ncmds; i++)
+		s->cmds[g->cmds[i]].drop = 1;
+}
+
+static void shadow_group_resolve_map(struct shadow_script *s, struct shadow_group *g)
+{
+	struct shadow_obj *o = g->obj;
+	struct shadow_parsed p;
+	struct shadow_items dels, adds;
+	struct shadow_item *it, *cur;
+
+	shadow_items_init(&dels);
+	shadow_items_init(&adds);
+
+	if (o->known) {
+		list_for_each_entry(it, &o->items.list, list) {
+			cur = shadow_items_lookup(&g->items, it->key);
+			if ((!cur || !shadow_data_equal(cur->data, it->data)) && shadow_items_set(&dels, it->key, NULL))
+				goto keep;
+		}
+
+		list_for_each_entry(it, &g->items.list, list) {
+			cur = shadow_items_lookup(&o->items, it->key);
+			if ((!cur || !shadow_data_equal(cur->data, it->data)) && shadow_items_set(&adds, it->key, it->data))
+				goto keep;
+		}
+
+		shadow_parse(s->cmds[g->flush].text, &p);
+		shadow_group_drop(s, g);
+		s->cmds[g->flush].replace = shadow_gen_elements(&p, &dels, &adds);
+		if (s->cmds[g->flush].replace)
+			s->cmds[g->flush].drop = 0;
+	}
+
+keep:
+	shadow_items_clean(&dels);
+	shadow_items_clean(&adds);
+	shadow_items_move(&o->items, &g->items);
+	o->known = 1;
+}
+
+static void shadow_group_resolve(struct shadow_script *s, struct shadow_group *g)
+{
+	struct shadow_obj *o = g->obj;
+
+	if (!o) {
+		shadow_items_clean(&g->items);
+		return;
+	}
+
+	o->group = -1;
+
+	if (g->forced) {
+		shadow_items_clean(&g->items);
+		shadow_obj_forget(NULL, o);
+		return;
+	}
+
+	if (o->type == SHADOW_MAP) {
+		shadow_group_resolve_map(s, g);
+		return;
+	}
+
+	if (o->known && shadow_rules_equal(&o->items, &g->items)) {
+		shadow_group_drop(s, g);
+		shadow_items_clean(&g->items);
+		return;
+	}
+
+	shadow_items_move(&o->items, &g->items);
+	o->known = 1;
+}
+
+static void shadow_script_clean(struct shadow_script *s)
+{
+	int i;
+
+	for (i = 0; i < s->ncmds; i++) {
+		free(s->cmds[i].text);
+		free(s->cmds[i].replace);
+	}
+
+	for (i = 0; i < s->ngroups; i++) {
+		if (s->groups[i]->obj)
+			s->groups[i]->obj->group = -1;
+		shadow_items_clean(&s->groups[i]->items);
+		free(s->groups[i]->cmds);
+		free(s->groups[i]);
+	}
+
+	free(s->cmds);
+	free(s->groups);
+}
+
+static void shadow_reset_objs(struct shadow_script *s)
+{
+	struct shadow_obj *o, *next;
+	int i;
+
+	for (i = 0; i < SHADOW_HASH_SIZE; i++)
+		list_for_each_entry_safe(o, next, &shadow_hash[i], list)
+			shadow_obj_delete(s, o);
+}
+
+/*
+ * Filter the script through the shadow model, writing into out the
+ * commands that actually change the ruleset. Returns the number of
+ * commands to be executed, or -1 if the script couldn't be processed
+ * and has to be executed as it is.
+ */
+int shadow_filter(const char *script, struct sbuffer *out)
+{
+	struct shadow_script s = { NULL, 0, SHADOW_INIT_CMDS, NULL, 0 };
+	struct shadow_parsed p;
+	int emitted = 0;
+	int i;
+
+	shadow_init();
+
+	s.cmds = (struct shadow_cmd *)malloc(sizeof(struct shadow_cmd) * s.size);
+	if (!s.cmds || shadow_split(script, &s)) {
+		tools_printlog(LOG_ERR, "%s():%d: unable to parse the nft script", __FUNCTION__, __LINE__);
+		shadow_script_clean(&s);
+		shadow_reset();
+		return -1;
+	}
+
+	for (i = 0; i < s.ncmds; i++) {
+		if (!shadow_parse(s.cmds[i].text, &p))
+			continue;
+
+		switch (p.object) {
+		case SHADOW_OBJ_RULESET:
+			shadow_reset_objs(&s);
+			break;
+		case SHADOW_OBJ_TABLE:
+			shadow_cmd_table(&s, &p);
+			break;
+		case SHADOW_OBJ_CHAIN:
+			shadow_cmd_chain(&s, &p, i);
+			break;
+		case SHADOW_OBJ_RULE:
+			shadow_cmd_rule(&s, &p, i);
+			break;
+		case SHADOW_OBJ_MAP:
+			shadow_cmd_map(&s, &p, i);
+			break;
+		case SHADOW_OBJ_ELEMENT:
+			shadow_cmd_element(&s, &p, i);
+			break;
+		default:
+			break;
+		}
+	}
+
+	for (i = 0; i < s.ngroups; i++)
+		shadow_group_resolve(&s, s.groups[i]);
+
+	for (i = 0; i < s.ncmds; i++) {
+		if (s.cmds[i].drop)
+			continue;
+		concat_buf(out, "%s%s", emitted ? " ; " : "", s.cmds[i].replace ? s.cmds[i].replace : s.cmds[i].text);
+		emitted++;
+	}
+
+	if (emitted != s.ncmds)
+		tools_printlog(LOG_DEBUG, "%s():%d: %d of %d nft commands are already in place", __FUNCTION__, __LINE__, s.ncmds - emitted, s.ncmds);
+
+	shadow_script_clean(&s);
+
+	return emitted;
+}
+
+void shadow_reset(void)
+{
+	if (!shadow_ready)
+		return;
+
+	shadow_reset_objs(NULL);
+}
+
+void shadow_fini(void)
+{
+	shadow_reset();
+}
@@ -0,0 +1,245 @@
+/*
+ *   This file is part of nftlb, nftables load balancer.
+ *
+ *   Copyright (C) ZEVENET SL.
+ *   Author: Laura Garcia <laura.garcia@zevenet.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Affero General Public License as
+ *   published by the Free Software Foundation, either version 3 of the
+ *   License, or any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Affero General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Affero General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "slab.h"
+#include "objindex.h"
+#include "stats.h"
+#include "tools.h"
+
+/* the pools and strings are only used from the main loop */
+
+struct slab_chunk {
+	struct list_head	list;
+	void			*free;
+	unsigned int		used;
+	unsigned int		carved;
+};
+
+#define SLAB_CHUNK_HDR		((sizeof(struct slab_chunk) + SLAB_ALIGN - 1) & ~(SLAB_ALIGN - 1))
+
+struct slab_str {
+	struct objindex_node	hnode;
+	unsigned int		refs;
+	char			str[];
+};
+
+static LIST_HEAD(slab_pools);
+
+static struct objindex strings_index;
+static unsigned long strings_bytes;
+static unsigned long strings_refs;
+
+static struct slab_chunk *slab_chunk_of(void *obj)
+{
+	return (struct slab_chunk *)((uintptr_t)obj & ~((uintptr_t)SLAB_CHUNK_SIZE - 1));
+}
+
+static struct slab_chunk *slab_chunk_create(struct slab_pool *pool)
+{
+	struct slab_chunk *chunk;
+
+	if (!pool->per_chunk) {
+		pool->per_chunk = (SLAB_CHUNK_SIZE - SLAB_CHUNK_HDR) / pool->size;
+		if (!pool->per_chunk) {
+			tools_printlog(LOG_ERR, "%s():%d: objects of pool %s are too big", __FUNCTION__, __LINE__, pool->name);
+			return NULL;
+		}
+	}
+
+	if (posix_memalign((void **)&chunk, SLAB_CHUNK_SIZE, SLAB_CHUNK_SIZE)) {
+		tools_printlog(LOG_ERR, "%s():%d: pool %s memory allocation error", __FUNCTION__, __LINE__, pool->name);
+		return NULL;
+	}
+
+	chunk->free = NULL;
+	chunk->used = 0;
+	chunk->carved = 0;
+	list_add(&chunk->list, &pool->chunks);
+
+	if (list_empty(&pool->list))
+		list_add_tail(&pool->list, &slab_pools);
+
+	pool->total_chunks++;
+	pool->empty++;
+
+	return chunk;
+}
+
+void *slab_alloc(struct slab_pool *pool)
+{
+	struct slab_chunk *chunk;
+	void *obj;
+
+	if (list_empty(&pool->chunks))
+		chunk = slab_chunk_create(pool);
+	else
+		chunk = list_first_entry(&pool->chunks, struct slab_chunk, list);
+
+	if (!chunk)
+		return NULL;
+
+	if (chunk->free) {
+		obj = chunk->free;
+		chunk->free = *(void **)obj;
+	} else
+		obj = (char *)chunk + SLAB_CHUNK_HDR + chunk->carved++ * pool->size;
+
+	if (chunk->used++ == 0)
+		pool->empty--;
+
+	/* full chunks are out of the list until an object is released */
+	if (chunk->used == pool->per_chunk)
+		list_del_init(&chunk->list);
+
+	pool->used++;
+	pool->allocs++;
+
+	return obj;
+}
+
+void slab_free(struct slab_pool *pool, void *obj)
+{
+	struct slab_chunk *chunk;
+
+	if (!obj)
+		return;
+
+	chunk = slab_chunk_of(obj);
+
+	if (chunk->used == pool->per_chunk)
+		list_add(&chunk->list, &pool->chunks);
+
+	*(void **)obj = chunk->free;
+	chunk->free = obj;
+	pool->used--;
+
+	if (--chunk->used)
+		return;
+
+	if (!pool->empty) {
+		pool->empty++;
+		return;
+	}
+
+	list_del(&chunk->list);
+	free(chunk);
+	pool->total_chunks--;
+}
+
+static struct slab_str *slab_str_lookup(const char *str, unsigned int hash)
+{
+	struct slab_str *s;
+	struct hlist_node *pos;
+
+	hlist_for_each_entry(s, pos, objindex_bucket(&strings_index, hash), hnode.node) {
+		if (s->hnode.hash == hash && strcmp(s->str, str) == 0)
+			return s;
+	}
+
+	return NULL;
+}
+
+char *slab_str_get(const char *str)
+{
+	unsigned int hash = objindex_hash_str(str, 0);
+	struct slab_str *s;
+	size_t len;
+
+	s = slab_str_lookup(str, hash);
+	if (s) {
+		s->refs++;
+		strings_refs++;
+		return s->str;
+	}
+
+	len = strlen(str) + 1;
+	s = (struct slab_str *)malloc(sizeof(struct slab_str) + len);
+	if (!s) {
+		tools_printlog(LOG_ERR, "%s():%d: string memory allocation error", __FUNCTION__, __LINE__);
+		return NULL;
+	}
+
+	memcpy(s->str, str, len);
+	s->refs = 1;
+
+	if (objindex_add(&strings_index, &s->hnode, hash)) {
+		free(s);
+		return NULL;
+	}
+
+	strings_bytes += len;
+	strings_refs++;
+
+	return s->str;
+}
+
+void slab_str_put(char *str)
+{
+	struct slab_str *s;
+
+	if (!str)
+		return;
+
+	s = (struct slab_str *)(str - offsetof(struct slab_str, str));
+	strings_refs--;
+
+	if (--s->refs)
+		return;
+
+	objindex_del(&strings_index, &s->hnode);
+	strings_bytes -= strlen(s->str) + 1;
+	free(s);
+}
+
+int slab_dump_metrics(struct sbuffer *buf)
+{
+	struct slab_pool *pool;
+
+	stats_metric_header(buf, "nftlb_slab_objects", "gauge", "Objects in use by pool.");
+	list_for_each_entry(pool, &slab_pools, list)
+		concat_buf(buf, "nftlb_slab_objects{pool=\"%s\"} %lu\n", pool->name, pool->used);
+
+	stats_metric_header(buf, "nftlb_slab_capacity", "gauge", "Objects that fit in the chunks allocated by pool.");
+	list_for_each_entry(pool, &slab_pools, list)
+		concat_buf(buf, "nftlb_slab_capacity{pool=\"%s\"} %lu\n", pool->name, pool->total_chunks * pool->per_chunk);
+
+	stats_metric_header(buf, "nftlb_slab_bytes", "gauge", "Memory of the chunks allocated by pool.");
+	list_for_each_entry(pool, &slab_pools, list)
+		concat_buf(buf, "nftlb_slab_bytes{pool=\"%s\"} %lu\n", pool->name, pool->total_chunks * SLAB_CHUNK_SIZE);
+
+	stats_metric_header(buf, "nftlb_slab_allocs_total", "counter", "Objects allocated by pool.");
+	list_for_each_entry(pool, &slab_pools, list)
+		concat_buf(buf, "nftlb_slab_allocs_total{pool=\"%s\"} %lu\n", pool->name, pool->allocs);
+
+	stats_metric_header(buf, "nftlb_strings", "gauge", "Interned attribute strings.");
+	concat_buf(buf, "nftlb_strings %u\n", strings_index.count);
+	stats_metric_header(buf, "nftlb_string_refs", "gauge", "Attributes referencing an interned string.");
+	concat_buf(buf, "nftlb_string_refs %lu\n", strings_refs);
+	stats_metric_header(buf, "nftlb_string_bytes", "gauge", "Memory of the interned strings.");
+	concat_buf(buf, "nftlb_string_bytes %lu\n", strings_bytes);
+
+	return 0;
+}
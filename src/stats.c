@@ -0,0 +1,335 @@
+/*
+ *   This file is part of nftlb, nftables load balancer.
+ *
+ *   Copyright (C) ZEVENET SL.
+ *   Author: Laura Garcia <laura.garcia@zevenet.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Affero General Public License as
+ *   published by the Free Software Foundation, either version 3 of the
+ *   License, or any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Affero General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Affero General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "stats.h"
+#include "tools.h"
+
+#define STATS_MAX_ENDPOINTS	32
+#define STATS_MAX_NAME		32
+#define STATS_ENDPOINT_INTERNAL	"internal"
+#define STATS_MAX_STATUS	8
+
+struct stats_endpoint {
+	char			name[STATS_MAX_NAME];
+	struct stats_hist	phase[STATS_PHASE_MAX];
+};
+
+static const char *stats_phases[] = {
+	"parse",
+	"json",
+	"apply",
+	"rules",
+	"commit",
+	"total",
+};
+
+struct stats_status {
+	int			code;
+	unsigned long		count;
+};
+
+static struct stats_endpoint endpoints[STATS_MAX_ENDPOINTS];
+static int total_endpoints;
+
+static unsigned long counters[STATS_CNT_MAX];
+static struct stats_hist rulerize;
+static struct stats_status responses[STATS_MAX_STATUS];
+static int total_responses;
+
+/* the timers are only used from the main loop */
+static struct stats_timer *current_timer;
+static struct stats_request *current_request;
+
+uint64_t stats_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+const char *stats_phase_name(int phase)
+{
+	return stats_phases[phase];
+}
+
+static struct stats_endpoint *stats_endpoint_get(const char *name)
+{
+	struct stats_endpoint *ep;
+	int i;
+
+	for (i = 0; i < total_endpoints; i++) {
+		if (strcmp(endpoints[i].name, name) == 0)
+			return &endpoints[i];
+	}
+
+	if (total_endpoints == STATS_MAX_ENDPOINTS) {
+		tools_printlog(LOG_DEBUG, "%s():%d: too many endpoints, %s not accounted", __FUNCTION__, __LINE__, name);
+		return NULL;
+	}
+
+	ep = &endpoints[total_endpoints++];
+	snprintf(ep->name, STATS_MAX_NAME, "%s", name);
+
+	return ep;
+}
+
+void stats_hist_add(struct stats_hist *h, uint64_t nsecs)
+{
+	uint64_t usecs = nsecs / 1000;
+	int i = 0;
+
+	while (i < STATS_HIST_BUCKETS - 1 && usecs > (1ULL << i))
+		i++;
+
+	h->count++;
+	h->sum += nsecs;
+	h->bucket[i]++;
+}
+
+void stats_phase_begin(struct stats_timer *t, int phase)
+{
+	t->phase = phase;
+	t->nested = 0;
+	t->parent = current_timer;
+	current_timer = t;
+	t->start = stats_now();
+}
+
+void stats_phase_end(struct stats_timer *t)
+{
+	uint64_t elapsed = stats_now() - t->start;
+	struct stats_endpoint *ep;
+
+	current_timer = t->parent;
+	if (t->parent)
+		t->parent->nested += elapsed;
+
+	elapsed -= t->nested;
+
+	if (current_request) {
+		current_request->phase[t->phase] += elapsed;
+		return;
+	}
+
+	/* changes not requested through the API, like netlink events */
+	ep = stats_endpoint_get(STATS_ENDPOINT_INTERNAL);
+	if (ep)
+		stats_hist_add(&ep->phase[t->phase], elapsed);
+}
+
+void stats_request_init(struct stats_request *r)
+{
+	memset(r, 0, sizeof(struct stats_request));
+	r->start = stats_now();
+}
+
+/* the phases are accounted to the given request until it's unset */
+void stats_request_set(struct stats_request *r)
+{
+	current_request = r;
+}
+
+void stats_request_done(struct stats_request *r, const char *endpoint)
+{
+	struct stats_endpoint *ep = stats_endpoint_get(endpoint);
+	int i;
+
+	r->phase[STATS_PHASE_TOTAL] = stats_now() - r->start;
+
+	if (!ep)
+		return;
+
+	for (i = 0; i < STATS_PHASE_MAX; i++) {
+		if (r->phase[i] || i == STATS_PHASE_TOTAL)
+			stats_hist_add(&ep->phase[i], r->phase[i]);
+	}
+}
+
+static void stats_dump_hist(struct sbuffer *buf, const char *name, struct stats_hist *h)
+{
+	int i;
+
+	concat_buf(buf, "{\"phase\":\"%s\",\"count\":%lu,\"sum-us\":%llu,\"histogram\":[",
+		   name, h->count, (unsigned long long)(h->sum / 1000));
+	for (i = 0; i < STATS_HIST_BUCKETS; i++)
+		concat_buf(buf, "%s%lu", i ? "," : "", h->bucket[i]);
+	concat_buf(buf, "]}");
+}
+
+/*
+ * Latency histograms per endpoint and phase, the bucket limits are given
+ * once in buckets-us.
+ */
+int stats_dump_latency(struct sbuffer *buf)
+{
+	struct stats_endpoint *ep;
+	int i, j, first;
+
+	concat_buf(buf, "{\"buckets-us\":[");
+	for (i = 0; i < STATS_HIST_BUCKETS - 1; i++)
+		concat_buf(buf, "%s%llu", i ? "," : "", 1ULL << i);
+	concat_buf(buf, ",\"+Inf\"],\"latency\":[");
+
+	for (i = 0; i < total_endpoints; i++) {
+		ep = &endpoints[i];
+		concat_buf(buf, "%s{\"endpoint\":\"%s\",\"phases\":[", i ? "," : "", ep->name);
+		for (j = 0, first = 1; j < STATS_PHASE_MAX; j++) {
+			if (!ep->phase[j].count)
+				continue;
+			if (!first)
+				concat_buf(buf, ",");
+			stats_dump_hist(buf, stats_phases[j], &ep->phase[j]);
+			first = 0;
+		}
+		concat_buf(buf, "]}");
+	}
+
+	concat_buf(buf, "]}\n");
+
+	return 0;
+}
+
+/* the nft commands may be committed from the worker thread */
+void stats_count(int counter, unsigned long n)
+{
+	__atomic_add_fetch(&counters[counter], n, __ATOMIC_RELAXED);
+}
+
+static unsigned long stats_get_count(int counter)
+{
+	return __atomic_load_n(&counters[counter], __ATOMIC_RELAXED);
+}
+
+void stats_rulerize_done(uint64_t nsecs)
+{
+	stats_hist_add(&rulerize, nsecs);
+}
+
+void stats_http_response(int code)
+{
+	int i;
+
+	for (i = 0; i < total_responses; i++) {
+		if (responses[i].code == code) {
+			responses[i].count++;
+			return;
+		}
+	}
+
+	if (total_responses == STATS_MAX_STATUS)
+		return;
+
+	responses[total_responses].code = code;
+	responses[total_responses++].count = 1;
+}
+
+void stats_metric_header(struct sbuffer *buf, const char *name, const char *type, const char *help)
+{
+	concat_buf(buf, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/* the prometheus buckets are cumulative and given in seconds */
+static void stats_metric_hist(struct sbuffer *buf, const char *name, const char *labels, struct stats_hist *h)
+{
+	unsigned long acc = 0;
+	const char *sep = labels[0] ? "," : "";
+	int i;
+
+	for (i = 0; i < STATS_HIST_BUCKETS - 1; i++) {
+		acc += h->bucket[i];
+		concat_buf(buf, "%s_bucket{%s%sle=\"%.7g\"} %lu\n", name, labels, sep,
+			   (1ULL << i) / 1000000., acc);
+	}
+	concat_buf(buf, "%s_bucket{%s%sle=\"+Inf\"} %lu\n", name, labels, sep, h->count);
+	concat_buf(buf, "%s_sum%s%s%s %.9f\n", name, labels[0] ? "{" : "", labels,
+		   labels[0] ? "}" : "", h->sum / 1000000000.);
+	concat_buf(buf, "%s_count%s%s%s %lu\n", name, labels[0] ? "{" : "", labels,
+		   labels[0] ? "}" : "", h->count);
+}
+
+static unsigned long stats_get_rss(void)
+{
+	unsigned long size, resident;
+	FILE *fd;
+
+	fd = fopen("/proc/self/statm", "r");
+	if (!fd)
+		return 0;
+
+	if (fscanf(fd, "%lu %lu", &size, &resident) != 2)
+		resident = 0;
+	fclose(fd);
+
+	return resident * sysconf(_SC_PAGESIZE);
+}
+
+/*
+ * Daemon counters and latency histograms in the prometheus text format,
+ * printed straight into the buffer.
+ */
+int stats_dump_metrics(struct sbuffer *buf)
+{
+	char labels[STATS_MAX_NAME * 2];
+	int i, j;
+
+	stats_metric_header(buf, "nftlb_nft_commands_total", "counter", "nft scripts and netlink batches committed.");
+	concat_buf(buf, "nftlb_nft_commands_total %lu\n", stats_get_count(STATS_CNT_NFT_CMDS));
+	stats_metric_header(buf, "nftlb_nft_command_bytes_total", "counter", "Bytes of the nft scripts and netlink batches committed.");
+	concat_buf(buf, "nftlb_nft_command_bytes_total %lu\n", stats_get_count(STATS_CNT_NFT_BYTES));
+	stats_metric_header(buf, "nftlb_nft_command_errors_total", "counter", "nft commits refused by the kernel.");
+	concat_buf(buf, "nftlb_nft_command_errors_total %lu\n", stats_get_count(STATS_CNT_NFT_ERRORS));
+
+	stats_metric_header(buf, "nftlb_recoveries_total", "counter", "Reloads of the whole ruleset after a failed commit.");
+	concat_buf(buf, "nftlb_recoveries_total{result=\"success\"} %lu\n", stats_get_count(STATS_CNT_RECOVERY));
+	concat_buf(buf, "nftlb_recoveries_total{result=\"failed\"} %lu\n", stats_get_count(STATS_CNT_RECOVERY_FAILED));
+
+	stats_metric_header(buf, "nftlb_netlink_events_total", "counter", "Neighbour messages received from the kernel.");
+	concat_buf(buf, "nftlb_netlink_events_total %lu\n", stats_get_count(STATS_CNT_NETLINK_EVENTS));
+
+	stats_metric_header(buf, "nftlb_http_responses_total", "counter", "API responses by status code.");
+	for (i = 0; i < total_responses; i++)
+		concat_buf(buf, "nftlb_http_responses_total{code=\"%d\"} %lu\n", responses[i].code, responses[i].count);
+
+	stats_metric_header(buf, "nftlb_rulerize_duration_seconds", "histogram", "Time spent generating and applying the whole ruleset.");
+	stats_metric_hist(buf, "nftlb_rulerize_duration_seconds", "", &rulerize);
+
+	stats_metric_header(buf, "nftlb_request_phase_seconds", "histogram", "Time spent in every phase of the requests by endpoint.");
+	for (i = 0; i < total_endpoints; i++) {
+		for (j = 0; j < STATS_PHASE_MAX; j++) {
+			if (!endpoints[i].phase[j].count)
+				continue;
+			snprintf(labels, sizeof(labels), "endpoint=\"%s\",phase=\"%s\"",
+				 endpoints[i].name, stats_phases[j]);
+			stats_metric_hist(buf, "nftlb_request_phase_seconds", labels, &endpoints[i].phase[j]);
+		}
+	}
+
+	stats_metric_header(buf, "process_resident_memory_bytes", "gauge", "Resident memory size in bytes.");
+	concat_buf(buf, "process_resident_memory_bytes %lu\n", stats_get_rss());
+
+	return 0;
+}
@@ -0,0 +1,227 @@
+/*
+ *   This file is part of nftlb, nftables load balancer.
+ *
+ *   Copyright (C) ZEVENET SL.
+ *   Author: Laura Garcia <laura.garcia@zevenet.com>
+ *
+ *   This program is free software: you can redistribute it and/or modify
+ *   it under the terms of the GNU Affero General Public License as
+ *   published by the Free Software Foundation, either version 3 of the
+ *   License, or any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU Affero General Public License for more details.
+ *
+ *   You should have received a copy of the GNU Affero General Public License
+ *   along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ */
+
+/*
+ * The commit worker executes the nft commands out of the event loop.
+ * Jobs are queued in order by the main thread and executed one by one
+ * by the worker thread, the results are handed back to the loop through
+ * an ev_async watcher where the done callback is called for every job.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "worker.h"
+#include "events.h"
+#include "tools.h"
+
+struct worker {
+	pthread_t			thread;
+	pthread_mutex_t		lock;
+	pthread_cond_t		jobs_cond;
+	pthread_cond_t		idle_cond;
+	struct list_head	jobs;
+	struct list_head	done;
+	int					running;
+	int					busy;
+	int					stop;
+	unsigned long		seq;
+	worker_exec_fn		exec;
+	worker_done_fn		done_cb;
+};
+
+static struct worker wk = {
+	.lock		= PTHREAD_MUTEX_INITIALIZER,
+	.jobs_cond	= PTHREAD_COND_INITIALIZER,
+	.idle_cond	= PTHREAD_COND_INITIALIZER,
+	.jobs		= LIST_HEAD_INIT(wk.jobs),
+	.done		= LIST_HEAD_INIT(wk.done),
+};
+
+static void worker_job_delete(struct worker_job *job)
+{
+	if (job->cmd)
+		free(job->cmd);
+	if (job->full)
+		free(job->full);
+	free(job);
+}
+
+static void *worker_run(void *arg)
+{
+	struct worker_job *job;
+
+	pthread_mutex_lock(&wk.lock);
+	while (1) {
+		while (list_empty(&wk.jobs) && !wk.stop)
+			pthread_cond_wait(&wk.jobs_cond, &wk.lock);
+
+		if (list_empty(&wk.jobs))
+			break;
+
+		job = list_first_entry(&wk.jobs, struct worker_job, list);
+		list_del(&job->list);
+		wk.busy = 1;
+		pthread_mutex_unlock(&wk.lock);
+
+		job->error = wk.exec(job);
+
+		pthread_mutex_lock(&wk.lock);
+		wk.busy = 0;
+		list_add_tail(&job->list, &wk.done);
+		if (list_empty(&wk.jobs))
+			pthread_cond_broadcast(&wk.idle_cond);
+
+		ev_async_send(get_loop(), events_get_worker());
+	}
+	pthread_mutex_unlock(&wk.lock);
+
+	return NULL;
+}
+
+static void worker_process_done(void)
+{
+	struct worker_job *job, *next;
+	LIST_HEAD(done);
+
+	pthread_mutex_lock(&wk.lock);
+	list_splice_init(&wk.done, &done);
+	pthread_mutex_unlock(&wk.lock);
+
+	list_for_each_entry_safe(job, next, &done, list) {
+		list_del(&job->list);
+		wk.done_cb(job);
+		worker_job_delete(job);
+	}
+}
+
+static void worker_done_cb(struct ev_loop *loop, ev_async *watcher, int revents)
+{
+	worker_process_done();
+}
+
+int worker_start(worker_exec_fn exec, worker_done_fn done)
+{
+	struct ev_async *async;
+
+	if (wk.running)
+		return 0;
+
+	async = events_create_worker();
+	if (!async) {
+		tools_printlog(LOG_ERR, "%s():%d: worker watcher memory allocation error", __FUNCTION__, __LINE__);
+		return -1;
+	}
+
+	ev_async_init(async, worker_done_cb);
+	ev_async_start(get_loop(), async);
+
+	wk.exec = exec;
+	wk.done_cb = done;
+	wk.stop = 0;
+
+	if (pthread_create(&wk.thread, NULL, worker_run, NULL) != 0) {
+		tools_printlog(LOG_ERR, "%s():%d: unable to create the commit worker", __FUNCTION__, __LINE__);
+		events_delete_worker();
+		return -1;
+	}
+
+	wk.running = 1;
+	tools_printlog(LOG_INFO, "%s():%d: nft commands are executed by the commit worker", __FUNCTION__, __LINE__);
+
+	return 0;
+}
+
+/* wait for the pending jobs, deliver their results and stop the thread */
+void worker_stop(void)
+{
+	if (!wk.running)
+		return;
+
+	pthread_mutex_lock(&wk.lock);
+	wk.stop = 1;
+	pthread_cond_signal(&wk.jobs_cond);
+	pthread_mutex_unlock(&wk.lock);
+
+	pthread_join(wk.thread, NULL);
+	wk.running = 0;
+
+	worker_process_done();
+	events_delete_worker();
+}
+
+int worker_is_running(void)
+{
+	return wk.running;
+}
+
+/*
+ * Queue a job, the commands are copied. Returns the sequence number of
+ * the job, or 0 if it couldn't be queued.
+ */
+unsigned long worker_submit(const char *cmd, const char *full, unsigned int epoch)
+{
+	struct worker_job *job = (struct worker_job *)calloc(1, sizeof(struct worker_job));
+
+	if (!job) {
+		tools_printlog(LOG_ERR, "%s():%d: worker job memory allocation error", __FUNCTION__, __LINE__);
+		return 0;
+	}
+
+	job->cmd = strdup(cmd);
+	job->full = strdup(full);
+	if (!job->cmd || !job->full) {
+		tools_printlog(LOG_ERR, "%s():%d: worker job memory allocation error", __FUNCTION__, __LINE__);
+		worker_job_delete(job);
+		return 0;
+	}
+	job->epoch = epoch;
+
+	pthread_mutex_lock(&wk.lock);
+	job->seq = ++wk.seq;
+	list_add_tail(&job->list, &wk.jobs);
+	pthread_cond_signal(&wk.jobs_cond);
+	pthread_mutex_unlock(&wk.lock);
+
+	return job->seq;
+}
+
+unsigned long worker_get_seq(void)
+{
+	return wk.seq;
+}
+
+/*
+ * Wait until every queued job has been executed and keep the worker
+ * stopped until worker_unlock(), so the caller can run commands by itself.
+ */
+void worker_lock(void)
+{
+	pthread_mutex_lock(&wk.lock);
+	while (!list_empty(&wk.jobs) || wk.busy)
+		pthread_cond_wait(&wk.idle_cond, &wk.lock);
+}
+
+void worker_unlock(void)
+{
+	pthread_mutex_unlock(&wk.lock);
+}
@@ -46,8 +46,14 @@ for DIRTEST in `ls -d */`; do
 		fi
 	fi
 	CURL_OUTPUT="report-${INDEX_OUT}-req.out"
-	rm -f report-*-req.out
-	$CURL -H "Key: $APISRV_KEY" -X $VERB $CURL_ARGS http://$APISRV_ADDR:$APISRV_PORT/$URI -o "$CURL_OUTPUT" 2> /dev/null
+	HEADERS_OUTPUT="report-${INDEX_OUT}-hdr.out"
+	rm -f report-*-req.out report-*-hdr.out
+	$CURL -H "Key: $APISRV_KEY" -H "$HEADER" -X $VERB $CURL_ARGS http://$APISRV_ADDR:$APISRV_PORT/$URI -o "$CURL_OUTPUT" -D "$HEADERS_OUTPUT" 2> /dev/null
+
+	# keep the last etag sent, the next tests can ask with it
+	if grep -q "^ETag: " "$HEADERS_OUTPUT"; then
+		ETAG=`grep "^ETag: " "$HEADERS_OUTPUT" | cut -d' ' -f2 | tr -d '\r'`
+	fi
 
 	FEXEC="pos.sh"
 	if [ -x $FEXEC ]; then
@@ -73,6 +79,31 @@ for DIRTEST in `ls -d */`; do
 		echo -en "\e[33mUNKNOWN\e[0m) "
 	fi
 
+	# checking the status and etag of the response
+	if [ "$CHECK_HEADERS" = "1" ]; then
+		CHECK_OUTPUT="hdr.out"
+		grep -E "^(HTTP/|ETag: )" "$HEADERS_OUTPUT" | tr -d '\r' > "$HEADERS_OUTPUT.tmp"
+		mv "$HEADERS_OUTPUT.tmp" "$HEADERS_OUTPUT"
+		echo -n "(headers:"
+		if [ -f "$CHECK_OUTPUT" ]; then
+			if [ "`diff -Nru $CHECK_OUTPUT $HEADERS_OUTPUT`" != "" ]; then
+				echo -en "\e[31mFAILURE\e[0m) "
+				diff -Nru $CHECK_OUTPUT $HEADERS_OUTPUT
+				if [ $APPLY_REPORTS -eq 1 ]; then
+					cat $HEADERS_OUTPUT > $CHECK_OUTPUT
+					echo -en "APPLIED "
+				fi
+			else
+				echo -en "\e[32mOK\e[0m) "
+				rm -f report-*-hdr.out
+			fi
+		else
+			echo -en "\e[33mUNKNOWN\e[0m) "
+		fi
+	else
+		rm -f report-*-hdr.out
+	fi
+
 	# check nft output
 	CHECK_OUTPUT="nft.out"
 	NFT_OUTPUT="report-${INDEX_OUT}-nft.out"
@@ -122,6 +153,8 @@ for DIRTEST in `ls -d */`; do
 	echo ""
 
 	CURL_ARGS=
+	HEADER=
+	CHECK_HEADERS=
 	INDEX=$(($INDEX+1));
 	cd ../
 
@@ -0,0 +1,63 @@
+#!/bin/bash
+
+# Time the nft script generation for synthetic configurations of
+# FARMS farms x BACKENDS backends x PORTS virtual ports, without
+# applying anything to the kernel.
+#
+# Usage: ./bench_compile.sh [FARMS] [BACKENDS] [PORTS] [RUNS]
+#
+# The binary is taken from NFTLBIN if set, as done by "make bench" for
+# out-of-tree builds, or from ../src/nftlb otherwise.
+
+FARMS="${1:-100}"
+BACKENDS="${2:-10}"
+PORTS="${3:-4}"
+RUNS="${4:-5}"
+NFTLBIN="${NFTLBIN:-../src/nftlb}"
+INPUTFILE=`mktemp /tmp/nftlb-bench-XXXXXX.json`
+OUTPUTFILE=`mktemp /tmp/nftlb-bench-XXXXXX.nft`
+
+trap "rm -f $INPUTFILE $OUTPUTFILE" EXIT
+
+gen_ports() {
+	local ports="80"
+
+	for p in `seq 1 $((PORTS - 1))`; do
+		ports="${ports},$((80 + p))"
+	done
+
+	echo -n "$ports"
+}
+
+gen_config() {
+	local ports=`gen_ports`
+
+	echo '{ "farms" : ['
+	for f in `seq 1 $FARMS`; do
+		[ $f -gt 1 ] && echo ','
+		echo "{ \"name\" : \"lb$f\", \"family\" : \"ipv4\","
+		echo "\"virtual-addr\" : \"10.$((f / 250)).$((f % 250)).1\", \"virtual-ports\" : \"$ports\","
+		echo '"mode" : "snat", "protocol" : "tcp", "scheduler" : "weight", "state" : "up",'
+		echo '"backends" : ['
+		for b in `seq 1 $BACKENDS`; do
+			[ $b -gt 1 ] && echo ','
+			echo "{ \"name\" : \"bck$b\", \"ip-addr\" : \"172.$((f / 250)).$((f % 250)).$((b % 250 + 1))\", \"weight\" : \"$((b % 5 + 1))\", \"state\" : \"up\" }"
+		done
+		echo '] }'
+	done
+	echo '] }'
+}
+
+gen_config > $INPUTFILE
+
+echo "-- Compiling $FARMS farms x $BACKENDS backends x $PORTS ports, $RUNS runs"
+
+for r in `seq 1 $RUNS`; do
+	$NFTLBIN -l 0 -C $INPUTFILE -o $OUTPUTFILE
+	if [ $? -ne 0 ]; then
+		echo -e "\e[31mCOMPILE ERROR\e[0m"
+		exit 1
+	fi
+done
+
+echo "-- Script: `wc -l < $OUTPUTFILE` lines, `wc -c < $OUTPUTFILE` bytes"